@@ -0,0 +1,88 @@
+#ifndef GAME_CONTEXT_H
+#define GAME_CONTEXT_H
+
+#include "globals.h"
+#include <Leds.h>
+#include <Animation.h>
+#include <Journal.h>
+#include <KeypadDriver.h>
+#include <SpscQueue.h>
+#include <memory>
+
+/**
+ * @struct GameContext
+ * @brief Everything one room shares between its puzzles: the current stage, the peripherals, the LED frame with its
+ * segments and animations, the countdown, the journal and the queues to the network task.
+ *
+ * The firmware has exactly one, in its Room. The puzzles, the pipeline and the MQTT link take it by reference, so a
+ * host build can run as many rooms side by side as it likes (see src/native/games.cpp). It is neither copied nor
+ * moved: the segments, animations and the keypad driver keep references into it.
+ */
+struct GameContext
+{
+    GameContext() = default;
+    GameContext(const GameContext &) = delete;
+    GameContext &operator=(const GameContext &) = delete;
+
+    stage currentStage = READY;
+
+    // Wi-Fi and MQTT, network task side
+    hal::NetClient espClient;
+    hal::IPAddress mqtt_ip;
+    std::unique_ptr<hal::MqttClient> mqttClient; // created once the network task is up
+
+    // KEYPAD
+    hal::Keypad keypad{0x20};
+    KeypadDriver keypadDriver{keypad, keypadIntPin};
+
+    // LEDS
+    hal::Strip ws2812b{numFuelLeds + numStarLeds + 1 + numKeypadLeds, ledsPin};
+    LedFrame leds{ws2812b};
+    LedSegment fuelLeds{leds, 0, numFuelLeds};                                 // in tank order through Fuel::_ledMapping
+    LedSegment starLeds{leds, numFuelLeds, numStarLeds};                       // 16-19
+    LedSegment wheelsHintLed{leds, numFuelLeds + numStarLeds, 1};              // 20
+    LedSegment keypadLeds{leds, numFuelLeds + numStarLeds + 1, numKeypadLeds}; // 21-24
+    Animator animator{500 /*us per frame*/};
+    Animation keypadAnimation{animator, keypadLeds};
+
+    // TIMER
+    uint32_t publishedTimerSeconds = UINT32_MAX; // the countdown value last queued on ESP_TIMER_TOPIC
+    uint32_t displayedTimerSeconds = UINT32_MAX; // and last written to the display
+    unsigned long gameDuration = defaultGameDuration;
+    hal::CountDown timerCountDown{hal::CountDown::SECONDS};
+    hal::SegmentDisplay timerDisplay{0x70};
+
+    // METRICS
+    unsigned long lastMetricsPublished = 0;
+
+    // JOURNAL
+    Journal journal;
+
+    // CORE 0 <-> CORE 1
+    SpscQueue<NetEvent, 16> netEvents;       // network task -> game loop
+    SpscQueue<OutboundMessage, 16> outbound; // game loop -> network task
+
+    /**
+     * @brief Queues an event for the game loop and wakes it if it is idle. Only called from the network task.
+     */
+    void post(const NetEvent &event)
+    {
+        netEvents.push(event);
+        hal::idleWake();
+    }
+
+    /**
+     * @brief Queues a publish for the network task. Only called from the game loop.
+     *
+     * @return False if the queue is full, in which case the message is dropped and counted.
+     */
+    bool publish(const char *topic, const char *payload)
+    {
+        hal::trace().published(topic, payload);
+        OutboundMessage message;
+        message.set(topic, payload);
+        return outbound.push(message);
+    }
+};
+
+#endif /* GAME_CONTEXT_H */
@@ -0,0 +1,657 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include "GameContext.h"
+#include "utils.h"
+#include <Wheels.h>
+#include <Fuel.h>
+#include <Stars.h>
+#include <Metrics.h>
+#include <MqttLink.h>
+#include <Commands.h>
+#include <Pipeline.h>
+#include <Snapshot.h>
+#include <BootTimeline.h>
+#include <Outbox.h>
+#include <IdleMode.h>
+
+/**
+ * @class Room
+ * @brief One escape room: its GameContext, the three puzzles in their pipeline, and the game loop and network task
+ * that drive them.
+ *
+ * The firmware runs a single Room from setup() and loop() in main.cpp. Nothing in here is global, so a host build can
+ * run any number of rooms in one process, each on a thread with its own virtual board (see src/native/games.cpp).
+ * The members are public for the host tools, which look into a running room.
+ */
+class Room : public GameContext
+{
+public:
+    Room() : wheels(*this), fuel(*this), stars(*this), pipeline(*this, wheels, fuel, stars), mqttLink(*this) {}
+
+    Wheels wheels;
+    Fuel fuel;
+    Stars stars;
+    PuzzlePipeline<Wheels, Fuel, Stars> pipeline;
+    LoopMetrics loopMetrics;
+    IdleMode idleMode;
+    MqttLink mqttLink;
+    Outbox outbox;
+    CommandDispatcher commandDispatcher;
+    SnapshotStore snapshots;
+    bool resumedGame = false; // set in setup() before the network task starts, read-only afterwards
+    GameSnapshot resumeSnapshot;
+    BootTimeline bootTimeline;
+    static_assert(decltype(pipeline)::numPuzzles <= GameSnapshot::maxPuzzles, "every puzzle needs a state word in the snapshot");
+    bool linkUp = false;
+    stage journaledStage = READY;
+    unsigned long lastLinkStatsPublished = 0;
+
+    void resetGlobal()
+    {
+        pipeline.reset();
+        publish(ESP_TOPIC, GLOBAL_RESET);
+    }
+
+    void startGame()
+    {
+        timerCountDown.start(gameDuration);
+        pipeline.start();
+    }
+
+    std::pair<uint32_t, uint32_t> calcTimePassed()
+    {
+        const int MINUTE = 60;
+        uint32_t passedSeconds = gameDuration - timerCountDown.remaining();
+
+        uint32_t second = passedSeconds % MINUTE;
+        uint32_t minute = passedSeconds / MINUTE;
+
+        return std::make_pair(minute, second);
+    }
+
+    std::pair<uint32_t, uint32_t> calcRemainingTime()
+    {
+        const int MINUTE = 60;
+        uint32_t remainingSeconds;
+
+        if (currentStage == READY)
+            remainingSeconds = gameDuration;
+        else
+            remainingSeconds = timerCountDown.remaining();
+
+        uint32_t second = remainingSeconds % MINUTE;
+        uint32_t minute = remainingSeconds / MINUTE;
+
+        return std::make_pair(minute, second);
+    }
+
+    // "MM:SS" into `text`, which holds timeTextSize characters
+    static const size_t timeTextSize = 6;
+    static void formatTime(uint32_t minute, uint32_t second, char *text)
+    {
+        text[0] = '0' + minute / 10 % 10;
+        text[1] = '0' + minute % 10;
+        text[2] = ':';
+        text[3] = '0' + second / 10 % 10;
+        text[4] = '0' + second % 10;
+        text[5] = '\0';
+    }
+
+    /**
+     * @brief Called by the pipeline when the last puzzle is solved: reports how long the game took.
+     */
+    void onGameSolved()
+    {
+        auto [minute, second] = calcTimePassed();
+        char text[timeTextSize];
+        formatTime(minute, second, text);
+        publish(ESP_COMPLETION_TOPIC, text);
+    }
+
+    /**
+     * @brief Runs an admin command received by the network task. Game loop side.
+     */
+    void executeCommand(adminCommand command)
+    {
+        commandDispatcher.record(command);
+        journal.log(EVENT_ADMIN_COMMAND, command);
+        switch (command)
+        {
+        case CMD_START_GAME:
+            startGame();
+            break;
+        case CMD_WHEELS_HINT:
+            pipeline.hint<Wheels>();
+            break;
+        case CMD_WHEELS_SOLVE:
+            pipeline.solve<Wheels>();
+            break;
+        case CMD_FUEL_RESET:
+            fuel.reset(false /*global*/);
+            break;
+        case CMD_FUEL_HINT:
+            pipeline.hint<Fuel>();
+            break;
+        case CMD_FUEL_SOLVE:
+            pipeline.solve<Fuel>();
+            break;
+        case CMD_STARS_HINT:
+            pipeline.hint<Stars>();
+            break;
+        case CMD_STARS_SOLVE:
+            pipeline.solve<Stars>();
+            break;
+        case CMD_GLOBAL_RESET:
+            resetGlobal();
+            break;
+        case CMD_ADD_MIN:
+            gameDuration += 60;
+            break;
+        case CMD_SUB_MIN:
+            if (gameDuration > 60)
+                gameDuration -= 60;
+            break;
+        case CMD_COMPARTMENT_OPEN1:
+            wheels.compartment.open();
+            break;
+        case CMD_COMPARTMENT_OPEN2:
+            fuel.compartment.open();
+            break;
+        case CMD_COMPARTMENT_OPEN3:
+            stars.compartment.open();
+            break;
+        case CMD_JOURNAL_DUMP:
+            journal.requestDump();
+            break;
+        case CMD_UNKNOWN:
+            // already journaled and counted in the CMDS metrics line (unknown=) above
+            break;
+        }
+    }
+
+    /**
+     * @brief Handles the events queued by the network task: admin commands and broker connection changes.
+     */
+    void handleNetEvents()
+    {
+        NetEvent event;
+        while (hal::trace().event(netEvents.pop(event), event))
+        {
+            switch (event.type)
+            {
+            case NET_ADMIN_COMMAND:
+                executeCommand((adminCommand)event.value);
+                break;
+            case NET_LINK_STATE:
+                journal.log(EVENT_MQTT_STATE, event.value);
+                linkUp = event.value == LINK_CONNECTED;
+                break;
+            case NET_CONNECTED:
+                if (!event.value && currentStage == READY)
+                    utils::blinkKeypadLeds(*this, true);
+                else if (!event.value && resumedGame)
+                    pipeline.announceCompleted();
+                break;
+            }
+        }
+    }
+
+    // Wifi and MQTT functions, network task side
+    void callback(char *topic, byte *payload, unsigned int length)
+    {
+        post({NET_ADMIN_COMMAND, (uint8_t)commands::lookup(payload, length)});
+    }
+
+    /**
+     * @brief Joins the access point of the last boot directly, with its channel, BSSID and address, and falls back to
+     * WiFiManager (scan, DHCP and, without saved credentials, the configuration portal) when that fails.
+     */
+    void setup_wifi()
+    {
+        hal::WifiCache cache;
+        if (hal::storageRead("wifi", &cache, sizeof(cache)) == sizeof(cache) && hal::wifiConnectCached(cache, 3000))
+        {
+            bootTimeline.mark("wifi_cached");
+        }
+        else
+        {
+            // timeout connection to AP after 60 seconds
+            if (!hal::wifiAutoConnect("escape_room_game_AP", 60)) {
+                Serial.println("Failed to connect and hit timeout");
+            }
+            bootTimeline.mark("wifi");
+            if (hal::wifiCurrent(cache))
+                hal::storageWrite("wifi", &cache, sizeof(cache));
+        }
+        Serial.println("Connected to WiFi!");
+
+        if (!hal::mdnsBegin("esp32")) {
+            Serial.println("Error setting up MDNS responder!");
+        }
+    }
+
+    /**
+     * @brief Publishes the state of the broker connection on ESP_METRICS_TOPIC, how many events the
+     * game loop could not take in time, and what the outbox made of the publishes.
+     */
+    void publishLinkStats()
+    {
+        char stats[140];
+        snprintf(stats, sizeof(stats), "MQTT connects=%lu reconnects=%lu failures=%lu connect_ms=%lu events_dropped=%lu",
+                 mqttLink.connects(), mqttLink.reconnects(), mqttLink.failures(), mqttLink.lastConnectLatency(), netEvents.dropped());
+        transmit(ESP_METRICS_TOPIC, stats);
+
+        snprintf(stats, sizeof(stats), "OUTBOX sent=%lu coalesced=%lu duplicates=%lu dropped=%lu writes=%lu",
+                 outbox.sent(), outbox.coalesced(), outbox.duplicates(), outbox.dropped(), espClient.writes());
+        transmit(ESP_METRICS_TOPIC, stats);
+    }
+
+    /**
+     * @brief Prints how long each phase of this boot took and publishes it on ESP_METRICS_TOPIC, once the broker is up.
+     */
+    void publishBootTimeline()
+    {
+        bootTimeline.mark("mqtt");
+        char line[160];
+        bootTimeline.format(line, sizeof(line));
+        Serial.println(line);
+        transmit(ESP_METRICS_TOPIC, line);
+    }
+
+    /**
+     * @brief Called by mqttLink every time the broker connection comes up.
+     *
+     * The first connection announces a fresh game to the dashboard and has the game loop blink the keypad green,
+     * later ones only report the reconnect. After a resumed game the game loop reports the finished puzzles instead.
+     * Either way the outbox sends the last countdown value again.
+     */
+    void onMqttConnected(bool reconnect)
+    {
+        outbox.reconnected();
+        if (!reconnect)
+            publishBootTimeline();
+        if (!reconnect && !resumedGame)
+        {
+            transmit(ESP_TOPIC, GLOBAL_RESET);
+            transmit(ESP_TIMER_TOPIC, "15:00");
+        }
+        post({NET_CONNECTED, reconnect});
+        publishLinkStats();
+    }
+
+    void networkSetup()
+    {
+        // connect to wifi
+        setup_wifi();
+
+        // the countdown and the wheels progress are states: at most two or five values a second, the newest wins. A
+        // burst of more stage events than a game has is cut short, but a repeated one still goes out: every
+        // `global_reset` answers a reset of its own. The completion time is dropped when repeated.
+        outbox.setPolicy(ESP_TIMER_TOPIC, 500, 0);
+        outbox.setPolicy(ESP_WHEELS_TOPIC, 200, 0);
+        outbox.setPolicy(ESP_TOPIC, 1000, 8, false);
+        outbox.setPolicy(ESP_COMPLETION_TOPIC, 10000, 1);
+
+        // Connect to MQTT broker, from networkStep() onwards
+        mqttClient.reset(new hal::MqttClient(espClient));
+        mqttClient->setCallback([this](char *topic, byte *payload, unsigned int length) { callback(topic, payload, length); });
+        mqttLink.begin([](void *room, bool reconnect) { ((Room *)room)->onMqttConnected(reconnect); }, this);
+    }
+
+    /**
+     * @brief One pass of the network task on core 0.
+     *
+     * Keeps the broker connection up (admin messages arrive through `callback()`), sends what the game loop
+     * queued and the outbox let through or held until now, reports the link every metricsPublishInterval and writes
+     * the journal and the game snapshot to flash. Whatever the network or the flash does here, the game loop on core 1
+     * only ever sees the queues, so a WiFi stall, a slow broker or a flash erase no longer shows up in its timing. All
+     * the publishes of a pass leave in a single socket write.
+     */
+    void networkStep()
+    {
+        mqttLink.handle();
+
+        const unsigned long currentTime = hal::millis();
+        espClient.beginBatch();
+        OutboundMessage message;
+        while (outbound.pop(message))
+            transmit(message, currentTime);
+        while (outbox.nextDue(message, currentTime))
+            send(message);
+
+        if (mqttLink.connected() && currentTime - lastLinkStatsPublished >= metricsPublishInterval)
+        {
+            lastLinkStatsPublished = currentTime;
+            publishLinkStats();
+        }
+        writeJournal();
+        snapshots.handle();
+        espClient.endBatch();
+    }
+
+    /**
+     * @brief Publishes a message if the outbox lets it through. Network task side.
+     */
+    void transmit(const OutboundMessage &message, unsigned long currentTime)
+    {
+        if (outbox.offer(message, currentTime))
+            send(message);
+    }
+
+    void send(const OutboundMessage &message)
+    {
+        if (mqttLink.connected() && mqttClient->publish(message.topic, message.payload))
+            outbox.countSent();
+        else
+            outbox.countDropped();
+    }
+
+    void transmit(const char *topic, const char *payload)
+    {
+        OutboundMessage message;
+        message.set(topic, payload);
+        transmit(message, hal::millis());
+    }
+
+    /**
+     * @brief Displays the remaining time of the game.
+     * 
+     * This function calculates the remaining time of the game and displays it on the timer display.
+     * If the current stage is SOLVED, the function returns without doing anything.
+     * The remaining time is calculated based on the current stage and the game duration.
+     * Whenever it changes, it is formatted and queued for the MQTT client, and written to the timer display.
+     */
+    void displayRemainingTime()
+    {
+        if (currentStage == SOLVED) {
+            return;
+        }
+
+        // Display remaining time
+        auto [minute, second] = calcRemainingTime();
+
+        if (minute * 60 + second != publishedTimerSeconds) {
+            char text[timeTextSize];
+            formatTime(minute, second, text);
+            if (publish(ESP_TIMER_TOPIC, text))
+                publishedTimerSeconds = minute * 60 + second;
+        }
+
+        if (minute * 60 + second != displayedTimerSeconds) {
+            timerDisplay.displayTime(minute, second);
+            displayedTimerSeconds = minute * 60 + second;
+        }
+    }
+
+    /**
+     * @brief Publishes the loop latency summary.
+     *
+     * Every metricsPublishInterval milliseconds, one line per stage that ran since the last summary is published
+     * on ESP_METRICS_TOPIC (see LoopMetrics::format), and that stage's histograms start over.
+     * Five more lines report the NeoPixel frames pushed in the last second and since boot, the outbound queue
+     * to the network task, the admin commands received per command (see CommandDispatcher::format), the time
+     * spent on each puzzle in the current game (see PuzzlePipeline::format) and how much the loop slept (see
+     * IdleMode::format).
+     * The broker connection is reported by the network task itself (see publishLinkStats).
+     */
+    void publishMetrics()
+    {
+        const unsigned long currentTime = hal::millis();
+        if (currentTime - lastMetricsPublished < metricsPublishInterval)
+            return;
+        lastMetricsPublished = currentTime;
+
+        char summary[200];
+        for (int s = READY; s <= SOLVED; s++)
+        {
+            if (!loopMetrics.hasSamples((stage)s))
+                continue;
+            loopMetrics.format((stage)s, summary, sizeof(summary));
+            publish(ESP_METRICS_TOPIC, summary);
+            loopMetrics.reset((stage)s);
+        }
+
+        snprintf(summary, sizeof(summary), "LEDS fps=%u frames=%lu anim_us=%lu/%lu overruns=%lu animations=%d/%d dropped=%lu",
+                 leds.framesPerSecond(), leds.framesPushed(), (unsigned long)animator.frameMicros(),
+                 (unsigned long)animator.maxFrameMicros(), animator.overruns(), animator.numAnimations(),
+                 Animator::maxAnimations, animator.dropped());
+        publish(ESP_METRICS_TOPIC, summary);
+
+        snprintf(summary, sizeof(summary), "QUEUE outbound peak=%u/%u dropped=%lu", (unsigned)outbound.peak(), (unsigned)outbound.capacity, outbound.dropped());
+        publish(ESP_METRICS_TOPIC, summary);
+
+        commandDispatcher.format(summary, sizeof(summary));
+        publish(ESP_METRICS_TOPIC, summary);
+
+        pipeline.format(summary, sizeof(summary));
+        publish(ESP_METRICS_TOPIC, summary);
+
+        idleMode.format(summary, sizeof(summary));
+        publish(ESP_METRICS_TOPIC, summary);
+    }
+
+    /**
+     * @brief Logs the stage transitions that happened during this pass. Game loop side; the journal reaches flash
+     * from the network task (see writeJournal).
+     */
+    void handleJournal()
+    {
+        if (currentStage != journaledStage)
+        {
+            journal.log(EVENT_STAGE, journaledStage, currentStage);
+            journaledStage = currentStage;
+        }
+    }
+
+    /**
+     * @brief Lets the journal flush to flash, and while a dump requested with JOURNAL_DUMP is running, publishes one
+     * chunk per pass on ESP_JOURNAL_TOPIC. Network task side, so neither ever stalls the game loop.
+     * `pio run -e journal_decode` builds the host decoder for those chunks.
+     */
+    void writeJournal()
+    {
+        journal.handle();
+        if (journal.dumping() && mqttLink.connected())
+        {
+            char chunk[sizeof(OutboundMessage::payload)];
+            if (journal.nextDumpChunk(chunk, sizeof(chunk)) > 0)
+                transmit(ESP_JOURNAL_TOPIC, chunk);
+        }
+    }
+
+    /**
+     * @brief Picks up the game that was running before a reset (brownout, watchdog), if there was one.
+     *
+     * Called from setup() before the network comes up: restores the stage, the countdown, the puzzle states and
+     * with them their LEDs from the last snapshot.
+     */
+    void loadSnapshot()
+    {
+        GameSnapshot snapshot;
+        if (!snapshots.load(hal::resetReason(), snapshot) || snapshot.stage <= READY || snapshot.stage >= SOLVED)
+            return;
+        resumeSnapshot = snapshot;
+        resumedGame = true;
+    }
+
+    void resumeGame()
+    {
+        if (!resumedGame)
+            return;
+        gameDuration = resumeSnapshot.gameDuration;
+        timerCountDown.start(resumeSnapshot.remaining);
+        pipeline.resume((stage)resumeSnapshot.stage, resumeSnapshot.puzzles);
+        journal.log(EVENT_RESUME, resumeSnapshot.stage, resumeSnapshot.remaining);
+        journaledStage = currentStage;
+    }
+
+    /**
+     * @brief Takes a snapshot of the game whenever it changed, see SnapshotStore.
+     *
+     * Outside of a game only the stage is kept, so an idle room does not keep writing.
+     */
+    void handleSnapshots()
+    {
+        GameSnapshot snapshot = {};
+        snapshot.stage = currentStage;
+        if (pipeline.inPuzzle())
+        {
+            snapshot.gameDuration = gameDuration;
+            snapshot.remaining = timerCountDown.remaining();
+            pipeline.capture(snapshot.puzzles);
+        }
+        snapshots.save(snapshot);
+    }
+
+    /**
+     * @brief Handles the reset and start functionality.
+     * 
+     * This function is responsible for handling the reset and start functionality in the escape room game.
+     * It checks for key presses on the keypad and performs the corresponding actions based on the pressed key.
+     * If the '*' key is pressed, it starts the countdown timer and sets the current stage to WHEELS.
+     * If the '#' key is pressed, it resets the game globally and publishes a reset message to the MQTT client.
+     */
+    void handleKeypadInput()
+    {
+        KeyEvent event;
+        while (!pipeline.inPuzzle() && keypadDriver.nextEvent(event))
+        {
+            if (!event.pressed)
+                continue;
+            char key = event.key;
+            journal.log(EVENT_KEY, key);
+            if (key == '*' || key == '#')
+                idleMode.keyHandled(hal::millis() - event.seen);
+            if (key == '*')
+            {
+                resetGlobal();
+                startGame();
+            }
+
+            if (key == '#') {
+                resetGlobal();
+            }
+
+            if (key == '1') {
+                fuel.compartment.open();
+            }
+
+            if (key == '2') {
+                stars.compartment.open();
+            }
+
+            if (key == '3') {
+                wheels.compartment.open();
+            }
+        }
+    }
+
+    void setup()
+    {
+        // put your setup code here, to run once:
+        Serial.begin(115200);
+        hal::startInputTrace();
+        journal.begin(hal::resetReason());
+        bootTimeline.mark("serial");
+
+        // WiFi, mDNS and MQTT run on core 0, loop() stays on core 1. The network comes up while the peripherals below
+        // are initialized, and only needs to know whether this boot resumes a game.
+        loadSnapshot();
+        hal::idleBegin();
+        hal::startTask("network", 0, [](void *room) { ((Room *)room)->networkSetup(); }, [](void *room) { ((Room *)room)->networkStep(); }, this);
+
+        hal::pinMode(ledsPin, OUTPUT); // transferring fuel leds + wheels hint led + starry night leds + keypad leds
+        ws2812b.begin();
+
+        pipeline.setup([](void *room) { ((Room *)room)->onGameSolved(); }, this);
+        leds.flush();
+        bootTimeline.mark("leds");
+
+        // Initialize Keypad
+        hal::i2cBegin(400000);
+        if (keypad.begin() == false)
+        {
+            Serial.println("\nERROR: cannot communicate to keypad.\n");
+        }
+        keypadDriver.begin();
+        bootTimeline.mark("keypad");
+
+        currentStage = READY;
+        resumeGame();
+        leds.flush();
+
+        // Timer display
+        timerDisplay.begin();
+        timerDisplay.displayOn();
+        timerDisplay.setDigits(4);
+        bootTimeline.mark("ready");
+    }
+
+    /**
+     * @brief Outside of a game, sleeps until the next pass has something to do.
+     *
+     * In READY and SOLVED a pass only has work when a key goes down or the network task queues an event, both of
+     * which wake the loop, or when a keypad change is to be confirmed, an animation is due for its next frame or the
+     * metrics are due. The loop sleeps until the earliest of those, so `*` and `#` are acted on one debounce time after
+     * the keypad interrupt, as they are when it never sleeps. During a game, or while a frame waits for the strip, it
+     * does not sleep at all.
+     */
+    void idle()
+    {
+        if (pipeline.inPuzzle() || leds.pending())
+            return;
+        const unsigned long currentTime = hal::millis();
+        const unsigned long sinceMetrics = currentTime - lastMetricsPublished;
+        unsigned long ms = sinceMetrics >= metricsPublishInterval ? 0 : metricsPublishInterval - sinceMetrics;
+        ms = std::min(ms, keypadDriver.idleMs(currentTime));
+        ms = std::min(ms, animator.idleMs(currentTime));
+        idleMode.sleep(ms);
+    }
+
+    void loop()
+    {
+        hal::trace().pass();
+        idleMode.awake();
+        loopMetrics.beginLoop(currentStage);
+
+        handleNetEvents();
+        loopMetrics.lap(SECTION_MQTT);
+
+        // display remaining time
+        displayRemainingTime();
+        loopMetrics.lap(SECTION_TIMER);
+
+        // one frame of every running LED animation
+        animator.update();
+        loopMetrics.lap(SECTION_ANIMATIONS);
+
+        keypadDriver.handle();
+        if (pipeline.inPuzzle())
+        {
+            pipeline.play();
+        }
+        else
+        {
+            // READY or SOLVED
+            handleKeypadInput();
+        }
+        if (currentStage != STARS)
+        {
+            // only the stars take keys during a game
+            keypadDriver.discardEvents();
+        }
+        loopMetrics.lap(SECTION_PLAY);
+
+        // push the frame composed during this pass, if it changed
+        leds.flush();
+        loopMetrics.endLoop();
+
+        publishMetrics();
+        handleJournal();
+        handleSnapshots();
+        idle();
+    }
+};
+
+#endif /* ROOM_H */
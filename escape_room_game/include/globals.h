@@ -1,14 +1,11 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
-#include <Adafruit_NeoPixel.h>
-#include <WiFi.h>
-#include <WiFiManager.h>
-#include <ESPmDNS.h>
-#include <PubSubClient.h>
-#include <I2CKeyPad.h>
-#include <CountDown.h>
-#include <HT16K33.h>
+#include <Hal.h>
+#include <string.h>
+#include "messages.h"
+
+// The types and constants shared by every room. The state of a room lives in its GameContext (GameContext.h).
 
 enum stage
 {
@@ -18,58 +15,77 @@ enum stage
     STARS,
     SOLVED
 };
-stage currentStage;
 
 /* CONSTANTS */
 // ESP MQTT TOPIC
-const char *ESP_TOPIC = "esp";
-const char *ESP_TIMER_TOPIC = "esp_timer";
-const char *ESP_COMPLETION_TOPIC = "esp_completion";
-
-// MQTT MESSAGES
-const char *START_GAME = "start_game";
-const char *WHEELS_HINT = "wheels_hint";
-const char *WHEELS_SOLVE = "wheels_solved";
-const char *FUEL_RESET = "fuel_reset";
-const char *FUEL_HINT = "fuel_hint";
-const char *FUEL_SOLVE = "fuel_solved";
-const char *STARS_HINT = "star_hint";
-const char *STARS_SOLVE = "star_solved";
-const char *GLOBAL_RESET = "global_reset";
-const char *ADD_MIN = "add_min";
-const char *SUB_MIN = "sub_min";
-const char *COMPARTMENT_OPEN1 = "comp_1_open";
-const char *COMPARTMENT_OPEN2 = "comp_2_open";
-const char *COMPARTMENT_OPEN3 = "comp_3_open";
-
-// Wi-Fi
-WiFiClient espClient;
+constexpr const char *ESP_TOPIC = "esp";
+constexpr const char *ESP_TIMER_TOPIC = "esp_timer";
+constexpr const char *ESP_COMPLETION_TOPIC = "esp_completion";
+constexpr const char *ESP_METRICS_TOPIC = "esp_metrics";
+constexpr const char *ESP_JOURNAL_TOPIC = "esp_journal";
+constexpr const char *ESP_WHEELS_TOPIC = "esp_wheels";
 
 // MQTT
-int connectionTries = 3;
-bool connected = false;
-IPAddress mqtt_ip;
-const char *mqtt_hostname = "DESKTOP-E9DDPAE.local";
+constexpr const char *mqtt_hostname = "DESKTOP-E9DDPAE.local";
 const int mqtt_port = 1883;
-PubSubClient* mqttClient = nullptr;
 
 // KEYPAD
 const int numKeypadLeds = 4;
-const int keypadLeds[] = {21, 22, 23, 24};
-I2CKeyPad keypad(0x20);
-uint8_t prevKeyIndex = 16;
-unsigned long keypadLastDebounceTime = 0;
+const byte keypadIntPin = 4;
+
+// WHEELS
+// A reed switch per wheel. Built with -DWHEELS_REED_CHAIN, every reed is read on its own through a chain of 74HC165
+// shift registers (see hal::ShiftInChain), which the per-wheel progress and hint need. Otherwise the room keeps its
+// original wiring: all the reeds on one line to wheelsLinePin, which reads HIGH once every wheel is aligned.
+const int numWheels = 7;
+const byte wheelReedsLatchPin = 5;
+const byte wheelsLinePin = 15;
 
 // LEDS
 const byte ledsPin = 33;
 const int numFuelLeds = 16;
 const int numStarLeds = 4;
-Adafruit_NeoPixel ws2812b(numFuelLeds + numStarLeds + 1 + numKeypadLeds, ledsPin, NEO_GRB + NEO_KHZ800);
+
+// I/O NODE
+// The pins an I/O node (src/node/) drives itself and a CONFIG frame from the daemon never takes over: the keypad
+// interrupt, the LED strip, the reeds latch, the VSPI bus the reeds are read on (SCK 18, MISO 19, MOSI 23) and the
+// I2C bus of the keypad and the display (SDA 21, SCL 22).
+const uint64_t nodeOwnedPins = 1ull << keypadIntPin | 1ull << ledsPin | 1ull << wheelReedsLatchPin | 1ull << 18 | 1ull << 19 | 1ull << 23 |
+                               1ull << 21 | 1ull << 22;
 
 // TIMER
-unsigned long lastTimerPublished = 0;
-unsigned long gameDuration = 15 * 60;
-CountDown timerCountDown(CountDown::SECONDS);
-HT16K33 timerDisplay(0x70);
+const unsigned long defaultGameDuration = 15 * 60;
+
+// METRICS
+const unsigned long metricsPublishInterval = 10000;
+
+// CORE 0 <-> CORE 1
+// WiFi, mDNS and the MQTT client live in the network task on core 0, the game loop on core 1.
+// They only talk through the two queues of the GameContext.
+enum netEventType
+{
+    NET_ADMIN_COMMAND, // value = adminCommand
+    NET_LINK_STATE,    // value = linkState
+    NET_CONNECTED      // value = 1 on a reconnect
+};
+
+struct NetEvent
+{
+    uint8_t type;
+    uint8_t value;
+};
+
+struct OutboundMessage
+{
+    const char *topic; // one of the topic constants above
+    char payload[224];
+
+    void set(const char *topic, const char *payload)
+    {
+        this->topic = topic;
+        strncpy(this->payload, payload, sizeof(this->payload) - 1);
+        this->payload[sizeof(this->payload) - 1] = '\0';
+    }
+};
 
 #endif /* GLOBALS_H */
@@ -0,0 +1,23 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+/* MQTT MESSAGES */
+// Payloads exchanged with the Node-RED admin panel on the "admin" and ESP_TOPIC topics.
+// They are constexpr so the admin command table (lib/Commands) can be built from them at compile time.
+constexpr char START_GAME[] = "start_game";
+constexpr char WHEELS_HINT[] = "wheels_hint";
+constexpr char WHEELS_SOLVE[] = "wheels_solved";
+constexpr char FUEL_RESET[] = "fuel_reset";
+constexpr char FUEL_HINT[] = "fuel_hint";
+constexpr char FUEL_SOLVE[] = "fuel_solved";
+constexpr char STARS_HINT[] = "star_hint";
+constexpr char STARS_SOLVE[] = "star_solved";
+constexpr char GLOBAL_RESET[] = "global_reset";
+constexpr char ADD_MIN[] = "add_min";
+constexpr char SUB_MIN[] = "sub_min";
+constexpr char COMPARTMENT_OPEN1[] = "comp_1_open";
+constexpr char COMPARTMENT_OPEN2[] = "comp_2_open";
+constexpr char COMPARTMENT_OPEN3[] = "comp_3_open";
+constexpr char JOURNAL_DUMP[] = "journal_dump";
+
+#endif /* MESSAGES_H */
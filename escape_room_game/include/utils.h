@@ -1,66 +1,25 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include "globals.h"
-
-#define BLINKS 5
+#include "GameContext.h"
 
 namespace utils
 {
+    // the keypad's answer to a passcode or a connection: five quick blinks, then dark
+    constexpr auto keypadCorrectBlink = animations::blink<100, 100, 5>(animations::rgb(0, 25, 0), 0);
+    constexpr auto keypadWrongBlink = animations::blink<100, 100, 5>(animations::rgb(25, 0, 0), 0);
 
-    unsigned long lastBlinkTime = 0;
-    const unsigned long blinkInterval = 100;
-    int blinkCount = BLINKS;
-    bool light = true;
-
-    void setKeyPadLEDColors(int r, int g, int b)
-    {
-        for (int i = 0; i < numKeypadLeds; i++)
-        {
-            ws2812b.setPixelColor(keypadLeds[i], ws2812b.Color(r, g, b)); // it only takes effect if pixels.show() is called
-        }
-        ws2812b.show();
-    }
-
-    bool blinkKeypadLeds(bool correct)
+    inline void setKeyPadLEDColors(GameContext &context, int r, int g, int b)
     {
-        unsigned long currentTime = millis();
-        if (currentTime - lastBlinkTime >= blinkInterval && blinkCount > 0)
-        {
-            lastBlinkTime = currentTime;
-            if (light)
-            {
-                setKeyPadLEDColors(correct ? 0 : 25, correct ? 25 : 0, 0);
-            }
-            else
-            {
-                setKeyPadLEDColors(0, 0, 0);
-                blinkCount--;
-            }
-            light = !light;
-        }
-
-        if (blinkCount <= 0)
-        {
-            blinkCount = BLINKS;
-            setKeyPadLEDColors(0, 0, 0);
-            return false;
-        }
-
-        return true;
+        context.keypadLeds.fill(LedFrame::Color(r, g, b)); // it only takes effect on the next leds.flush()
     }
 
-    void blinkKeypadLedsBlocking(bool correct)
+    /**
+     * Starts blinking the keypad green or red. `keypadAnimation.running()` tells when it is done.
+     */
+    inline void blinkKeypadLeds(GameContext &context, bool correct)
     {
-        for (int j = 0; j < 5; j++)
-        {
-            setKeyPadLEDColors(correct ? 0 : 25, correct ? 25 : 0, 0);
-            delay(100);
-
-            setKeyPadLEDColors(0, 0, 0);
-            delay(100);
-        }
-        setKeyPadLEDColors(0, 0, 0);
+        context.keypadAnimation.start(correct ? keypadCorrectBlink : keypadWrongBlink);
     }
 }
 
@@ -0,0 +1,355 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <Hal.h>
+#include <Leds.h>
+#include <algorithm>
+#include <array>
+#include <limits.h>
+
+/**
+ * @brief LED animations as color tables computed at compile time.
+ *
+ * A Clip holds one color per animation frame of `frameMs`, so playing it is a table lookup per pixel: no timers,
+ * counters or color math at run time. The generators below build the tables in constexpr context. Brightness ramps
+ * are specified in perceived brightness and gamma corrected, and full brightness is the base color unchanged, so a
+ * clip's colors match the ones the rest of the firmware writes.
+ */
+namespace animations
+{
+    const uint32_t frameMs = 20;
+
+    constexpr uint32_t frames(uint32_t ms) { return (ms + frameMs - 1) / frameMs; }
+
+    // same packing as hal::Strip::Color(), usable in constant expressions
+    constexpr uint32_t rgb(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+    // x^(1/5) by Newton's method, x in [0, 1]
+    constexpr double fifthRoot(double x)
+    {
+        double y = 1;
+        for (int i = 0; i < 40; i++)
+            y -= (y * y * y * y * y - x) / (5 * y * y * y * y);
+        return y;
+    }
+
+    // perceived brightness in [0, 1] to the PWM duty that produces it (gamma 2.2)
+    constexpr double gamma(double level) { return level <= 0 ? 0 : level >= 1 ? 1 : level * level * fifthRoot(level); }
+
+    constexpr uint32_t dim(uint32_t color, double level)
+    {
+        const double duty = gamma(level);
+        return rgb((uint8_t)(((color >> 16) & 0xFF) * duty + 0.5), (uint8_t)(((color >> 8) & 0xFF) * duty + 0.5), (uint8_t)((color & 0xFF) * duty + 0.5));
+    }
+
+    template <size_t NumFrames>
+    struct Clip
+    {
+        static const size_t numFrames = NumFrames;
+        uint32_t colors[NumFrames];
+        bool loops;
+    };
+
+    /** `count` times `color` for `OnMs` and off for `OffMs`, then `endColor` stays. */
+    template <uint32_t OnMs, uint32_t OffMs, uint32_t Count>
+    constexpr Clip<(frames(OnMs) + frames(OffMs)) * Count + 1> blink(uint32_t color, uint32_t endColor)
+    {
+        Clip<(frames(OnMs) + frames(OffMs)) * Count + 1> clip = {};
+        size_t f = 0;
+        for (uint32_t i = 0; i < Count; i++)
+        {
+            for (uint32_t on = 0; on < frames(OnMs); on++)
+                clip.colors[f++] = color;
+            for (uint32_t off = 0; off < frames(OffMs); off++)
+                clip.colors[f++] = 0;
+        }
+        clip.colors[f] = endColor;
+        clip.loops = false;
+        return clip;
+    }
+
+    /** `color` from brightness `from` to `to` over `Ms`, ending exactly at `to`. */
+    template <uint32_t Ms>
+    constexpr Clip<frames(Ms)> fade(uint32_t color, double from, double to)
+    {
+        Clip<frames(Ms)> clip = {};
+        const size_t n = frames(Ms);
+        for (size_t f = 0; f < n; f++)
+            clip.colors[f] = dim(color, n > 1 ? from + (to - from) * f / (n - 1) : to);
+        clip.loops = false;
+        return clip;
+    }
+
+    /** Breathes `color` between brightness `low` and full, once per `PeriodMs`, forever. */
+    template <uint32_t PeriodMs>
+    constexpr Clip<frames(PeriodMs / 2) * 2> pulse(uint32_t color, double low)
+    {
+        Clip<frames(PeriodMs / 2) * 2> clip = {};
+        const auto up = fade<PeriodMs / 2>(color, low, 1);
+        const size_t half = frames(PeriodMs / 2);
+        for (size_t f = 0; f < half; f++)
+        {
+            clip.colors[f] = up.colors[f];
+            clip.colors[2 * half - 1 - f] = up.colors[f];
+        }
+        clip.loops = true;
+        return clip;
+    }
+
+    /** `count` flashes of `color`, `OnMs` on and `OffMs` off, then dark until `PeriodMs` is over, forever. */
+    template <uint32_t OnMs, uint32_t OffMs, uint32_t PeriodMs>
+    constexpr Clip<frames(PeriodMs)> flashes(uint32_t color, uint32_t count)
+    {
+        Clip<frames(PeriodMs)> clip = {};
+        const size_t flashFrames = frames(OnMs) + frames(OffMs);
+        for (size_t f = 0; f < frames(PeriodMs); f++)
+            clip.colors[f] = f / flashFrames < count && f % flashFrames < frames(OnMs) ? color : 0;
+        clip.loops = true;
+        return clip;
+    }
+
+    /** A `flashes` clip per count from 1 to `Count`, at index `count - 1`, e.g. to flash the number of a wheel. */
+    template <uint32_t OnMs, uint32_t OffMs, uint32_t PeriodMs, size_t Count>
+    constexpr std::array<Clip<frames(PeriodMs)>, Count> countedFlashes(uint32_t color)
+    {
+        std::array<Clip<frames(PeriodMs)>, Count> clips = {};
+        for (size_t count = 1; count <= Count; count++)
+            clips[count - 1] = flashes<OnMs, OffMs, PeriodMs>(color, count);
+        return clips;
+    }
+
+    /** `color` for one `TickMs` tick, then `restColor` for the other `Ticks - 1`, forever. Offset per pixel for a chase. */
+    template <uint32_t TickMs, uint32_t Ticks>
+    constexpr Clip<frames(TickMs) * Ticks> chase(uint32_t color, uint32_t restColor)
+    {
+        Clip<frames(TickMs) * Ticks> clip = {};
+        for (size_t f = 0; f < frames(TickMs) * Ticks; f++)
+            clip.colors[f] = f < frames(TickMs) ? color : restColor;
+        clip.loops = true;
+        return clip;
+    }
+}
+
+class Animator;
+
+/**
+ * @class Animation
+ * @brief Plays clips on (some of) the pixels of one LED segment.
+ *
+ * Owned by the module that drives the segment, and advanced by its Animator together with all the others.
+ * Pixel `i` runs `i * delayMs` behind pixel 0, which turns one clip into a chase across the segment.
+ */
+class Animation
+{
+public:
+    Animation(Animator &animator, LedSegment &segment);
+
+    template <size_t NumFrames>
+    void start(const animations::Clip<NumFrames> &clip, uint32_t pixelMask = ~0u, uint16_t delayMs = 0)
+    {
+        _colors = clip.colors;
+        _numFrames = NumFrames;
+        _loops = clip.loops;
+        _pixelMask = pixelMask;
+        _delayMs = delayMs;
+        _start = hal::millis();
+        _running = true;
+        render(_start);
+    }
+
+    // leaves the pixels as they are
+    void stop() { _running = false; }
+
+    bool running() const { return _running; }
+
+    void render(unsigned long currentTime)
+    {
+        if (!_running)
+            return;
+        _renderedAt = currentTime;
+        const uint32_t elapsed = currentTime - _start;
+        const uint32_t loopMs = _numFrames * animations::frameMs;
+        bool finished = !_loops;
+        for (uint16_t i = 0; i < _segment.length() && i < 32; i++)
+        {
+            if (!(_pixelMask & (1u << i)))
+                continue;
+            const uint32_t delay = (uint32_t)i * _delayMs;
+            uint32_t frame;
+            if (_loops)
+            {
+                frame = (elapsed + loopMs - delay % loopMs) % loopMs / animations::frameMs;
+            }
+            else
+            {
+                // before its delay a pixel shows the first frame, after the end the last one
+                frame = elapsed < delay ? 0 : std::min<uint32_t>((elapsed - delay) / animations::frameMs, _numFrames - 1);
+                if (elapsed < delay || frame < _numFrames - 1u)
+                    finished = false;
+            }
+            _segment.set(i, _colors[frame]);
+        }
+        if (finished)
+            _running = false;
+    }
+
+    /**
+     * @return In how many ms a pixel shows another color than it was last rendered with, or a one-shot clip ends:
+     * 0 if that is already overdue, ULONG_MAX if it never happens.
+     */
+    unsigned long changeDueMs(unsigned long currentTime) const
+    {
+        if (!_running)
+            return ULONG_MAX;
+        const unsigned long ahead = nextChangeAfter(_renderedAt);
+        if (ahead == ULONG_MAX)
+            return ahead;
+        const unsigned long since = currentTime - _renderedAt;
+        return since >= ahead ? 0 : ahead - since;
+    }
+
+private:
+    // ms from `time` to the first frame boundary at which a pixel's color changes, scanning at most one loop ahead
+    unsigned long nextChangeAfter(unsigned long time) const
+    {
+        const uint32_t elapsed = time - _start;
+        const uint32_t loopMs = _numFrames * animations::frameMs;
+        unsigned long next = ULONG_MAX;
+        for (uint16_t i = 0; i < _segment.length() && i < 32; i++)
+        {
+            if (!(_pixelMask & (1u << i)))
+                continue;
+            const uint32_t delay = (uint32_t)i * _delayMs;
+            uint32_t at, wait = 0; // where the pixel is in the clip, and how long it still holds its first frame
+            if (_loops)
+            {
+                at = (elapsed + loopMs - delay % loopMs) % loopMs;
+            }
+            else if (elapsed < delay)
+            {
+                at = 0;
+                wait = delay - elapsed;
+            }
+            else
+            {
+                at = elapsed - delay;
+                if (at / animations::frameMs >= _numFrames - 1u)
+                    continue; // showing its last frame for good
+            }
+            const uint32_t frame = at / animations::frameMs;
+            wait += animations::frameMs - at % animations::frameMs;
+            for (uint32_t n = 1; n < _numFrames && wait < next; n++, wait += animations::frameMs)
+            {
+                const uint32_t later = _loops ? (frame + n) % _numFrames : frame + n;
+                if (_colors[later] != _colors[frame] || later == _numFrames - 1u)
+                {
+                    next = wait;
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    LedSegment &_segment;
+    const uint32_t *_colors = nullptr;
+    uint16_t _numFrames = 0;
+    bool _loops = false;
+    bool _running = false;
+    uint32_t _pixelMask = 0;
+    uint16_t _delayMs = 0;
+    unsigned long _start = 0;
+    unsigned long _renderedAt = 0;
+};
+
+/**
+ * @class Animator
+ * @brief Advances every running Animation once per frame, within a fixed CPU budget.
+ *
+ * `update()` is called on every `loop()` pass and renders a frame every `animations::frameMs`. A frame that runs out
+ * of its `budgetMicros` stops after the current animation and the next frame picks up with the one after it, so a
+ * crowded frame delays some animations by a frame instead of stretching the pass. The measured frame time is kept
+ * for the metrics.
+ *
+ * It holds at most `maxAnimations`. One added past that is never rendered; it is counted in `dropped()`, which the
+ * LEDS metrics line reports, so raise the limit when it shows up there.
+ */
+class Animator
+{
+public:
+    static const int maxAnimations = 8;
+
+    Animator(uint32_t budgetMicros) : _budgetMicros(budgetMicros) {}
+
+    void add(Animation *animation)
+    {
+        if (_numAnimations < maxAnimations)
+            _animations[_numAnimations++] = animation;
+        else
+            _dropped++;
+    }
+
+    void update()
+    {
+        const unsigned long currentTime = hal::millis();
+        if (currentTime - _lastFrame < animations::frameMs)
+            return;
+        _lastFrame = currentTime;
+
+        const int64_t frameStart = hal::esp_timer_get_time();
+        for (int n = 0; n < _numAnimations; n++)
+        {
+            Animation *animation = _animations[_next];
+            _next = (_next + 1) % _numAnimations;
+            animation->render(currentTime);
+            if (hal::esp_timer_get_time() - frameStart >= _budgetMicros && n + 1 < _numAnimations)
+            {
+                _overruns++;
+                break;
+            }
+        }
+        _frameMicros = hal::esp_timer_get_time() - frameStart;
+        if (_frameMicros > _maxFrameMicros)
+            _maxFrameMicros = _frameMicros;
+        _frames++;
+    }
+
+    /**
+     * @return How long the game loop may wait before the next update(): until the first pixel of a running animation
+     * changes color, but no sooner than the next frame, or indefinitely (ULONG_MAX) if none will. The frames in
+     * between would render the same colors again.
+     */
+    unsigned long idleMs(unsigned long currentTime) const
+    {
+        unsigned long due = ULONG_MAX;
+        for (int n = 0; n < _numAnimations; n++)
+            due = std::min(due, _animations[n]->changeDueMs(currentTime));
+        if (due == ULONG_MAX)
+            return due;
+        const unsigned long sinceFrame = currentTime - _lastFrame;
+        return std::max(due, sinceFrame >= animations::frameMs ? 0 : animations::frameMs - sinceFrame);
+    }
+
+    uint32_t frameMicros() const { return _frameMicros; }
+    uint32_t maxFrameMicros() const { return _maxFrameMicros; }
+    unsigned long frames() const { return _frames; }
+    unsigned long overruns() const { return _overruns; }
+    int numAnimations() const { return _numAnimations; }
+    unsigned long dropped() const { return _dropped; }
+
+private:
+    const uint32_t _budgetMicros;
+    Animation *_animations[maxAnimations] = {};
+    int _numAnimations = 0;
+    int _next = 0;
+    unsigned long _lastFrame = 0;
+    uint32_t _frameMicros = 0;
+    uint32_t _maxFrameMicros = 0;
+    unsigned long _frames = 0;
+    unsigned long _overruns = 0;
+    unsigned long _dropped = 0;
+};
+
+inline Animation::Animation(Animator &animator, LedSegment &segment) : _segment(segment) { animator.add(this); }
+
+#endif /* ANIMATION_H */
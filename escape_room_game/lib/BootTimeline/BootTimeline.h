@@ -0,0 +1,64 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <Hal.h>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+
+/**
+ * @class BootTimeline
+ * @brief Milestones of one boot, as milliseconds since reset.
+ *
+ * Both cores mark phases while they start up in parallel (peripherals on core 1, WiFi and MQTT on core 0), so a slot
+ * is claimed with an atomic index and only counted once its time is written. `format()` lists the phases in the order
+ * they were reached, e.g. "BOOT serial=0 leds=3 keypad=5 ready=9 wifi_cached=412 mqtt=530".
+ */
+class BootTimeline
+{
+public:
+    static const int maxPhases = 12;
+
+    BootTimeline() : _next(0) {}
+
+    // phase names are string literals, only the pointer is kept
+    void mark(const char *phase)
+    {
+        const uint32_t index = _next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= maxPhases)
+            return;
+        _phases[index].time = hal::millis();
+        _phases[index].name = phase;
+        _phases[index].done.store(true, std::memory_order_release);
+    }
+
+    size_t format(char *buffer, size_t size) const
+    {
+        const Phase *sorted[maxPhases];
+        int count = 0;
+        for (int i = 0; i < maxPhases; i++)
+        {
+            if (_phases[i].done.load(std::memory_order_acquire))
+                sorted[count++] = &_phases[i];
+        }
+        std::stable_sort(sorted, sorted + count, [](const Phase *a, const Phase *b) { return a->time < b->time; });
+
+        size_t length = snprintf(buffer, size, "BOOT");
+        for (int i = 0; i < count && length < size; i++)
+            length += snprintf(buffer + length, size - length, " %s=%lu", sorted[i]->name, sorted[i]->time);
+        return std::min(length, size - 1);
+    }
+
+private:
+    struct Phase
+    {
+        const char *name = "";
+        unsigned long time = 0;
+        std::atomic<bool> done{false};
+    };
+
+    std::atomic<uint32_t> _next;
+    Phase _phases[maxPhases];
+};
+
+#endif /* BOOT_TIMELINE_H */
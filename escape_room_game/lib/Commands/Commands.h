@@ -0,0 +1,179 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "messages.h"
+
+enum adminCommand
+{
+    CMD_START_GAME,
+    CMD_WHEELS_HINT,
+    CMD_WHEELS_SOLVE,
+    CMD_FUEL_RESET,
+    CMD_FUEL_HINT,
+    CMD_FUEL_SOLVE,
+    CMD_STARS_HINT,
+    CMD_STARS_SOLVE,
+    CMD_GLOBAL_RESET,
+    CMD_ADD_MIN,
+    CMD_SUB_MIN,
+    CMD_COMPARTMENT_OPEN1,
+    CMD_COMPARTMENT_OPEN2,
+    CMD_COMPARTMENT_OPEN3,
+    CMD_JOURNAL_DUMP,
+    NUM_COMMANDS,
+    CMD_UNKNOWN = NUM_COMMANDS
+};
+
+namespace commands
+{
+    struct Entry
+    {
+        const char *name;
+        uint8_t length;
+    };
+
+    constexpr uint8_t nameLength(const char *text)
+    {
+        uint8_t n = 0;
+        while (text[n] != '\0')
+            n++;
+        return n;
+    }
+
+    // indexed by adminCommand
+    constexpr Entry table[NUM_COMMANDS] = {
+        {START_GAME, nameLength(START_GAME)},
+        {WHEELS_HINT, nameLength(WHEELS_HINT)},
+        {WHEELS_SOLVE, nameLength(WHEELS_SOLVE)},
+        {FUEL_RESET, nameLength(FUEL_RESET)},
+        {FUEL_HINT, nameLength(FUEL_HINT)},
+        {FUEL_SOLVE, nameLength(FUEL_SOLVE)},
+        {STARS_HINT, nameLength(STARS_HINT)},
+        {STARS_SOLVE, nameLength(STARS_SOLVE)},
+        {GLOBAL_RESET, nameLength(GLOBAL_RESET)},
+        {ADD_MIN, nameLength(ADD_MIN)},
+        {SUB_MIN, nameLength(SUB_MIN)},
+        {COMPARTMENT_OPEN1, nameLength(COMPARTMENT_OPEN1)},
+        {COMPARTMENT_OPEN2, nameLength(COMPARTMENT_OPEN2)},
+        {COMPARTMENT_OPEN3, nameLength(COMPARTMENT_OPEN3)},
+        {JOURNAL_DUMP, nameLength(JOURNAL_DUMP)},
+    };
+
+    const int numSlots = 32;
+    const uint8_t maxLength = 32;
+
+    // seeded FNV-1a, the slot is taken from the high bits
+    template <typename Char>
+    constexpr uint8_t slotOf(const Char *text, unsigned int len, uint32_t seed)
+    {
+        uint32_t hash = 2166136261u ^ seed;
+        for (unsigned int i = 0; i < len; i++)
+            hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+        return (hash >> 16) & (numSlots - 1);
+    }
+
+    constexpr bool isPerfect(uint32_t seed)
+    {
+        bool used[numSlots] = {};
+        for (int i = 0; i < NUM_COMMANDS; i++)
+        {
+            const uint8_t slot = slotOf(table[i].name, table[i].length, seed);
+            if (used[slot])
+                return false;
+            used[slot] = true;
+        }
+        return true;
+    }
+
+    constexpr uint32_t findSeed()
+    {
+        for (uint32_t seed = 0; seed < 4096; seed++)
+        {
+            if (isPerfect(seed))
+                return seed;
+        }
+        return UINT32_MAX;
+    }
+
+    constexpr uint32_t seed = findSeed();
+    static_assert(seed != UINT32_MAX, "no collision-free seed for the admin commands, grow numSlots");
+
+    struct Slots
+    {
+        uint8_t command[numSlots];
+    };
+
+    constexpr Slots buildSlots()
+    {
+        Slots slots = {};
+        for (int i = 0; i < numSlots; i++)
+            slots.command[i] = CMD_UNKNOWN;
+        for (int i = 0; i < NUM_COMMANDS; i++)
+            slots.command[slotOf(table[i].name, table[i].length, seed)] = i;
+        return slots;
+    }
+
+    // slot -> adminCommand, CMD_UNKNOWN for empty slots
+    constexpr Slots slots = buildSlots();
+
+    /**
+     * @brief Classifies an admin payload.
+     *
+     * The payload is not null-terminated and is only read up to `length`. One hash over at most
+     * maxLength bytes picks the single candidate, which must then match exactly, so a payload that merely
+     * contains a command (or a prefix of one) is rejected. No allocation.
+     */
+    inline adminCommand lookup(const uint8_t *payload, unsigned int length)
+    {
+        if (length == 0 || length > maxLength)
+            return CMD_UNKNOWN;
+        const uint8_t command = slots.command[slotOf(payload, length, seed)];
+        if (command == CMD_UNKNOWN || table[command].length != length || memcmp(table[command].name, payload, length) != 0)
+            return CMD_UNKNOWN;
+        return (adminCommand)command;
+    }
+}
+
+/**
+ * @class CommandDispatcher
+ * @brief Classifies admin payloads through the compile-time command table and counts them per command.
+ */
+class CommandDispatcher
+{
+public:
+    CommandDispatcher() : _counts() {}
+
+    adminCommand dispatch(const uint8_t *payload, unsigned int length)
+    {
+        const adminCommand command = commands::lookup(payload, length);
+        record(command);
+        return command;
+    }
+
+    // counts a command that was classified elsewhere, e.g. on the network task
+    void record(adminCommand command) { _counts[command]++; }
+
+    uint32_t count(adminCommand command) const { return _counts[command]; }
+
+    /**
+     * Renders the counters as `CMDS 1,0,0,2,...,0 unknown=0`, in adminCommand order.
+     */
+    int format(char *buffer, size_t size) const
+    {
+        int written = snprintf(buffer, size, "CMDS ");
+        for (int i = 0; i < NUM_COMMANDS && written < (int)size; i++)
+            written += snprintf(buffer + written, size - written, i == 0 ? "%u" : ",%u", (unsigned)_counts[i]);
+        if (written < (int)size)
+            written += snprintf(buffer + written, size - written, " unknown=%u", (unsigned)_counts[CMD_UNKNOWN]);
+        return written;
+    }
+
+private:
+    uint32_t _counts[NUM_COMMANDS + 1];
+};
+
+#endif /* COMMANDS_H */
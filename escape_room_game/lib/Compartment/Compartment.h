@@ -1,43 +1,32 @@
 #ifndef COMPARTMENT_H
 #define COMPARTMENT_H
 
-#include "globals.h"
+#include "GameContext.h"
+#include <PulseSequencer.h>
 
+/**
+ * @class Compartment
+ * @brief A compartment behind a relay-driven lock, opened with two pulses on the relay.
+ *
+ * The pulses are played by a PulseSequencer from a hardware timer, so the game loop does not poll the compartments.
+ */
 class Compartment
 {
 public:
-    Compartment(const byte relayPin): _relayPin(relayPin), _lastOpenedTime(0) {}
+    static constexpr Pulse openSequence[] = {{HIGH, 500}, {LOW, 200}, {HIGH, 500}};
 
-    void handle()
-    {
-        if (_lastOpenedTime != 0) {
-            uint64_t timeDiff = esp_timer_get_time() - _lastOpenedTime;
-            if (timeDiff < 0.5 * 1e6) {
-                digitalWrite(_relayPin, HIGH);
-            }
-            else if (timeDiff > 0.5 * 1e6 && timeDiff < 0.7 * 1e6) {
-                digitalWrite(_relayPin, LOW);
-            }
-            else if (timeDiff > 0.7 * 1e6 && timeDiff < 1.2 * 1e6) {
-                digitalWrite(_relayPin, HIGH);
-            }
-            else if (timeDiff > 1.2 * 1e6) {
-                digitalWrite(_relayPin, LOW);
-                _lastOpenedTime = 0;
-            }
-        }
-    }
+    Compartment(GameContext &context, const byte relayPin) : _context(context), _relayPin(relayPin), _sequencer(relayPin, openSequence) {}
 
     void open()
     {
-        _lastOpenedTime = esp_timer_get_time();
+        _context.journal.log(EVENT_COMPARTMENT_OPEN, _relayPin);
+        _sequencer.start();
     }
 
 private:
-    const uint64_t _intervalOn = 0.5 * 1e6;
-    const uint64_t _intervalOff = 0.2 * 1e6;
-    uint64_t _lastOpenedTime;
-    byte _relayPin;
+    GameContext &_context;
+    const byte _relayPin;
+    PulseSequencer<sizeof(openSequence) / sizeof(openSequence[0])> _sequencer;
 };
 
 #endif /* COMPARTMENT_H */
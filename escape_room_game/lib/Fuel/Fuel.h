@@ -1,105 +1,116 @@
 #ifndef FUEL_H
 #define FUEL_H
 
-#include "globals.h"
+#include "GameContext.h"
 #include <Compartment.h>
-
-#define BLINK_COUNT 10
+#include <HoseMatrix.h>
+#include "FuelMoves.h"
 
 enum hintState
 {
     OFF,
-    FIRST_TRANSFER,
-    SECOND_TRANSFER,
+    POURING,
     HINT_GIVEN
 };
 
 class Fuel
 {
 public:
-    Fuel() : _lastTransferTime(0),
-             _transferState(false),
-             _fromTank(-1),
-             _toTank(-1),
-             _blinkCount(BLINK_COUNT),
-             _lastBlinkTime(0),
-             _targetTank(-1),
-             _blinkState(true),
-             _light(true),
-             _lastConnectTime(0),
-             _connectState(false),
-             _hintState(OFF),
-             compartment(_relayPin)
+    static const stage id = FUEL;
+    static constexpr const char *name = "fuel";
+    static constexpr const char *solvedMessage = FUEL_SOLVE;
+
+    Fuel(GameContext &context) : _context(context),
+                                 _lastTransferTime(0),
+                                 _transferState(false),
+                                 _fromTank(-1),
+                                 _toTank(-1),
+                                 _targetTank(-1),
+                                 _blinkStarted(false),
+                                 _tankBlink(context.animator, context.fuelLeds),
+                                 _hintState(OFF),
+                                 _hintFrom(-1),
+                                 _hintTo(-1),
+                                 _hoses(_fillingPins),
+                                 compartment(context, _relayPin)
     {
     }
 
     void setup()
     {
-        pinMode(_relayPin, OUTPUT);
-        digitalWrite(_relayPin, LOW);
-        pinMode(_resetButtonPin, INPUT_PULLUP);
-        pinMode(_transferButtonPin, INPUT_PULLUP);
-        pinMode(_transferPossibleLED, OUTPUT);
-        digitalWrite(_transferPossibleLED, LOW);
+        hal::pinMode(_relayPin, OUTPUT);
+        hal::digitalWrite(_relayPin, LOW);
+        hal::pinMode(_resetButtonPin, INPUT_PULLUP);
+        hal::pinMode(_transferButtonPin, INPUT_PULLUP);
+        hal::pinMode(_transferPossibleLED, OUTPUT);
+        hal::digitalWrite(_transferPossibleLED, LOW);
+        _hoses.setup();
         updateDisplay();
     }
 
+    void reset() { reset(true /*global*/); }
+
     void reset(bool global)
     {
+        _context.journal.log(EVENT_FUEL_RESET, global);
         if (global)
             _hintState = OFF;
+        else if (_hintState == POURING)
+            _hintState = HINT_GIVEN;
         _transferState = false;
+        _tankBlink.stop();
+        _blinkStarted = false;
 
-        _currentValues[0] = _hintState == HINT_GIVEN ? 3 : 8;
-        _currentValues[1] = _hintState == HINT_GIVEN ? 2 : 0;
-        _currentValues[2] = _hintState == HINT_GIVEN ? 3 : 0;
+        for (int i = 0; i < _numTanks; i++)
+            _currentValues[i] = _startValues[i];
         updateDisplay();
     }
 
+    /**
+     * Starts pouring the next optimal transfer from the current fuel levels.
+     *
+     * The pour is looked up in the compile-time move table (see FuelMoves) and then animated by `play()`
+     * like a player transfer, so the players keep their progress. Nothing happens if the levels are already
+     * solved or a hint is still pouring.
+     */
     void hint()
     {
-        if (_hintState == OFF)
-        {
-            reset(false /*global*/);
-            _hintState = FIRST_TRANSFER;
-        }
-        else if (_hintState == FIRST_TRANSFER)
-        {
-            if (transfer(0, 1)) // 8, 0, 0 -> 3, 5, 0
-                _hintState = SECOND_TRANSFER;
-        }
-        else if (_hintState == SECOND_TRANSFER)
-        {
-            if (transfer(1, 2)) // 3, 5, 0 -> 3, 2, 3
-                _hintState = HINT_GIVEN;
-        }
+        if (_hintState == POURING || !Moves::nextMove(_currentValues, _hintFrom, _hintTo))
+            return;
+        _transferState = false;
+        _hintState = POURING;
+        _context.journal.log(EVENT_TRANSFER_START, _hintFrom << 4 | _hintTo, 1 /*hint*/);
+    }
+
+    // fuel levels and whether a hint was given, for the game snapshot; a pour in progress is not kept
+    uint16_t snapshot() const { return packedLevels() | (_hintState != OFF) << 12; }
+
+    void resume(uint16_t state)
+    {
+        for (int i = 0; i < _numTanks; i++)
+            _currentValues[i] = std::min((state >> (4 * i)) & 0x0F, _capacities[i]);
+        _hintState = state >> 12 & 1 ? HINT_GIVEN : OFF;
+        updateDisplay();
     }
 
     /**
-     * Solves the fuel puzzle.
-     * 
-     * This function is responsible for solving the fuel puzzle. It checks if the puzzle has already been solved,
-     * and if not, it sets the solve time, marks the puzzle as solved, turns off the relay, and updates the current stage.
-     * If the puzzle has already been solved, it checks if enough time has passed since the last solve, and if so,
-     * it updates the solve time, turns on the relay, updates the blink state, updates the current stage, and publishes
-     * a message to the MQTT client.
+     * Called when the admin panel solves the puzzle: stops any transfer or hint that is still pouring.
      */
     void solve()
     {
-        if (currentStage != FUEL)
-            return;
-        compartment.open();
-        currentStage = STARS;
-        mqttClient->publish(ESP_TOPIC, FUEL_SOLVE);
+        _transferState = false;
+        if (_hintState == POURING)
+            _hintState = HINT_GIVEN;
+        hal::digitalWrite(_transferPossibleLED, LOW);
     }
 
     /**
      * @brief Updates the display of the fuel jugs.
      * 
      * This function updates the display of the fuel jugs by setting the color of each LED
-     * based on the current fuel level in each tank. The LEDs are controlled using the ws2812b library.
+     * based on the current fuel level in each tank. The LEDs are written into the `fuelLeds` segment.
      * The LEDs are lit up with a blue color for the fuel level and turned off for the empty space.
-     * The changes take effect only when the `ws2812b.show()` function is called.
+     * The changes take effect on the next `leds.flush()` at the end of the loop.
      */
     void updateDisplay()
     {
@@ -110,116 +121,96 @@ public:
             {
                 if (i < _currentValues[tank])
                 {
-                    ws2812b.setPixelColor(_ledMapping[ledIndex], ws2812b.Color(0, 0, 25)); // it only takes effect if pixels.show() is called
+                    _context.fuelLeds.set(_ledMapping[ledIndex], LedFrame::Color(0, 0, 25));
                 }
                 else
                 {
-                    ws2812b.setPixelColor(_ledMapping[ledIndex], ws2812b.Color(0, 0, 0)); // it only takes effect if pixels.show() is called
+                    _context.fuelLeds.set(_ledMapping[ledIndex], LedFrame::Color(0, 0, 0));
                 }
                 ledIndex++;
             }
         }
-        ws2812b.show();
-    }
-
-    bool isConnected(byte OutputPin, byte InputPin)
-    {
-        // To test whether the pins are connected, set the first as output and the second as input
-        pinMode(OutputPin, OUTPUT);
-        pinMode(InputPin, INPUT_PULLUP);
-
-        // Set the output pin LOW
-        digitalWrite(OutputPin, LOW);
-
-        // If connected, the LOW signal should now be detected on the input pin
-        // (Remember, we're using LOW not HIGH, because an INPUT_PULLUP will read HIGH by default)
-        bool result = !digitalRead(InputPin);
-
-        // Set the output pin back to its default state
-        pinMode(OutputPin, INPUT_PULLUP);
-
-        return result;
     }
 
     /**
      * The `play` function is responsible for controlling the gameplay logic of the fuel puzzle in the escape room game.
-     * It checks the state of the hint, reset button, transfer button, and the connection between jugs.
-     * If the hint state is in the first or second transfer, it calls the `hint` function.
+     * It checks the state of the hint, reset button, transfer button, and the debounced connection between jugs
+     * reported by the hose matrix scanner.
+     * While a hint is pouring, it only advances that transfer.
      * If the reset button is pressed, it calls the `reset` function with the `global` parameter set to false.
      * If the transfer button is pressed or the transfer state is true, it transfers fuel from one tank to another using the `transfer` function.
      * It checks if the transfer is possible based on the current values and capacities of the jugs.
-     * If the puzzle is solved, it either blinks the tank or calls the `solve` function to open the door.
+     * If the puzzle is solved, it blinks the tank and then reports the puzzle as solved.
+     *
+     * @return True once the target level was reached and the tank finished blinking.
      */
-    void play()
+    bool play()
     {
-        if (_hintState == FIRST_TRANSFER || _hintState == SECOND_TRANSFER)
+        if (_hintState == POURING)
         {
-            hint();
-            return;
+            if (transfer(_hintFrom, _hintTo))
+            {
+                _hintState = HINT_GIVEN;
+                _context.journal.log(EVENT_TRANSFER_END, _hintFrom << 4 | _hintTo, packedLevels());
+            }
+            return false;
         }
 
-        int resetButtonState = digitalRead(_resetButtonPin);
+        int resetButtonState = hal::digitalRead(_resetButtonPin);
         if (resetButtonState == LOW)
         {
             reset(false /*global*/);
         }
-        int transferButtonState = digitalRead(_transferButtonPin);
+        int transferButtonState = hal::digitalRead(_transferButtonPin);
 
-        if (!_transferState)
+        // the hose is scanned at its own rate; a connection is only trusted once it has been stable
+        _hoses.scan();
+        if (!_transferState && !_hoses.connection(_fromTank, _toTank))
         {
             _fromTank = -1;
             _toTank = -1;
-            for (int i = 0; i < _numTanks; i++)
-            {
-                for (int j = 0; j < _numTanks; j++)
-                {
-                    if (i == j)
-                        continue;
-                    if (isConnected(_fillingPins[i], _fillingPins[j]))
-                    {
-                        _fromTank = j;
-                        _toTank = i;
-                        break;
-                    }
-                }
-            }
         }
 
         if ((_fromTank != -1 && _toTank != -1) || _transferState)
         {
             if (_currentValues[_fromTank] > 0 && _currentValues[_toTank] < _capacities[_toTank])
             {
-                digitalWrite(_transferPossibleLED, HIGH);
+                hal::digitalWrite(_transferPossibleLED, HIGH);
                 if (transferButtonState == LOW || _transferState)
                 {
+                    if (!_transferState)
+                        _context.journal.log(EVENT_TRANSFER_START, _fromTank << 4 | _toTank);
                     _transferState = true;
                     transfer(_fromTank, _toTank);
                 }
             }
             else
             {
+                if (_transferState)
+                    _context.journal.log(EVENT_TRANSFER_END, _fromTank << 4 | _toTank, packedLevels());
                 _transferState = false;
                 _fromTank = _toTank = -1;
-                digitalWrite(_transferPossibleLED, LOW);
+                hal::digitalWrite(_transferPossibleLED, LOW);
             }
         }
         else
         {
-            digitalWrite(_transferPossibleLED, LOW);
+            hal::digitalWrite(_transferPossibleLED, LOW);
         }
 
         // check if the puzzle is solved and open the door.
         if ((isTransferSolved() && !_transferState))
         {
-            if (_blinkState)
+            if (!_blinkStarted)
             {
                 blinkTank();
             }
-            else
+            else if (!_tankBlink.running())
             {
-                solve();
+                return true;
             }
         }
+        return false;
     }
 
     bool isTransferSolved()
@@ -246,10 +237,10 @@ public:
     bool transfer(int from, int to)
     {
         // calculate how much fuel can be transferred
-        int amountToTransfer = min(_currentValues[from], _capacities[to] - _currentValues[to]);
+        int amountToTransfer = std::min(_currentValues[from], _capacities[to] - _currentValues[to]);
 
         // perform the transfer gradually
-        unsigned long currentTime = millis();
+        unsigned long currentTime = hal::millis();
         if (amountToTransfer > 0 && currentTime - _lastTransferTime >= _transferInterval)
         {
             _lastTransferTime = currentTime;
@@ -263,14 +254,10 @@ public:
     }
 
     /**
-     * @brief Blinks the tank LEDs based on the target tank level.
-     * 
-     * This function calculates the offset of the LEDs based on the target tank level and blinks the LEDs accordingly.
-     * It uses the millis() function to determine the current time and checks if enough time has passed to blink the LEDs.
-     * The LEDs are set to a specific color depending on the light state.
-     * If the blink count reaches zero, the LEDs are set to a different color and the blink state is set to false.
-     * 
-     * @note This function requires the ws2812b library to control the LEDs.
+     * @brief Starts blinking the fuel in the tank that holds the target amount.
+     *
+     * The target tank's fuel LEDs blink green ten times and then go back to blue, as an Animation on the `fuelLeds`
+     * segment; `play()` reports the puzzle solved once it is over.
      */
     void blinkTank()
     {
@@ -279,43 +266,27 @@ public:
         {
             ledsOffset += _capacities[i];
         }
-        unsigned long currentTime = millis();
-        if (currentTime - _lastBlinkTime >= _blinkInterval && _blinkCount > 0)
+        uint32_t pixelMask = 0;
+        for (int i = 0; i < _target; i++)
         {
-            _lastBlinkTime = currentTime;
-            if (_light)
-            {
-                for (int i = 0; i < _target; i++)
-                {
-                    ws2812b.setPixelColor(_ledMapping[i + ledsOffset], ws2812b.Color(0, 25, 0)); // it only takes effect if pixels.show() is called
-                }
-                ws2812b.show();
-            }
-            else
-            {
-                for (int i = 0; i < _target; i++)
-                {
-                    ws2812b.setPixelColor(_ledMapping[i + ledsOffset], ws2812b.Color(0, 0, 0)); // it only takes effect if pixels.show() is called
-                }
-                ws2812b.show();
-                _blinkCount--;
-            }
-            _light = !_light;
-        }
-
-        if (_blinkCount <= 0)
-        {
-            _blinkState = false;
-            _blinkCount = BLINK_COUNT;
-            for (int i = 0; i < _target; i++)
-            {
-                ws2812b.setPixelColor(_ledMapping[i + ledsOffset], ws2812b.Color(0, 0, 25)); // it only takes effect if pixels.show() is called
-            }
-            ws2812b.show();
+            pixelMask |= 1u << _ledMapping[i + ledsOffset];
         }
+        _tankBlink.start(_solvedBlink, pixelMask);
+        _blinkStarted = true;
     }
 
 private:
+    // fuel levels for the journal, 4 bits per tank
+    uint16_t packedLevels() const
+    {
+        uint16_t levels = 0;
+        for (int i = 0; i < _numTanks && i < 4; i++)
+            levels |= _currentValues[i] << (4 * i);
+        return levels;
+    }
+
+    GameContext &_context;
+
     // transfer state variables
     const unsigned long _transferInterval = 500;
     unsigned long _lastTransferTime;
@@ -324,33 +295,32 @@ private:
     int _toTank;
 
     // blinking state variables
-    const unsigned long _blinkInterval = 100;
-    int _blinkCount;
-    unsigned long _lastBlinkTime;
+    static constexpr auto _solvedBlink = animations::blink<100, 100, 10>(animations::rgb(0, 25, 0), animations::rgb(0, 0, 25));
     int _targetTank;
-    bool _blinkState;
-    bool _light;
-
-    // connection variables
-    const unsigned long _connectInterval = 100;
-    unsigned long _lastConnectTime;
-    bool _connectState;
+    bool _blinkStarted;
+    Animation _tankBlink;
 
     // puzzle state variables
     hintState _hintState;
+    int _hintFrom;
+    int _hintTo;
 
     // puzzle variables
-    const int _numTanks = 3;
-    const int _capacities[3] = {8, 5, 3};
-    const int _target = 4;
-    int _currentValues[3] = {8, 0, 0};
+    typedef FuelMoves<4 /*target*/, 8, 5, 3 /*capacities*/> Moves;
+    static const int _numTanks = Moves::numTanks;
+    static constexpr const int *_capacities = Moves::capacities;
+    static const int _target = Moves::target;
+    static constexpr int _startValues[_numTanks] = {8, 0, 0};
+    static_assert(Moves::distance(_startValues) != Moves::unsolvable, "the fuel puzzle can't be solved from its start");
+    int _currentValues[_numTanks] = {8, 0, 0};
 
     // Pins and LED indexes
     const byte _relayPin = 12;
     const byte _transferButtonPin = 35;
     const byte _transferPossibleLED = 32;
     const byte _resetButtonPin = 34;
-    const byte _fillingPins[3] = {25, 26, 27};
+    const byte _fillingPins[_numTanks] = {25, 26, 27};
+    HoseMatrix<_numTanks> _hoses;
     const int _ledMapping[16] = {0, 1, 2, 3, 4, 5, 6, 7, 12, 11, 10, 9, 8, 13, 14, 15};
 public:
     Compartment compartment;
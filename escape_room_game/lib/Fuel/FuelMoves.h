@@ -0,0 +1,160 @@
+#ifndef FUEL_MOVES_H
+#define FUEL_MOVES_H
+
+#include <stdint.h>
+
+/**
+ * @class FuelMoves
+ * @brief Compile-time table of optimal pours for the fuel puzzle.
+ *
+ * Every combination of tank levels is a state, numbered in mixed radix (tank 0 is the lowest digit).
+ * A pour always runs until the source is empty or the destination is full, like `Fuel::transfer`.
+ * The table is built by the compiler: goal states (any tank holding Target) get distance 0, then the
+ * distances are relaxed over all pours until nothing changes, which is a breadth-first search run backwards.
+ * Each entry keeps the number of pours still needed and the first pour of one shortest solution, so the
+ * next optimal move from any state is a single lookup. Being constexpr, the table lives in flash.
+ *
+ * @tparam Target amount of fuel that has to end up in one tank
+ * @tparam Capacities capacity of each tank
+ */
+template <int Target, int... Capacities>
+class FuelMoves
+{
+public:
+    static const int numTanks = sizeof...(Capacities);
+    static const int target = Target;
+    static constexpr int capacities[numTanks] = {Capacities...};
+    static const int numStates = ((Capacities + 1) * ...);
+    static const uint8_t unsolvable = 0xFF;
+
+    static_assert(numTanks >= 2 && numTanks <= 16, "moves are packed as two nibbles");
+
+    struct Entry
+    {
+        uint8_t distance; // pours left, unsolvable if the target can't be reached
+        uint8_t move;     // from << 4 | to
+    };
+
+    struct Table
+    {
+        Entry entries[numStates];
+    };
+
+    static constexpr int encode(const int *values)
+    {
+        int index = 0;
+        for (int i = numTanks - 1; i >= 0; i--)
+            index = index * (capacities[i] + 1) + values[i];
+        return index;
+    }
+
+    static constexpr void decode(int index, int *values)
+    {
+        for (int i = 0; i < numTanks; i++)
+        {
+            values[i] = index % (capacities[i] + 1);
+            index /= capacities[i] + 1;
+        }
+    }
+
+    static constexpr bool isSolved(const int *values)
+    {
+        for (int i = 0; i < numTanks; i++)
+        {
+            if (values[i] == Target)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @return The state after pouring from `from` into `to`, or -1 if nothing can be poured.
+     */
+    static constexpr int pour(int index, int from, int to)
+    {
+        int values[numTanks] = {};
+        decode(index, values);
+        int amount = values[from] < capacities[to] - values[to] ? values[from] : capacities[to] - values[to];
+        if (from == to || amount <= 0)
+            return -1;
+        values[from] -= amount;
+        values[to] += amount;
+        return encode(values);
+    }
+
+    static constexpr Table build()
+    {
+        Table table = {};
+        for (int s = 0; s < numStates; s++)
+        {
+            int values[numTanks] = {};
+            decode(s, values);
+            table.entries[s].distance = isSolved(values) ? 0 : unsolvable;
+        }
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (int s = 0; s < numStates; s++)
+            {
+                for (int from = 0; from < numTanks; from++)
+                {
+                    for (int to = 0; to < numTanks; to++)
+                    {
+                        const int next = pour(s, from, to);
+                        if (next < 0 || table.entries[next].distance == unsolvable)
+                            continue;
+                        if (table.entries[next].distance + 1 < table.entries[s].distance)
+                        {
+                            table.entries[s].distance = table.entries[next].distance + 1;
+                            table.entries[s].move = from << 4 | to;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+        return table;
+    }
+
+    /**
+     * Checks the table against itself: every solvable state that is not a goal has a move, and that move
+     * is a legal pour into a state exactly one pour closer to the goal.
+     */
+    static constexpr bool isConsistent(const Table &table)
+    {
+        for (int s = 0; s < numStates; s++)
+        {
+            const Entry entry = table.entries[s];
+            if (entry.distance == 0 || entry.distance == unsolvable)
+                continue;
+            const int next = pour(s, entry.move >> 4, entry.move & 0x0F);
+            if (next < 0 || table.entries[next].distance + 1 != entry.distance)
+                return false;
+        }
+        return true;
+    }
+
+    static constexpr Table table = build();
+    static_assert(isConsistent(table), "fuel move table is inconsistent");
+
+    static constexpr uint8_t distance(const int *values) { return table.entries[encode(values)].distance; }
+
+    /**
+     * Gets the first pour of a shortest solution from the given levels.
+     *
+     * @return False if the levels are already solved or can't be solved.
+     */
+    static bool nextMove(const int *values, int &from, int &to)
+    {
+        const Entry entry = table.entries[encode(values)];
+        if (entry.distance == 0 || entry.distance == unsolvable)
+            return false;
+        from = entry.move >> 4;
+        to = entry.move & 0x0F;
+        return true;
+    }
+};
+
+#endif /* FUEL_MOVES_H */
@@ -0,0 +1,45 @@
+#ifndef HAL_H
+#define HAL_H
+
+/**
+ * @brief Hardware abstraction layer.
+ *
+ * Everything the game touches that depends on the board (time, GPIO, the NeoPixel strip, the I2C keypad,
+ * the HT16K33 timer display, WiFi, mDNS and the MQTT client) is reached through the `hal` namespace.
+ * On the ESP32 (ARDUINO defined) the calls forward straight to the Arduino core and the libraries in `lib_deps`.
+ * Everywhere else a simulated backend with virtual pins, a virtual clock and virtual peripherals is used,
+ * so the unchanged game logic can run on a dev box (see `[env:native]` in platformio.ini).
+ */
+#ifdef ARDUINO
+#include "HalEsp32.h"
+#else
+#include "HalNative.h"
+#endif
+
+namespace hal
+{
+    const uint32_t gpioSettleMicros = 2; // from driving a pin to reading the others
+    const uint32_t gpioRiseMicros = 50;  // at most, for released pins to be pulled back up
+
+    /**
+     * @brief Drives the pin `driver` LOW and returns which of the other `pins` that pulls LOW too, e.g. through a
+     * hose with a diode. All of them must be inputs with pull-ups.
+     *
+     * A real pull-down only shows after the input synchronizer and the wire capacitance against the ~45 kOhm pull-up,
+     * so the levels are read gpioSettleMicros after the drive. After the release it waits until all `pins` read HIGH
+     * again, at most gpioRiseMicros, so the next probe cannot take a line that is still rising for a link.
+     */
+    inline uint64_t gpioProbeLow(uint8_t driver, uint64_t pins)
+    {
+        const uint64_t driverMask = 1ull << driver;
+        gpioDriveLow(driverMask);
+        delayMicros(gpioSettleMicros);
+        const uint64_t pulledLow = ~gpioReadAll() & pins & ~driverMask;
+        gpioRelease(driverMask);
+        for (uint32_t waited = 0; (gpioReadAll() & pins) != pins && waited < gpioRiseMicros; waited++)
+            delayMicros(1);
+        return pulledLow;
+    }
+}
+
+#endif /* HAL_H */
@@ -0,0 +1,594 @@
+#ifndef HAL_ESP32_H
+#define HAL_ESP32_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <soc/gpio_struct.h>
+#include <driver/rmt.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <WiFiManager.h>
+#include <ESPmDNS.h>
+#include <mdns.h>
+#include <PubSubClient.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+#include <I2CKeyPad.h>
+#include <CountDown.h>
+#include <HT16K33.h>
+#include <Preferences.h>
+#include "Ws2812.h"
+#include "InputTrace.h"
+
+namespace hal
+{
+    // INPUT TRACE
+    // Built with -DINPUT_TRACE, every input of the game loop is recorded (see InputTrace.h) and streamed out on
+    // UART2 (TX on GPIO 17) at 2 Mbaud, e.g. into a USB serial adapter: `cat /dev/ttyUSB1 > game.trace`.
+    // A full UART buffer stalls the game loop until there is room, so a trace build runs fewer passes per second.
+#ifdef INPUT_TRACE
+    inline inputtrace::Session &trace() { return inputtrace::session; }
+#else
+    inline inputtrace::Passthrough &trace()
+    {
+        static inputtrace::Passthrough passthrough;
+        return passthrough;
+    }
+#endif
+
+    // TIME
+    inline unsigned long millis() { return trace().millis(::millis()); }
+    inline int64_t esp_timer_get_time() { return trace().micros(::esp_timer_get_time()); }
+    inline void delay(unsigned long ms) { ::delay(ms); }
+    inline void delayMicros(uint32_t us) { ::delayMicroseconds(us); } // busy-waits
+
+    // GPIO
+    inline void pinMode(uint8_t pin, uint8_t mode) { ::pinMode(pin, mode); }
+    inline int digitalRead(uint8_t pin) { return trace().pin(pin, ::digitalRead(pin)); }
+    inline void digitalWrite(uint8_t pin, uint8_t level) { ::digitalWrite(pin, level); }
+    inline void attachInterrupt(uint8_t pin, void (*isr)(void *arg), void *arg, int mode) { ::attachInterruptArg(digitalPinToInterrupt(pin), isr, arg, mode); }
+
+    // Batched access straight to the GPIO registers, one bit per pin (0-39).
+    // gpioDriveLow() enables the output driver of already configured pins with a LOW level and
+    // gpioRelease() disables it again, which leaves them as inputs with their pull-ups as set by pinMode().
+    inline uint64_t gpioReadAll() { return trace().gpio(((uint64_t)GPIO.in1.data << 32) | GPIO.in); }
+
+    inline void gpioDriveLow(uint64_t mask)
+    {
+        GPIO.out_w1tc = (uint32_t)mask;
+        GPIO.out1_w1tc.val = (uint32_t)(mask >> 32);
+        GPIO.enable_w1ts = (uint32_t)mask;
+        GPIO.enable1_w1ts.val = (uint32_t)(mask >> 32);
+    }
+
+    inline void gpioRelease(uint64_t mask)
+    {
+        GPIO.enable_w1tc = (uint32_t)mask;
+        GPIO.enable1_w1tc.val = (uint32_t)(mask >> 32);
+    }
+
+    // PERIPHERALS
+    /**
+     * @brief WS2812B strip clocked out by the RMT peripheral.
+     *
+     * `show()` encodes the pixels into RMT symbols (see Ws2812.h) and starts the transmission without waiting
+     * for it, so the CPU keeps running with interrupts enabled while the frame goes out. The symbols stay in
+     * their own buffer, which the RMT driver keeps reading while the pixels are already being changed for the
+     * next frame; `busy()` tells when the line is free for the next `show()`.
+     */
+    class Strip
+    {
+    public:
+        Strip(uint16_t numPixels, uint8_t pin, rmt_channel_t channel = RMT_CHANNEL_0)
+            : _numPixels(numPixels), _pin(pin), _channel(channel),
+              _pixels(new uint32_t[numPixels]()), _symbols(new ws2812::RmtSymbol[ws2812::symbolsFor(numPixels)]), _sending(false)
+        {
+        }
+
+        void begin()
+        {
+            rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)_pin, _channel);
+            config.clk_div = ws2812::clockDivider;
+            rmt_config(&config);
+            rmt_driver_install(_channel, 0, 0);
+        }
+
+        bool busy() { return trace().flag(sending()); }
+
+        void show()
+        {
+            if (sending())
+                return;
+            const size_t count = ws2812::encode(_pixels, _numPixels, _symbols);
+            _sending = rmt_write_items(_channel, (const rmt_item32_t *)_symbols, count, false) == ESP_OK;
+        }
+
+        void setPixelColor(uint16_t index, uint32_t color)
+        {
+            if (index < _numPixels)
+                _pixels[index] = color;
+        }
+        uint32_t getPixelColor(uint16_t index) const { return index < _numPixels ? _pixels[index] : 0; }
+        uint16_t numPixels() const { return _numPixels; }
+
+        static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+    private:
+        bool sending()
+        {
+            if (_sending && rmt_wait_tx_done(_channel, 0) == ESP_OK)
+                _sending = false;
+            return _sending;
+        }
+
+        const uint16_t _numPixels;
+        const uint8_t _pin;
+        const rmt_channel_t _channel;
+        uint32_t *_pixels;
+        ws2812::RmtSymbol *_symbols;
+        bool _sending;
+    };
+
+    class Keypad : public I2CKeyPad
+    {
+    public:
+        using I2CKeyPad::I2CKeyPad;
+        uint8_t getKey() { return trace().key(I2CKeyPad::getKey()); }
+    };
+
+    using SegmentDisplay = HT16K33;
+
+    /**
+     * @brief A chain of 74HC165 parallel-in shift registers on the VSPI bus: SCK on GPIO 18 to their clocks, the
+     * serial output of the first one on MISO (GPIO 19), and `latchPin` to their /PL inputs.
+     *
+     * `read()` latches every input at the same instant and shifts them all out in a single SPI transaction, so
+     * a snapshot of up to 32 switches costs one short pulse and a few microseconds of bus time. Input A of the
+     * register next to the ESP32 is bit 0, its input H bit 7, and the next register's inputs follow.
+     */
+    class ShiftInChain
+    {
+    public:
+        ShiftInChain(uint8_t latchPin, uint8_t numRegisters) : _latchPin(latchPin), _numRegisters(numRegisters < 4 ? numRegisters : 4) {}
+
+        void begin()
+        {
+            ::pinMode(_latchPin, OUTPUT);
+            ::digitalWrite(_latchPin, HIGH);
+            SPI.begin();
+        }
+
+        uint32_t read()
+        {
+            // /PL low loads the inputs into the registers, high again lets the clock shift them out, H first
+            ::digitalWrite(_latchPin, LOW);
+            ::digitalWrite(_latchPin, HIGH);
+            uint8_t bytes[4] = {};
+            SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE0));
+            SPI.transferBytes(nullptr, bytes, _numRegisters);
+            SPI.endTransaction();
+            uint32_t inputs = 0;
+            for (uint8_t i = 0; i < _numRegisters; i++)
+                inputs |= (uint32_t)bytes[i] << (8 * i);
+            return trace().value(inputs);
+        }
+
+    private:
+        const uint8_t _latchPin;
+        const uint8_t _numRegisters;
+    };
+
+    // reads its own clock, so its answers are inputs of their own
+    class CountDown : public ::CountDown
+    {
+    public:
+        using ::CountDown::CountDown;
+        bool isRunning() { return trace().flag(::CountDown::isRunning()); }
+        uint32_t remaining() { return trace().value(::CountDown::remaining()); }
+    };
+
+    inline void i2cBegin(uint32_t clock)
+    {
+        Wire.begin();
+        Wire.setClock(clock);
+    }
+
+    // esp_reset_reason_t, kept in the journal's BOOT record
+    inline uint8_t resetReason() { return trace().value(esp_reset_reason()); }
+
+    // ONE-SHOT TIMERS
+    // esp_timer callbacks run in the esp_timer task at the highest application priority, independent of loop().
+    class OneShotTimer
+    {
+    public:
+        typedef void (*Callback)(void *arg);
+
+        OneShotTimer(Callback callback, void *arg) : _callback(callback), _arg(arg), _handle(nullptr) {}
+
+        // fires at `deadline` in esp_timer_get_time() microseconds, or right away if that already passed
+        void startAt(int64_t deadline)
+        {
+            if (!_handle)
+            {
+                esp_timer_create_args_t args = {};
+                args.callback = _callback;
+                args.arg = _arg;
+                args.name = "relay";
+                esp_timer_create(&args, &_handle);
+            }
+            esp_timer_stop(_handle);
+            const int64_t delay = deadline - ::esp_timer_get_time();
+            esp_timer_start_once(_handle, delay > 0 ? delay : 0);
+        }
+
+        void stop()
+        {
+            if (_handle)
+                esp_timer_stop(_handle);
+        }
+
+    private:
+        const Callback _callback;
+        void *const _arg;
+        esp_timer_handle_t _handle;
+    };
+
+    // Keeps the game loop and a timer callback, which may run on the other core, out of each other's way, e.g. with
+    // std::lock_guard. Interrupts stay off on the core that holds it, so only ever for a few microseconds.
+    class Spinlock
+    {
+    public:
+        void lock() { portENTER_CRITICAL(&_mux); }
+        void unlock() { portEXIT_CRITICAL(&_mux); }
+
+    private:
+        portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    };
+
+    // TASKS
+    // Runs `setup` once and then `step` forever in a FreeRTOS task pinned to `core`. The one tick delay
+    // between steps lets the idle task of that core (and its watchdog) run.
+    inline void startTask(const char *name, int core, void (*setup)(void *arg), void (*step)(void *arg), void *arg)
+    {
+        struct Task
+        {
+            void (*setup)(void *arg);
+            void (*step)(void *arg);
+            void *arg;
+        };
+        xTaskCreatePinnedToCore(
+            [](void *arg)
+            {
+                const Task *task = (const Task *)arg;
+                if (task->setup)
+                    task->setup(task->arg);
+                for (;;)
+                {
+                    task->step(task->arg);
+                    vTaskDelay(1);
+                }
+            },
+            name, 8192, new Task{setup, step, arg}, 1, nullptr, core);
+    }
+
+    // IDLE
+    // Between passes it has nothing to do in, the game loop blocks on its task notification, and core 1 runs its idle
+    // task, which waits for the next interrupt with the CPU clock gated. Whatever has work for the loop gives the
+    // notification: the keypad INT handler, the network task when it queues an event. A notification given while the
+    // loop is still running is kept, so the next wait returns right away.
+    inline TaskHandle_t idleTask = nullptr;
+
+    // called by the task that is going to wait, before anything can wake it
+    inline void idleBegin() { idleTask = xTaskGetCurrentTaskHandle(); }
+
+    inline void idleWait(unsigned long ms) { ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms)); }
+
+    inline void idleWake()
+    {
+        if (idleTask)
+            xTaskNotifyGive(idleTask);
+    }
+
+    inline void IRAM_ATTR idleWakeFromIsr()
+    {
+        if (!idleTask)
+            return;
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(idleTask, &woken);
+        if (woken)
+            portYIELD_FROM_ISR();
+    }
+
+    // RTC MEMORY
+    // Left alone by the startup code, so it keeps its contents through every reset but a power-on.
+    const size_t rtcMemorySize = 64;
+
+    inline uint8_t *rtcMemory()
+    {
+        static RTC_NOINIT_ATTR uint8_t memory[rtcMemorySize];
+        return memory;
+    }
+
+    // Starts recording from the task that calls it (setup(), then loop()); the RTC memory goes first, as the
+    // game finds it. Does nothing unless built with -DINPUT_TRACE.
+    inline void startInputTrace()
+    {
+#ifdef INPUT_TRACE
+        static inputtrace::Writer writer([](const uint8_t *data, size_t size) { Serial2.write(data, size); });
+        Serial2.setTxBufferSize(16384);
+        Serial2.begin(2000000, SERIAL_8N1, -1, 17);
+        inputtrace::session.record(writer, []() -> const void * { return xTaskGetCurrentTaskHandle(); });
+        trace().blob(rtcMemory(), rtcMemorySize, rtcMemorySize);
+#endif
+    }
+
+    // STORAGE
+    // Small named blobs in the NVS partition, which does its own wear leveling.
+    inline Preferences &storage()
+    {
+        static Preferences preferences;
+        static const bool opened = preferences.begin("escape_room", false);
+        (void)opened;
+        return preferences;
+    }
+
+    inline size_t storageRead(const char *key, void *data, size_t size) { return trace().blob(data, storage().getBytes(key, data, size), size); }
+    inline bool storageWrite(const char *key, const void *data, size_t size) { return storage().putBytes(key, data, size) == size; }
+
+    // NETWORK
+    // A WiFiClient that, between beginBatch() and endBatch(), gathers what is written into one buffer and sends it
+    // with a single write at the end, so all the publishes of one network task pass leave in as few TCP segments as
+    // possible instead of one lwIP call and one segment each. Outside of a batch it writes straight through, which
+    // the MQTT handshake relies on. A write that fails at endBatch() drops the connection like any other.
+    //
+    // connectStart() and connectPoll() make the TCP connect non-blocking, and startSession() and sessionAnswered()
+    // the MQTT handshake: PubSubClient's connect() sends CONNECT and then waits for the CONNACK for as long as its
+    // socket timeout, a second at least. startSession() sends the same CONNECT ahead of time and swallows the next
+    // one written, so once the CONNACK is waiting PubSubClient's connect() reads it and returns straight away.
+    class NetClient : public WiFiClient
+    {
+    public:
+        // drops any connection that is still up
+        bool connectStart(IPAddress ip, uint16_t port)
+        {
+            stop();
+            _pending = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (_pending < 0)
+                return false;
+            fcntl(_pending, F_SETFL, fcntl(_pending, F_GETFL, 0) | O_NONBLOCK);
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = (uint32_t)ip;
+            address.sin_port = htons(port);
+            if (::connect(_pending, (sockaddr *)&address, sizeof(address)) == 0 || errno == EINPROGRESS)
+                return true;
+            abandonConnect();
+            return false;
+        }
+
+        // 1 once connected, 0 while the connect is under way, -1 if it failed
+        int connectPoll()
+        {
+            if (_pending < 0)
+                return connected() ? 1 : -1;
+            fd_set writable;
+            FD_ZERO(&writable);
+            FD_SET(_pending, &writable);
+            timeval noWait = {0, 0};
+            const int ready = select(_pending + 1, nullptr, &writable, nullptr, &noWait);
+            if (ready == 0)
+                return 0;
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (ready < 0 || getsockopt(_pending, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+            {
+                abandonConnect();
+                return -1;
+            }
+            // blocking again, with the options WiFiClient::connect() sets, and the WiFiClient takes the socket over
+            fcntl(_pending, F_SETFL, fcntl(_pending, F_GETFL, 0) & ~O_NONBLOCK);
+            const int enable = 1;
+            setsockopt(_pending, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+            setsockopt(_pending, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+            WiFiClient::operator=(WiFiClient(_pending));
+            _pending = -1;
+            return 1;
+        }
+
+        // an MQTT 3.1.1 CONNECT with a clean session and only a client id, like PubSubClient's
+        bool startSession(const char *clientId, uint16_t keepAliveSeconds)
+        {
+            const size_t idLength = strlen(clientId);
+            uint8_t packet[14 + 23]; // the longest client id MQTT 3.1.1 guarantees
+            if (idLength > sizeof(packet) - 14)
+                return false;
+            const uint8_t header[14] = {0x10, (uint8_t)(12 + idLength), 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02,
+                                        (uint8_t)(keepAliveSeconds >> 8), (uint8_t)keepAliveSeconds, 0, (uint8_t)idLength};
+            memcpy(packet, header, sizeof(header));
+            memcpy(packet + sizeof(header), clientId, idLength);
+            _swallowConnect = true;
+            return writeThrough(packet, sizeof(header) + idLength) == sizeof(header) + idLength;
+        }
+
+        // the CONNACK is in, 4 bytes
+        bool sessionAnswered() { return available() >= 4; }
+
+        void beginBatch() { _batching = true; }
+        void endBatch()
+        {
+            flushBatch();
+            _batching = false;
+        }
+
+        // to the socket: one per write outside of a batch, one per batch
+        unsigned long writes() const { return _writes; }
+
+        size_t write(uint8_t data) override { return write(&data, 1); }
+        size_t write(const uint8_t *data, size_t size) override
+        {
+            if (_swallowConnect && size > 0 && (data[0] & 0xF0) == 0x10)
+            {
+                // PubSubClient's CONNECT, already sent by startSession()
+                _swallowConnect = false;
+                return size;
+            }
+            if (!_batching)
+                return writeThrough(data, size);
+            if (_length + size > sizeof(_buffer))
+                flushBatch();
+            if (size > sizeof(_buffer))
+                return writeThrough(data, size);
+            memcpy(_buffer + _length, data, size);
+            _length += size;
+            return size;
+        }
+
+        void stop() override
+        {
+            abandonConnect();
+            _length = 0;
+            _swallowConnect = false;
+            WiFiClient::stop();
+        }
+
+    private:
+        void abandonConnect()
+        {
+            if (_pending >= 0)
+                ::close(_pending);
+            _pending = -1;
+        }
+
+        size_t writeThrough(const uint8_t *data, size_t size)
+        {
+            _writes++;
+            return WiFiClient::write(data, size);
+        }
+
+        void flushBatch()
+        {
+            if (_length > 0)
+                writeThrough(_buffer, _length);
+            _length = 0;
+        }
+
+        uint8_t _buffer[1436]; // one TCP segment at the lwIP default MSS
+        size_t _length = 0;
+        bool _batching = false;
+        unsigned long _writes = 0;
+        int _pending = -1; // the socket of a connect under way
+        bool _swallowConnect = false;
+    };
+    using MqttClient = PubSubClient;
+    using ::IPAddress;
+
+    inline bool wifiAutoConnect(const char *apName, unsigned long portalTimeoutSeconds)
+    {
+        WiFiManager wifiManager;
+        wifiManager.setConfigPortalTimeout(portalTimeoutSeconds);
+        return wifiManager.autoConnect(apName);
+    }
+
+    // Where the last connection went, so the next boot can skip the scan and DHCP. The SSID and password stay
+    // in the WiFi driver's own NVS config, where WiFiManager saved them.
+    struct WifiCache
+    {
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint8_t reserved;
+        uint32_t ip, gateway, subnet, dns;
+    };
+
+    // Joins the cached access point with the cached static address; falls back to DHCP and returns false on timeout.
+    inline bool wifiConnectCached(const WifiCache &cache, unsigned long timeoutMs)
+    {
+        WiFi.mode(WIFI_STA);
+        wifi_config_t config;
+        if (cache.channel == 0 || esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK || config.sta.ssid[0] == 0)
+            return false;
+
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin((const char *)config.sta.ssid, (const char *)config.sta.password, cache.channel, cache.bssid);
+        const unsigned long start = ::millis();
+        while (WiFi.status() != WL_CONNECTED && ::millis() - start < timeoutMs)
+            ::delay(10);
+        if (WiFi.status() == WL_CONNECTED)
+            return true;
+
+        WiFi.disconnect();
+        WiFi.config(IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+        return false;
+    }
+
+    inline bool wifiCurrent(WifiCache &cache)
+    {
+        if (WiFi.status() != WL_CONNECTED)
+            return false;
+        memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+        cache.channel = WiFi.channel();
+        cache.reserved = 0;
+        cache.ip = WiFi.localIP();
+        cache.gateway = WiFi.gatewayIP();
+        cache.subnet = WiFi.subnetMask();
+        cache.dns = WiFi.dnsIP();
+        return true;
+    }
+
+    enum mdnsQueryStatus
+    {
+        MDNS_QUERY_PENDING,
+        MDNS_QUERY_FOUND,
+        MDNS_QUERY_NOT_FOUND
+    };
+
+    inline bool mdnsBegin(const char *hostname) { return MDNS.begin(hostname); }
+    inline void mdnsAddService(const char *service, const char *proto, uint16_t port) { MDNS.addService(service, proto, port); }
+
+    // Asynchronous PTR query, so a lookup never blocks the caller for the whole mDNS timeout
+    inline mdns_search_once_t *mdnsSearch = nullptr;
+
+    inline bool mdnsQueryStart(const char *service, const char *proto, unsigned long timeoutMs)
+    {
+        if (mdnsSearch != nullptr)
+            mdns_query_async_delete(mdnsSearch);
+
+        char serviceType[32], protocol[8];
+        snprintf(serviceType, sizeof(serviceType), "_%s", service);
+        snprintf(protocol, sizeof(protocol), "_%s", proto);
+        mdnsSearch = mdns_query_async_new(NULL, serviceType, protocol, MDNS_TYPE_PTR, timeoutMs, 1, NULL);
+        return mdnsSearch != nullptr;
+    }
+
+    inline mdnsQueryStatus mdnsQueryPoll(IPAddress &ip)
+    {
+        if (mdnsSearch == nullptr)
+            return MDNS_QUERY_NOT_FOUND;
+
+        mdns_result_t *results = nullptr;
+        if (!mdns_query_async_get_results(mdnsSearch, 0, &results))
+            return MDNS_QUERY_PENDING;
+        mdns_query_async_delete(mdnsSearch);
+        mdnsSearch = nullptr;
+
+        mdnsQueryStatus status = MDNS_QUERY_NOT_FOUND;
+        for (mdns_result_t *result = results; result != nullptr && status != MDNS_QUERY_FOUND; result = result->next)
+        {
+            for (mdns_ip_addr_t *address = result->addr; address != nullptr; address = address->next)
+            {
+                if (address->addr.type == ESP_IPADDR_TYPE_V4)
+                {
+                    ip = IPAddress(address->addr.u_addr.ip4.addr);
+                    status = MDNS_QUERY_FOUND;
+                    break;
+                }
+            }
+        }
+        mdns_query_results_free(results);
+        return status;
+    }
+}
+
+#endif /* HAL_ESP32_H */
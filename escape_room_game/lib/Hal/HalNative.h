@@ -0,0 +1,919 @@
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Ws2812.h"
+#include "InputTrace.h"
+
+/* ARDUINO CORE TYPES AND CONSTANTS */
+typedef uint8_t byte;
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+
+namespace hal
+{
+    class IPAddress
+    {
+    public:
+        IPAddress() : _octets{0, 0, 0, 0} {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _octets{a, b, c, d} {}
+
+        uint8_t operator[](int index) const { return _octets[index]; }
+        bool operator==(const IPAddress &other) const { return memcmp(_octets, other._octets, sizeof(_octets)) == 0; }
+
+        std::string toString() const
+        {
+            char buffer[16];
+            snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", _octets[0], _octets[1], _octets[2], _octets[3]);
+            return buffer;
+        }
+
+    private:
+        uint8_t _octets[4];
+    };
+
+    /**
+     * @brief Simulated hardware.
+     *
+     * The state of the virtual board lives here so a host driver can poke the inputs (pins, keypad, broker)
+     * and inspect the outputs (pixels, display, publishes) while the game code runs against it. Every thread has a
+     * board of its own, so several threads can each run a game (see src/native/games.cpp), and reset() puts it back
+     * to power-on for the next one.
+     */
+    namespace sim
+    {
+        // VIRTUAL CLOCK
+        inline thread_local int64_t nowMicros = 0;
+
+        // what runs right now: nullptr for setup() and loop(), a task or a timer otherwise (see InputTrace.h)
+        inline thread_local const void *currentTask = nullptr;
+        inline const void *taskId() { return currentTask; }
+
+        // OUTPUT LOG
+        // When set, every LED frame, output edge and publish of the game loop is appended as a line of text, so the
+        // outputs of two runs (a recording and its replay) can be compared byte for byte.
+        inline thread_local std::string *outputLog = nullptr;
+
+        inline void logOutput(const char *format, ...) __attribute__((format(printf, 1, 2)));
+        inline void logOutput(const char *format, ...)
+        {
+            char line[320];
+            va_list args;
+            va_start(args, format);
+            vsnprintf(line, sizeof(line), format, args);
+            va_end(args);
+            outputLog->append(line).push_back('\n');
+        }
+
+        // VIRTUAL ESP_TIMER
+        // Armed one-shot timers fire while the clock advances, each at exactly its deadline.
+        struct Timer
+        {
+            void (*callback)(void *arg);
+            void *arg;
+            int64_t deadline = 0;
+            bool armed = false;
+        };
+        inline thread_local std::vector<Timer *> timers;
+
+        inline void advanceMicros(int64_t us)
+        {
+            const int64_t target = nowMicros + us;
+            for (;;)
+            {
+                Timer *next = nullptr;
+                for (Timer *timer : timers)
+                {
+                    if (timer->armed && timer->deadline <= target && (!next || timer->deadline < next->deadline))
+                        next = timer;
+                }
+                if (!next)
+                    break;
+                nowMicros = std::max(nowMicros, next->deadline);
+                next->armed = false;
+                const void *interrupted = currentTask;
+                currentTask = next; // the esp_timer task, not the game loop
+                next->callback(next->arg);
+                currentTask = interrupted;
+            }
+            nowMicros = target;
+        }
+        inline void advanceMillis(unsigned long ms) { advanceMicros((int64_t)ms * 1000); }
+
+        // VIRTUAL PINS
+        const int numPins = 40;
+
+        struct Pin
+        {
+            uint8_t mode = INPUT;
+            uint8_t level = LOW;
+            int8_t forcedLevel = -1; // driven from outside the board (button, reed switch)
+            int8_t linkedFrom = -1;  // another pin wired to this one through a diode (fuel hose)
+            void (*isr)(void *arg) = nullptr;
+            void *isrArg = nullptr;
+            int isrMode = 0;
+        };
+        inline thread_local Pin pins[numPins];
+
+        // pins the firmware scans itself by driving them low with gpioDriveLow() (the hose matrix)
+        inline thread_local uint64_t scannedPins = 0;
+
+        // runs the pin's interrupt handler if the external level change from `before` to `after` matches its mode
+        inline void interrupt(uint8_t pin, int before, int after)
+        {
+            const Pin &p = pins[pin];
+            if (!p.isr || before == after)
+                return;
+            if (p.isrMode == CHANGE || (p.isrMode == FALLING && after == LOW) || (p.isrMode == RISING && after == HIGH))
+                p.isr(p.isrArg);
+        }
+
+        inline int externalLevel(uint8_t pin) { return pins[pin].forcedLevel >= 0 ? pins[pin].forcedLevel : pins[pin].mode == INPUT_PULLUP; }
+
+        inline void setPin(uint8_t pin, uint8_t level)
+        {
+            const int before = externalLevel(pin);
+            pins[pin].forcedLevel = level;
+            interrupt(pin, before, level);
+        }
+        inline void releasePin(uint8_t pin)
+        {
+            const int before = externalLevel(pin);
+            pins[pin].forcedLevel = -1;
+            interrupt(pin, before, externalLevel(pin));
+        }
+        // what the firmware reads on a pin
+        inline int readLevel(uint8_t pin)
+        {
+            const Pin &p = pins[pin];
+            if (p.forcedLevel >= 0)
+                return p.forcedLevel;
+            if (p.linkedFrom >= 0 && pins[p.linkedFrom].mode == OUTPUT && pins[p.linkedFrom].level == LOW)
+                return LOW;
+            if (p.mode == OUTPUT)
+                return p.level;
+            return p.mode == INPUT_PULLUP ? HIGH : LOW;
+        }
+
+        inline void linkPins(uint8_t from, uint8_t to) { pins[to].linkedFrom = from; }
+        inline void unlinkPin(uint8_t to) { pins[to].linkedFrom = -1; }
+
+        // every level change written to an output, for checking pulse timing from the host
+        struct Edge
+        {
+            uint8_t pin;
+            uint8_t level;
+            int64_t micros;
+        };
+        inline thread_local std::vector<Edge> edges;
+
+        // I/O the firmware did, for the host benchmarks: GPIO input register reads (a digitalRead() or one
+        // gpioReadAll()) and I2C transactions (keypad scans and display writes). Strip show()s are framesShown.
+        inline thread_local unsigned long pinReads = 0;
+        inline thread_local unsigned long i2cTransactions = 0;
+
+        // VIRTUAL PCF8574 KEYPAD
+        // Its open-drain INT output is wired to GPIO 4 as on the board: it goes LOW when the keys change and is
+        // released by the next read. Every getKey() is counted as one I2C scan.
+        const uint8_t noKey = 16;
+        const uint8_t keypadIntPin = 4;
+        inline thread_local uint8_t keyIndex = noKey;
+        inline thread_local unsigned long keypadScans = 0;
+
+        inline void changeKey(uint8_t index)
+        {
+            if (index == keyIndex)
+                return;
+            keyIndex = index;
+            setPin(keypadIntPin, LOW);
+        }
+        inline void pressKey(uint8_t index) { changeKey(index); }
+        inline void releaseKey() { changeKey(noKey); }
+
+        // VIRTUAL 74HC165 CHAIN
+        // The levels on the parallel inputs of the shift register chain, bit 0 on input A of the first register.
+        // Every read() of the chain is counted as one SPI transaction.
+        inline thread_local uint32_t shiftInputs = 0;
+        inline thread_local unsigned long spiTransactions = 0;
+
+        // VIRTUAL NEOPIXEL FRAMEBUFFER
+        // What the strip latched, decoded from the RMT symbols the frame was encoded into.
+        inline thread_local std::vector<uint32_t> frame;
+        inline thread_local unsigned long framesShown = 0;
+        inline thread_local unsigned long frameTimingErrors = 0;
+
+        // VIRTUAL HT16K33
+        inline thread_local int displayedMinute = -1;
+        inline thread_local int displayedSecond = -1;
+
+        // VIRTUAL BROKER
+        struct Message
+        {
+            std::string topic;
+            std::string payload;
+        };
+
+        struct Broker
+        {
+            bool reachable = true;
+            std::vector<std::string> subscriptions;
+            std::deque<Message> inbound;
+            std::vector<Message> published;
+
+            void inject(const std::string &topic, const std::string &payload) { inbound.push_back({topic, payload}); }
+
+            bool sawPublish(const std::string &topic, const std::string &payload) const
+            {
+                return std::any_of(published.begin(), published.end(), [&](const Message &message)
+                                   { return message.topic == topic && message.payload == payload; });
+            }
+        };
+        inline thread_local Broker broker;
+
+        // VIRTUAL WIFI AND MDNS
+        inline thread_local unsigned long wifiCachedConnects = 0;
+        inline thread_local unsigned long wifiPortalConnects = 0;
+        inline thread_local unsigned long mdnsQueries = 0;
+
+        // VIRTUAL NVS AND RTC MEMORY
+        // A host driver can carry both over into a fresh process to simulate a reset.
+        inline thread_local std::map<std::string, std::vector<uint8_t>> storage;
+        inline thread_local uint8_t rtcMemory[64];
+        inline thread_local uint8_t resetReason = 1; // ESP_RST_POWERON
+
+        // VIRTUAL TASKS
+        // Run cooperatively: the driver calls stepTasks() after every loop() pass, which keeps the sim deterministic.
+        struct Task
+        {
+            const char *name;
+            void (*step)(void *arg);
+            void *arg;
+        };
+        inline thread_local std::vector<Task> tasks;
+
+        inline void stepTasks()
+        {
+            for (const Task &task : tasks)
+            {
+                currentTask = &task;
+                task.step(task.arg);
+            }
+            currentTask = nullptr;
+        }
+
+        // VIRTUAL IDLE WAIT
+        // hal::idleWait() only notes until when the game loop waits; the driver skips its loop() passes while
+        // sleeping() (see src/native/scenario.h), and keeps stepping the tasks and the clock. A wake given while the
+        // loop runs is kept for its next wait, as the FreeRTOS task notification is.
+        inline thread_local int64_t idleUntilMicros = 0;
+        inline thread_local bool idleWoken = false;
+
+        inline bool sleeping()
+        {
+            if (nowMicros >= idleUntilMicros)
+                return false;
+            if (idleWoken)
+            {
+                idleWoken = false;
+                idleUntilMicros = 0;
+                return false;
+            }
+            return true;
+        }
+
+        inline thread_local bool verbose = false;
+
+        // BOARDS
+        // A host running several rooms on one thread keeps the board of each in a Board while it is not the room's
+        // turn, and swaps it in for the turn (see src/native/daemon.cpp). The containers are swapped, not copied.
+        struct Board
+        {
+            int64_t nowMicros = 0;
+            std::vector<Timer *> timers;
+            Pin pins[numPins];
+            uint64_t scannedPins = 0;
+            std::vector<Edge> edges;
+            unsigned long pinReads = 0;
+            unsigned long i2cTransactions = 0;
+            uint8_t keyIndex = noKey;
+            unsigned long keypadScans = 0;
+            uint32_t shiftInputs = 0;
+            unsigned long spiTransactions = 0;
+            std::vector<uint32_t> frame;
+            unsigned long framesShown = 0;
+            unsigned long frameTimingErrors = 0;
+            int displayedMinute = -1;
+            int displayedSecond = -1;
+            Broker broker;
+            unsigned long wifiCachedConnects = 0;
+            unsigned long wifiPortalConnects = 0;
+            unsigned long mdnsQueries = 0;
+            std::map<std::string, std::vector<uint8_t>> storage;
+            uint8_t rtcMemory[sizeof(sim::rtcMemory)] = {};
+            uint8_t resetReason = 1;
+            std::vector<Task> tasks;
+            int64_t idleUntilMicros = 0;
+            bool idleWoken = false;
+        };
+
+        // exchanges the board of this thread with `board`; only between two passes, with no task or timer running
+        inline void swapBoard(Board &board)
+        {
+            std::swap(nowMicros, board.nowMicros);
+            std::swap(timers, board.timers);
+            std::swap(pins, board.pins);
+            std::swap(scannedPins, board.scannedPins);
+            std::swap(edges, board.edges);
+            std::swap(pinReads, board.pinReads);
+            std::swap(i2cTransactions, board.i2cTransactions);
+            std::swap(keyIndex, board.keyIndex);
+            std::swap(keypadScans, board.keypadScans);
+            std::swap(shiftInputs, board.shiftInputs);
+            std::swap(spiTransactions, board.spiTransactions);
+            std::swap(frame, board.frame);
+            std::swap(framesShown, board.framesShown);
+            std::swap(frameTimingErrors, board.frameTimingErrors);
+            std::swap(displayedMinute, board.displayedMinute);
+            std::swap(displayedSecond, board.displayedSecond);
+            std::swap(broker, board.broker);
+            std::swap(wifiCachedConnects, board.wifiCachedConnects);
+            std::swap(wifiPortalConnects, board.wifiPortalConnects);
+            std::swap(mdnsQueries, board.mdnsQueries);
+            std::swap(storage, board.storage);
+            std::swap(rtcMemory, board.rtcMemory);
+            std::swap(resetReason, board.resetReason);
+            std::swap(tasks, board.tasks);
+            std::swap(idleUntilMicros, board.idleUntilMicros);
+            std::swap(idleWoken, board.idleWoken);
+        }
+
+        // the board as it comes out of a power-on reset, with nothing recorded yet, for the next game on this thread
+        inline void reset()
+        {
+            Board fresh;
+            swapBoard(fresh);
+            currentTask = nullptr;
+            outputLog = nullptr;
+        }
+    }
+
+    // INPUT TRACE
+    // Always compiled in: a host driver can record or replay a game (see InputTrace.h).
+    inline inputtrace::Session &trace() { return inputtrace::session; }
+
+    // TIME
+    inline unsigned long millis() { return trace().millis((unsigned long)(sim::nowMicros / 1000)); }
+    inline int64_t esp_timer_get_time() { return trace().micros(sim::nowMicros); }
+    inline void delay(unsigned long ms) { sim::advanceMillis(ms); }
+
+    // GPIO
+    inline void pinMode(uint8_t pin, uint8_t mode) { sim::pins[pin].mode = mode; }
+
+    inline void digitalWrite(uint8_t pin, uint8_t level)
+    {
+        if (sim::pins[pin].level != level)
+        {
+            sim::edges.push_back({pin, level, sim::nowMicros});
+            if (sim::outputLog)
+                sim::logOutput("edge %u %u %lld", pin, level, (long long)sim::nowMicros);
+        }
+        sim::pins[pin].level = level;
+    }
+
+    inline int digitalRead(uint8_t pin)
+    {
+        sim::pinReads++;
+        return trace().pin(pin, sim::readLevel(pin));
+    }
+
+    inline void attachInterrupt(uint8_t pin, void (*isr)(void *arg), void *arg, int mode)
+    {
+        sim::pins[pin].isr = isr;
+        sim::pins[pin].isrArg = arg;
+        sim::pins[pin].isrMode = mode;
+    }
+
+    // the virtual pins settle at once
+    inline void delayMicros(uint32_t us) {}
+
+    inline uint64_t gpioReadAll()
+    {
+        sim::pinReads++;
+        uint64_t levels = 0;
+        for (int pin = 0; pin < sim::numPins; pin++)
+        {
+            if (sim::readLevel(pin) == HIGH)
+                levels |= 1ull << pin;
+        }
+        return trace().gpio(levels);
+    }
+
+    inline void gpioDriveLow(uint64_t mask)
+    {
+        for (int pin = 0; pin < sim::numPins; pin++)
+        {
+            if (mask & (1ull << pin))
+            {
+                sim::pins[pin].mode = OUTPUT;
+                sim::pins[pin].level = LOW;
+            }
+        }
+        sim::scannedPins |= mask;
+    }
+
+    inline void gpioRelease(uint64_t mask)
+    {
+        for (int pin = 0; pin < sim::numPins; pin++)
+        {
+            if (mask & (1ull << pin))
+                sim::pins[pin].mode = INPUT_PULLUP;
+        }
+    }
+
+    // PERIPHERALS
+    class Strip
+    {
+    public:
+        Strip(uint16_t numPixels, uint8_t pin) : _pixels(numPixels, 0), _symbols(ws2812::symbolsFor(numPixels)) {}
+
+        void begin() { sim::frame.assign(_pixels.size(), 0); }
+
+        // the virtual line is clocked out instantly
+        bool busy() const { return trace().flag(false); }
+
+        void show()
+        {
+            const size_t count = ws2812::encode(_pixels.data(), _pixels.size(), _symbols.data());
+            if (!ws2812::decode(_symbols.data(), count, sim::frame.data(), sim::frame.size()) || sim::frame != _pixels)
+                sim::frameTimingErrors++;
+            sim::framesShown++;
+            if (sim::outputLog)
+            {
+                std::string line = "frame";
+                char pixel[8];
+                for (uint32_t color : _pixels)
+                {
+                    snprintf(pixel, sizeof(pixel), " %06x", (unsigned)color);
+                    line += pixel;
+                }
+                sim::logOutput("%s", line.c_str());
+            }
+        }
+        void setPixelColor(uint16_t index, uint32_t color)
+        {
+            if (index < _pixels.size())
+                _pixels[index] = color;
+        }
+        uint32_t getPixelColor(uint16_t index) const { return index < _pixels.size() ? _pixels[index] : 0; }
+        uint16_t numPixels() const { return _pixels.size(); }
+
+        static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+    private:
+        std::vector<uint32_t> _pixels;
+        std::vector<ws2812::RmtSymbol> _symbols;
+    };
+
+    class Keypad
+    {
+    public:
+        Keypad(uint8_t address) {}
+
+        bool begin() { return true; }
+        uint8_t getKey()
+        {
+            sim::keypadScans++;
+            sim::i2cTransactions++;
+            sim::releasePin(sim::keypadIntPin);
+            return trace().key(sim::keyIndex);
+        }
+    };
+
+    class ShiftInChain
+    {
+    public:
+        ShiftInChain(uint8_t latchPin, uint8_t numRegisters) : _numRegisters(numRegisters < 4 ? numRegisters : 4) {}
+
+        void begin() {}
+        uint32_t read()
+        {
+            sim::spiTransactions++;
+            const uint32_t mask = _numRegisters == 4 ? ~0u : (1u << (8 * _numRegisters)) - 1;
+            return trace().value(sim::shiftInputs & mask);
+        }
+
+    private:
+        const uint8_t _numRegisters;
+    };
+
+    class SegmentDisplay
+    {
+    public:
+        SegmentDisplay(uint8_t address) {}
+
+        bool begin() { return true; }
+        void displayOn() { sim::i2cTransactions++; }
+        void setDigits(uint8_t digits) {}
+        bool displayTime(uint8_t left, uint8_t right, bool colon = true, bool leadingZero = true)
+        {
+            sim::i2cTransactions++;
+            sim::displayedMinute = left;
+            sim::displayedSecond = right;
+            return true;
+        }
+    };
+
+    class CountDown
+    {
+    public:
+        enum Resolution
+        {
+            MICROS,
+            MILLIS,
+            SECONDS,
+            MINUTES
+        };
+
+        CountDown(Resolution resolution) : _resolution(resolution), _ticks(0), _startTime(0), _running(false) {}
+
+        bool start(uint32_t ticks)
+        {
+            _ticks = ticks;
+            _startTime = now();
+            _running = true;
+            return true;
+        }
+        void stop()
+        {
+            _ticks = remaining();
+            _running = false;
+        }
+        bool isRunning() const { return trace().flag(_running && remainingTicks() > 0); }
+
+        uint32_t remaining() const { return trace().value(remainingTicks()); }
+
+    private:
+        uint32_t remainingTicks() const
+        {
+            if (!_running)
+                return _ticks;
+            uint64_t elapsed = now() - _startTime;
+            return elapsed >= _ticks ? 0 : _ticks - elapsed;
+        }
+
+        uint64_t now() const
+        {
+            switch (_resolution)
+            {
+            case MICROS:
+                return sim::nowMicros;
+            case MILLIS:
+                return sim::nowMicros / 1000;
+            case SECONDS:
+                return sim::nowMicros / 1000000;
+            default:
+                return sim::nowMicros / 60000000;
+            }
+        }
+
+        Resolution _resolution;
+        uint32_t _ticks;
+        uint64_t _startTime;
+        bool _running;
+    };
+
+    inline void i2cBegin(uint32_t clock) {}
+
+    inline uint8_t resetReason() { return trace().value(sim::resetReason); }
+
+    const size_t rtcMemorySize = sizeof(sim::rtcMemory);
+    inline uint8_t *rtcMemory() { return sim::rtcMemory; }
+
+    // the host driver starts recording or replaying with sim::record() or sim::replay() before setup()
+    inline void startInputTrace() {}
+
+    namespace sim
+    {
+        // records the game loop from here on, starting with the RTC memory
+        inline void record(inputtrace::Writer &writer)
+        {
+            trace().record(writer, taskId);
+            trace().blob(rtcMemory, sizeof(rtcMemory), sizeof(rtcMemory));
+        }
+
+        // replays `reader` instead of the virtual board, and moves the clock along with it. The tasks still run,
+        // but the game loop only gets what the trace says it got from them.
+        inline bool replay(inputtrace::Reader &reader)
+        {
+            trace().replay(reader, taskId, [](int64_t micros)
+                           {
+                               if (micros > nowMicros)
+                                   advanceMicros(micros - nowMicros);
+                           });
+            if (!reader.nextPass())
+                return false;
+            trace().blob(rtcMemory, sizeof(rtcMemory), sizeof(rtcMemory));
+            return trace().replaying();
+        }
+    }
+
+    // ONE-SHOT TIMERS
+    class OneShotTimer
+    {
+    public:
+        typedef void (*Callback)(void *arg);
+
+        OneShotTimer(Callback callback, void *arg) { _timer.callback = callback, _timer.arg = arg; }
+        ~OneShotTimer() { sim::timers.erase(std::remove(sim::timers.begin(), sim::timers.end(), &_timer), sim::timers.end()); }
+
+        void startAt(int64_t deadline)
+        {
+            if (std::find(sim::timers.begin(), sim::timers.end(), &_timer) == sim::timers.end())
+                sim::timers.push_back(&_timer);
+            _timer.deadline = deadline;
+            _timer.armed = true;
+        }
+
+        void stop() { _timer.armed = false; }
+
+    private:
+        sim::Timer _timer;
+    };
+
+    // timers fire on the thread of their board, between two passes
+    class Spinlock
+    {
+    public:
+        void lock() {}
+        void unlock() {}
+    };
+
+    // TASKS
+    inline void startTask(const char *name, int core, void (*setup)(void *arg), void (*step)(void *arg), void *arg)
+    {
+        sim::tasks.push_back({name, step, arg});
+        sim::currentTask = &sim::tasks.back();
+        if (setup)
+            setup(arg);
+        sim::currentTask = nullptr;
+    }
+
+    // IDLE
+    inline void idleBegin() {}
+
+    inline void idleWait(unsigned long ms)
+    {
+        if (sim::idleWoken)
+        {
+            sim::idleWoken = false;
+            return;
+        }
+        sim::idleUntilMicros = sim::nowMicros + (int64_t)ms * 1000;
+    }
+
+    inline void idleWake() { sim::idleWoken = true; }
+    inline void idleWakeFromIsr() { idleWake(); }
+
+    // STORAGE
+    inline size_t storageRead(const char *key, void *data, size_t size)
+    {
+        auto blob = sim::storage.find(key);
+        if (blob == sim::storage.end() || blob->second.size() > size)
+            return trace().blob(data, 0, size);
+        memcpy(data, blob->second.data(), blob->second.size());
+        return trace().blob(data, blob->second.size(), size);
+    }
+
+    inline bool storageWrite(const char *key, const void *data, size_t size)
+    {
+        sim::storage[key].assign((const uint8_t *)data, (const uint8_t *)data + size);
+        return true;
+    }
+
+    // NETWORK
+    class NetClient
+    {
+    public:
+        NetClient() : _connected(false), _connecting(false), _batching(false), _batched(0), _writes(0) {}
+
+        int connect(IPAddress ip, uint16_t port, int32_t timeoutMs)
+        {
+            _connected = sim::broker.reachable;
+            return _connected;
+        }
+
+        // see the ESP32 NetClient: the connect and the CONNACK each take one poll
+        bool connectStart(IPAddress ip, uint16_t port)
+        {
+            stop();
+            _connecting = true;
+            return true;
+        }
+        int connectPoll()
+        {
+            if (_connecting)
+                connect(IPAddress(), 0, 0);
+            _connecting = false;
+            return connected() ? 1 : -1;
+        }
+        bool startSession(const char *clientId, uint16_t keepAliveSeconds) { return connected(); }
+        bool sessionAnswered() const { return connected(); }
+        bool connected() const { return _connected && sim::broker.reachable; }
+        void stop()
+        {
+            _connected = false;
+            _connecting = false;
+            _batched = 0;
+        }
+
+        size_t write(const uint8_t *data, size_t size)
+        {
+            if (_batching)
+                _batched += size;
+            else
+                _writes++;
+            return size;
+        }
+
+        // see the ESP32 NetClient
+        void beginBatch() { _batching = true; }
+        void endBatch()
+        {
+            if (_batched > 0)
+                _writes++;
+            _batched = 0;
+            _batching = false;
+        }
+        unsigned long writes() const { return _writes; }
+
+    private:
+        bool _connected;
+        bool _connecting;
+        bool _batching;
+        size_t _batched;
+        unsigned long _writes;
+    };
+
+    class MqttClient
+    {
+    public:
+        typedef std::function<void(char *, uint8_t *, unsigned int)> Callback;
+
+        MqttClient(NetClient &client) : _client(client), _connected(false) {}
+
+        void setServer(IPAddress ip, uint16_t port) {}
+        void setSocketTimeout(uint16_t seconds) {}
+        void setKeepAlive(uint16_t seconds) {}
+        void setCallback(Callback callback) { _callback = callback; }
+
+        bool connect(const char *clientId)
+        {
+            _connected = _client.connected() || _client.connect(IPAddress(), 0, 0);
+            if (_connected)
+                sim::broker.subscriptions.clear(); // clean session
+            return _connected;
+        }
+        void disconnect()
+        {
+            _connected = false;
+            _client.stop();
+        }
+        bool connected() const { return _connected && _client.connected(); }
+        int state() const { return connected() ? 0 : -2; }
+
+        bool subscribe(const char *topic)
+        {
+            if (!connected())
+                return false;
+            sim::broker.subscriptions.push_back(topic);
+            return true;
+        }
+
+        bool publish(const char *topic, const char *payload)
+        {
+            if (!connected())
+                return false;
+            sim::broker.published.push_back({topic, payload});
+            _client.write((const uint8_t *)payload, strlen(payload));
+            return true;
+        }
+
+        bool loop()
+        {
+            if (!connected())
+                return false;
+            while (!sim::broker.inbound.empty())
+            {
+                sim::Message message = sim::broker.inbound.front();
+                sim::broker.inbound.pop_front();
+                auto &subscriptions = sim::broker.subscriptions;
+                if (_callback && std::find(subscriptions.begin(), subscriptions.end(), message.topic) != subscriptions.end())
+                    _callback(&message.topic[0], (uint8_t *)&message.payload[0], message.payload.size());
+            }
+            return true;
+        }
+
+    private:
+        NetClient &_client;
+        bool _connected;
+        Callback _callback;
+    };
+
+    inline bool wifiAutoConnect(const char *apName, unsigned long portalTimeoutSeconds)
+    {
+        sim::wifiPortalConnects++;
+        return true;
+    }
+
+    struct WifiCache
+    {
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint8_t reserved;
+        uint32_t ip, gateway, subnet, dns;
+    };
+
+    inline bool wifiConnectCached(const WifiCache &cache, unsigned long timeoutMs)
+    {
+        sim::wifiCachedConnects++;
+        return cache.channel != 0;
+    }
+
+    inline bool wifiCurrent(WifiCache &cache)
+    {
+        cache = {{0x02, 0, 0, 0, 0, 1}, 6, 0, 0x0A00A8C0, 0x0100A8C0, 0x00FFFFFF, 0x0100A8C0}; // 192.168.0.10 on channel 6
+        return true;
+    }
+
+    enum mdnsQueryStatus
+    {
+        MDNS_QUERY_PENDING,
+        MDNS_QUERY_FOUND,
+        MDNS_QUERY_NOT_FOUND
+    };
+
+    inline bool mdnsBegin(const char *hostname) { return true; }
+    inline void mdnsAddService(const char *service, const char *proto, uint16_t port) {}
+    inline bool mdnsQueryStart(const char *service, const char *proto, unsigned long timeoutMs)
+    {
+        sim::mdnsQueries++;
+        return true;
+    }
+    inline mdnsQueryStatus mdnsQueryPoll(IPAddress &ip)
+    {
+        if (!sim::broker.reachable)
+            return MDNS_QUERY_NOT_FOUND;
+        ip = IPAddress(127, 0, 0, 1);
+        return MDNS_QUERY_FOUND;
+    }
+}
+
+/* SERIAL */
+class SimSerial
+{
+public:
+    void begin(unsigned long baud) {}
+
+    void print(const char *text) { write(text); }
+    void print(const std::string &text) { write(text.c_str()); }
+    void print(int value) { write(std::to_string(value).c_str()); }
+    void print(const hal::IPAddress &ip) { write(ip.toString().c_str()); }
+
+    template <typename T>
+    void println(const T &value)
+    {
+        print(value);
+        write("\n");
+    }
+
+private:
+    void write(const char *text)
+    {
+        if (hal::sim::verbose)
+            fputs(text, stdout);
+    }
+};
+inline SimSerial Serial;
+
+#endif /* HAL_NATIVE_H */
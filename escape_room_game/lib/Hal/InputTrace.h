@@ -0,0 +1,626 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * @brief Record and replay of everything the game loop reads from the outside world.
+ *
+ * In a trace build every input the game loop sees goes through a Session: clock reads (`millis()` and
+ * `esp_timer_get_time()`), pin reads, keypad indices, the keypad interrupt flag, countdown reads, NVS reads, the reset
+ * reason and the events the network task hands over (admin commands from MQTT, link changes). Recording writes them
+ * to a compact binary trace in the order they were read. Replaying feeds them back in the same order to the
+ * unchanged game logic on the host, which then produces the same LED frames, relay edges and publishes.
+ *
+ * Only the task that started the recording is traced (the Arduino loop task on the ESP32): the network task, timer
+ * callbacks and interrupts read the hardware at times no replay could reproduce, and reach the game loop only through
+ * inputs that are traced (the event queue, the interrupt flag).
+ *
+ * Format: "ESCT" and a version byte, then passes, one per `loop()` pass (the first one is `setup()`). A pass is a
+ * PASS record holding its encoded inputs, optionally preceded by PART records when it did not fit in the buffer.
+ * A REPEAT record stands for that many copies of the previous pass, so an idle game loop costs a few bytes per
+ * thousand passes. Inside a pass, each input is a header byte (kind in the high nibble, a small value in the low
+ * one) followed by LEB128 varints where needed. Clocks, the GPIO register and countdown values are stored as the
+ * difference to the previous read of the same kind, which is usually zero or one.
+ */
+namespace inputtrace
+{
+    const uint8_t version = 1;
+    const char magic[4] = {'E', 'S', 'C', 'T'};
+
+    enum Kind : uint8_t
+    {
+        MILLIS,  // small: delta if < 15, else 15 and a varint delta
+        MICROS,  // small: zigzag delta if < 15, else 15 and a varint
+        PIN,     // small: level, then the pin number
+        GPIO,    // varint: XOR with the previous register read
+        KEY,     // small: index if < 15, else 15 and a byte
+        FLAG,    // small: value
+        VALUE,   // small: zigzag delta if < 15, else 15 and a varint
+        EVENT,   // small: 0 for none, 1 for a varint length and the bytes
+        BLOB,    // varint length and the bytes
+        PART,    // varint length and encoded inputs: the start of a pass
+        PASS,    // varint length and encoded inputs: the (rest of the) pass
+        REPEAT   // varint count: copies of the previous pass
+    };
+
+    inline uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    inline int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+    /**
+     * @class Writer
+     * @brief Encodes inputs into passes and hands the bytes to a sink, e.g. a UART or a host buffer.
+     */
+    class Writer
+    {
+    public:
+        typedef void (*Sink)(const uint8_t *data, size_t size);
+        static const size_t passCapacity = 512;
+
+        Writer(Sink sink) : _sink(sink) {}
+
+        void begin()
+        {
+            _sink((const uint8_t *)magic, sizeof(magic));
+            _sink(&version, 1);
+        }
+
+        void millis(uint32_t value)
+        {
+            small(MILLIS, value - _lastMillis);
+            _lastMillis = value;
+        }
+
+        void micros(int64_t value)
+        {
+            small(MICROS, zigzag(value - _lastMicros));
+            _lastMicros = value;
+        }
+
+        void pin(uint8_t pin, int level)
+        {
+            const uint8_t record[2] = {(uint8_t)(PIN << 4 | (level & 1)), pin};
+            put(record, sizeof(record));
+        }
+
+        void gpio(uint64_t levels)
+        {
+            header(GPIO, 0);
+            varint(levels ^ _lastGpio);
+            _lastGpio = levels;
+        }
+
+        void key(uint8_t index)
+        {
+            header(KEY, index < 15 ? index : 15);
+            if (index >= 15)
+                put(&index, 1);
+        }
+
+        void flag(bool value) { header(FLAG, value); }
+
+        void value(uint32_t value)
+        {
+            small(VALUE, zigzag((int64_t)value - _lastValue));
+            _lastValue = value;
+        }
+
+        void event(const void *data, size_t size)
+        {
+            header(EVENT, data != nullptr);
+            if (data)
+                bytes(data, size);
+        }
+
+        void blob(const void *data, size_t size)
+        {
+            header(BLOB, 0);
+            bytes(data, size);
+        }
+
+        // closes the current pass
+        void pass()
+        {
+            if (!_split && _length == _previousLength && memcmp(_pass, _previous, _length) == 0)
+            {
+                _repeats++;
+                _length = 0;
+                return;
+            }
+            flushRepeats();
+            emit(PASS, _pass, _length);
+            memcpy(_previous, _pass, _length);
+            _previousLength = _split ? SIZE_MAX : _length;
+            _split = false;
+            _length = 0;
+        }
+
+        // closes the current pass and writes out what is still held back
+        void finish()
+        {
+            pass();
+            flushRepeats();
+        }
+
+    private:
+        void header(Kind kind, uint8_t small)
+        {
+            const uint8_t byte = kind << 4 | small;
+            put(&byte, 1);
+        }
+
+        void small(Kind kind, uint64_t value)
+        {
+            header(kind, value < 15 ? value : 15);
+            if (value >= 15)
+                varint(value);
+        }
+
+        void varint(uint64_t value)
+        {
+            uint8_t buffer[10];
+            size_t n = 0;
+            do
+            {
+                buffer[n] = value & 0x7F;
+                value >>= 7;
+                if (value)
+                    buffer[n] |= 0x80;
+                n++;
+            } while (value);
+            put(buffer, n);
+        }
+
+        void bytes(const void *data, size_t size)
+        {
+            varint(size);
+            put((const uint8_t *)data, size);
+        }
+
+        void put(const uint8_t *data, size_t size)
+        {
+            while (size > 0)
+            {
+                if (_length == passCapacity)
+                {
+                    // the pass goes out in parts and cannot be repeated
+                    flushRepeats();
+                    emit(PART, _pass, _length);
+                    _length = 0;
+                    _split = true;
+                }
+                const size_t n = size < passCapacity - _length ? size : passCapacity - _length;
+                memcpy(_pass + _length, data, n);
+                _length += n;
+                data += n;
+                size -= n;
+            }
+        }
+
+        // a record outside of the passes: the kind, a varint length (or count) and the data
+        void emit(Kind kind, const uint8_t *data, size_t length)
+        {
+            uint8_t head[11] = {(uint8_t)(kind << 4)};
+            size_t n = 1;
+            for (uint64_t rest = length;; rest >>= 7)
+            {
+                head[n++] = (rest & 0x7F) | (rest > 0x7F ? 0x80 : 0);
+                if (rest <= 0x7F)
+                    break;
+            }
+            _sink(head, n);
+            if (data)
+                _sink(data, length);
+        }
+
+        void flushRepeats()
+        {
+            if (_repeats == 0)
+                return;
+            emit(REPEAT, nullptr, _repeats);
+            _repeats = 0;
+        }
+
+        Sink _sink;
+        uint8_t _pass[passCapacity];
+        size_t _length = 0;
+        bool _split = false;
+        uint8_t _previous[passCapacity];
+        size_t _previousLength = SIZE_MAX;
+        uint32_t _repeats = 0;
+
+        uint32_t _lastMillis = 0;
+        int64_t _lastMicros = 0;
+        uint64_t _lastGpio = 0;
+        uint32_t _lastValue = 0;
+    };
+
+    /**
+     * @class Reader
+     * @brief Decodes a trace pass by pass. A read of the wrong kind, or past the end of the pass, marks the replay as
+     * diverged: the code no longer reads what it read when the trace was recorded.
+     */
+    class Reader
+    {
+    public:
+        Reader(const uint8_t *data, size_t size)
+            : _data(data), _size(size), _offset(sizeof(magic) + 1), _valid(size > sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0 && data[sizeof(magic)] == version)
+        {
+        }
+
+        bool valid() const { return _valid; }
+        bool diverged() const { return _diverged; }
+        unsigned long passes() const { return _passes; }
+
+        // moves on to the next pass, false at the end of the trace
+        bool nextPass()
+        {
+            _position = 0;
+            if (_repeats > 0)
+            {
+                _repeats--;
+                _passes++;
+                return true;
+            }
+            _pass.clear();
+            while (_valid && _offset < _size)
+            {
+                const Kind kind = (Kind)(_data[_offset++] >> 4);
+                const uint64_t length = traceVarint();
+                if (kind == REPEAT && length > 0)
+                {
+                    _pass = _previous;
+                    _repeats = length - 1;
+                    _passes++;
+                    return true;
+                }
+                if ((kind != PART && kind != PASS) || length > _size - _offset)
+                    break;
+                _pass.insert(_pass.end(), _data + _offset, _data + _offset + length);
+                _offset += length;
+                if (kind == PASS)
+                {
+                    _previous = _pass;
+                    _passes++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        uint32_t millis()
+        {
+            _lastMillis += small(MILLIS);
+            return _lastMillis;
+        }
+
+        int64_t micros()
+        {
+            _lastMicros += unzigzag(small(MICROS));
+            return _lastMicros;
+        }
+
+        int pin(uint8_t pin)
+        {
+            const uint8_t level = header(PIN);
+            return byte() == pin ? level : diverge();
+        }
+
+        uint64_t gpio()
+        {
+            header(GPIO);
+            _lastGpio ^= varint();
+            return _lastGpio;
+        }
+
+        uint8_t key()
+        {
+            const uint8_t index = header(KEY);
+            return index < 15 ? index : byte();
+        }
+
+        bool flag() { return header(FLAG); }
+
+        uint32_t value()
+        {
+            _lastValue += unzigzag(small(VALUE));
+            return _lastValue;
+        }
+
+        // copies the recorded event into `data`, false if none was recorded
+        bool event(void *data, size_t size)
+        {
+            if (!header(EVENT))
+                return false;
+            return bytes(data, size, size) == size;
+        }
+
+        // copies up to `capacity` recorded bytes into `data` and returns how many were recorded
+        size_t blob(void *data, size_t capacity)
+        {
+            header(BLOB);
+            return bytes(data, capacity, SIZE_MAX);
+        }
+
+    private:
+        uint8_t header(Kind kind)
+        {
+            const uint8_t head = byte();
+            if (head >> 4 != kind)
+                diverge();
+            return head & 0x0F;
+        }
+
+        uint64_t small(Kind kind)
+        {
+            const uint8_t value = header(kind);
+            return value < 15 ? value : varint();
+        }
+
+        uint8_t byte()
+        {
+            if (_position < _pass.size())
+                return _pass[_position++];
+            diverge();
+            return 0;
+        }
+
+        uint64_t varint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                const uint8_t b = byte();
+                value |= (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    break;
+            }
+            return value;
+        }
+
+        size_t bytes(void *data, size_t capacity, size_t expected)
+        {
+            const size_t size = varint();
+            if (size > _pass.size() - _position || (expected != SIZE_MAX && size != expected))
+                return diverge();
+            memcpy(data, _pass.data() + _position, size < capacity ? size : capacity);
+            _position += size;
+            return size;
+        }
+
+        uint64_t traceVarint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64 && _offset < _size; shift += 7)
+            {
+                const uint8_t b = _data[_offset++];
+                value |= (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    break;
+            }
+            return value;
+        }
+
+        int diverge()
+        {
+            _diverged = true;
+            return 0;
+        }
+
+        const uint8_t *_data;
+        size_t _size;
+        size_t _offset;
+        bool _valid;
+        bool _diverged = false;
+        std::vector<uint8_t> _pass;
+        std::vector<uint8_t> _previous;
+        size_t _position = 0;
+        uint64_t _repeats = 0;
+        unsigned long _passes = 0;
+
+        uint32_t _lastMillis = 0;
+        int64_t _lastMicros = 0;
+        uint64_t _lastGpio = 0;
+        uint32_t _lastValue = 0;
+    };
+
+    /**
+     * @class Session
+     * @brief Where the HAL sends every input: passed through, recorded, or replaced by the recorded one.
+     *
+     * Each call takes the live value and returns the value the game loop gets. While replaying, the live value is
+     * ignored, and every clock read is reported to `onClock` so the host can move its virtual clock (and the timers
+     * on it) along. After a divergence the live values are used again.
+     */
+    class Session
+    {
+    public:
+        typedef const void *(*TaskId)();
+        typedef void (*ClockHandler)(int64_t micros);
+        typedef void (*PublishHandler)(const char *topic, const char *payload);
+
+        void record(Writer &writer, TaskId currentTask)
+        {
+            _currentTask = currentTask;
+            _task = currentTask();
+            _writer = &writer;
+            _writer->begin();
+        }
+
+        void replay(Reader &reader, TaskId currentTask, ClockHandler onClock)
+        {
+            _currentTask = currentTask;
+            _task = currentTask();
+            _reader = &reader;
+            _onClock = onClock;
+        }
+
+        void stop()
+        {
+            _writer = nullptr;
+            _reader = nullptr;
+        }
+
+        bool recording() const { return _writer != nullptr; }
+        bool replaying() const { return _reader != nullptr && !_reader->diverged(); }
+
+        // whether the caller's inputs are the ones being recorded or replayed
+        bool traced() const { return _currentTask != nullptr && _currentTask() == _task; }
+
+        unsigned long millis(unsigned long live)
+        {
+            if (replaying() && traced())
+            {
+                const uint32_t value = _reader->millis();
+                clock((int64_t)value * 1000);
+                return replaying() ? value : live;
+            }
+            if (_writer && traced())
+                _writer->millis(live);
+            return live;
+        }
+
+        int64_t micros(int64_t live)
+        {
+            if (replaying() && traced())
+            {
+                const int64_t value = _reader->micros();
+                clock(value);
+                return replaying() ? value : live;
+            }
+            if (_writer && traced())
+                _writer->micros(live);
+            return live;
+        }
+
+        int pin(uint8_t pin, int live)
+        {
+            if (replaying() && traced())
+                return checked(_reader->pin(pin), live);
+            if (_writer && traced())
+                _writer->pin(pin, live);
+            return live;
+        }
+
+        uint64_t gpio(uint64_t live)
+        {
+            if (replaying() && traced())
+                return checked(_reader->gpio(), live);
+            if (_writer && traced())
+                _writer->gpio(live);
+            return live;
+        }
+
+        uint8_t key(uint8_t live)
+        {
+            if (replaying() && traced())
+                return checked(_reader->key(), live);
+            if (_writer && traced())
+                _writer->key(live);
+            return live;
+        }
+
+        bool flag(bool live)
+        {
+            if (replaying() && traced())
+                return checked(_reader->flag(), live);
+            if (_writer && traced())
+                _writer->flag(live);
+            return live;
+        }
+
+        uint32_t value(uint32_t live)
+        {
+            if (replaying() && traced())
+                return checked(_reader->value(), live);
+            if (_writer && traced())
+                _writer->value(live);
+            return live;
+        }
+
+        // an item the game loop took (`available`) or did not get from a queue
+        template <typename T>
+        bool event(bool available, T &item)
+        {
+            if (replaying() && traced())
+                return checked(_reader->event(&item, sizeof(item)), available);
+            if (_writer && traced())
+                _writer->event(available ? &item : nullptr, sizeof(item));
+            return available;
+        }
+
+        // `size` bytes read into `data`, which holds `capacity`
+        size_t blob(void *data, size_t size, size_t capacity)
+        {
+            if (replaying() && traced())
+                return checked(_reader->blob(data, capacity), size);
+            if (_writer && traced())
+                _writer->blob(data, size);
+            return size;
+        }
+
+        // start of a loop() pass
+        void pass()
+        {
+            if (_writer && traced())
+                _writer->pass();
+        }
+
+        // what the game loop publishes, for a host comparing the outputs of a recording and its replay
+        PublishHandler onPublish = nullptr;
+
+        void published(const char *topic, const char *payload)
+        {
+            if (onPublish)
+                onPublish(topic, payload);
+        }
+
+    private:
+
+        template <typename T>
+        T checked(T replayed, T live) const { return replaying() ? replayed : live; }
+
+        void clock(int64_t micros)
+        {
+            if (_onClock && replaying())
+                _onClock(micros);
+        }
+
+        Writer *_writer = nullptr;
+        TaskId _currentTask = nullptr;
+        const void *_task = nullptr;
+        Reader *_reader = nullptr;
+        ClockHandler _onClock = nullptr;
+    };
+
+#ifdef ARDUINO
+    inline Session session;
+#else
+    // one per thread on the host, like the virtual board it traces
+    inline thread_local Session session;
+#endif
+
+    /**
+     * @brief The same calls as Session, for builds without input tracing: every input passes straight through.
+     */
+    struct Passthrough
+    {
+        unsigned long millis(unsigned long live) { return live; }
+        int64_t micros(int64_t live) { return live; }
+        int pin(uint8_t pin, int live) { return live; }
+        uint64_t gpio(uint64_t live) { return live; }
+        uint8_t key(uint8_t live) { return live; }
+        bool flag(bool live) { return live; }
+        uint32_t value(uint32_t live) { return live; }
+        template <typename T>
+        bool event(bool available, T &item) { return available; }
+        size_t blob(void *data, size_t size, size_t capacity) { return size; }
+        void pass() {}
+        void published(const char *topic, const char *payload) {}
+    };
+}
+
+#endif /* INPUT_TRACE_H */
@@ -0,0 +1,104 @@
+#ifndef WS2812_H
+#define WS2812_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief WS2812B frame encoder for the ESP32 RMT peripheral.
+ *
+ * Each data bit becomes one RMT symbol (a high pulse and a low pulse, in RMT ticks); a pixel is 24 symbols,
+ * green, red, blue, most significant bit first. A frame ends with a symbol that holds the line low for the
+ * reset time and has a zero duration, which is where the RMT stops transmitting.
+ *
+ * Pure code without hardware access, so the same encoder runs in the native build, where `decode()` reads
+ * the symbols back and checks every pulse against the datasheet timing.
+ */
+namespace ws2812
+{
+    // same bit layout as rmt_item32_t
+    struct RmtSymbol
+    {
+        uint32_t duration0 : 15;
+        uint32_t level0 : 1;
+        uint32_t duration1 : 15;
+        uint32_t level1 : 1;
+    };
+    static_assert(sizeof(RmtSymbol) == 4, "an RMT symbol is one 32 bit word");
+
+    // RMT clocked from the 80 MHz APB clock divided by clockDivider
+    const uint8_t clockDivider = 2;
+    const uint32_t tickNs = 1000 / (80 / clockDivider);
+
+    // WS2812B datasheet: every high and low time within +-150 ns, reset low for more than 50 us
+    // (280 us for the newer V5 parts, so 300 us is used)
+    const uint32_t toleranceNs = 150;
+    const uint32_t t0hNs = 400, t0lNs = 850;
+    const uint32_t t1hNs = 800, t1lNs = 450;
+    const uint32_t resetNs = 300000;
+
+    constexpr uint16_t ticks(uint32_t ns) { return (ns + tickNs / 2) / tickNs; }
+    constexpr bool withinSpec(uint16_t ticks, uint32_t ns) { return ticks * tickNs + toleranceNs >= ns && ticks * tickNs <= ns + toleranceNs; }
+
+    const uint16_t t0h = ticks(t0hNs), t0l = ticks(t0lNs);
+    const uint16_t t1h = ticks(t1hNs), t1l = ticks(t1lNs);
+    const uint16_t reset = ticks(resetNs);
+
+    static_assert(withinSpec(t0h, t0hNs) && withinSpec(t0l, t0lNs), "0 bit timing out of the WS2812B spec");
+    static_assert(withinSpec(t1h, t1hNs) && withinSpec(t1l, t1lNs), "1 bit timing out of the WS2812B spec");
+    static_assert(reset < (1 << 15), "the reset time does not fit in one RMT duration");
+
+    constexpr size_t symbolsFor(size_t numPixels) { return numPixels * 24 + 1; }
+
+    /**
+     * Encodes `numPixels` 0x00RRGGBB colors into `symbolsFor(numPixels)` symbols.
+     */
+    inline size_t encode(const uint32_t *pixels, size_t numPixels, RmtSymbol *symbols)
+    {
+        RmtSymbol *symbol = symbols;
+        for (size_t p = 0; p < numPixels; p++)
+        {
+            const uint32_t color = pixels[p];
+            const uint32_t grb = ((color >> 8) & 0xFF) << 16 | ((color >> 16) & 0xFF) << 8 | (color & 0xFF);
+            for (int bit = 23; bit >= 0; bit--)
+            {
+                const bool one = grb & (1u << bit);
+                *symbol++ = {one ? t1h : t0h, 1, one ? t1l : t0l, 0};
+            }
+        }
+        *symbol++ = {reset, 0, 0, 0};
+        return symbol - symbols;
+    }
+
+    /**
+     * Reads a frame back the way a WS2812B would, checking the level and the timing of every pulse.
+     *
+     * @return False if a pulse is out of spec, the frame is not `numPixels` long or it does not end with a reset.
+     */
+    inline bool decode(const RmtSymbol *symbols, size_t count, uint32_t *pixels, size_t numPixels)
+    {
+        if (count != symbolsFor(numPixels))
+            return false;
+        for (size_t p = 0; p < numPixels; p++)
+        {
+            uint32_t grb = 0;
+            for (int bit = 0; bit < 24; bit++)
+            {
+                const RmtSymbol &symbol = symbols[p * 24 + bit];
+                if (symbol.level0 != 1 || symbol.level1 != 0)
+                    return false;
+                if (withinSpec(symbol.duration0, t1hNs) && withinSpec(symbol.duration1, t1lNs))
+                    grb = grb << 1 | 1;
+                else if (withinSpec(symbol.duration0, t0hNs) && withinSpec(symbol.duration1, t0lNs))
+                    grb = grb << 1;
+                else
+                    return false;
+            }
+            pixels[p] = ((grb >> 8) & 0xFF) << 16 | ((grb >> 16) & 0xFF) << 8 | (grb & 0xFF);
+        }
+        const RmtSymbol &last = symbols[count - 1];
+        return last.level0 == 0 && last.duration0 * tickNs >= resetNs && last.duration1 == 0;
+    }
+}
+
+#endif /* WS2812_H */
@@ -0,0 +1,133 @@
+#ifndef HOSE_MATRIX_H
+#define HOSE_MATRIX_H
+
+#include <Hal.h>
+
+/**
+ * @class HoseMatrix
+ * @brief Scans which fuel tank sockets are connected by the hose.
+ *
+ * Each tank socket is a pin with a pull-up. The hose has a diode in it, so when the pin of tank `to` is driven
+ * LOW, the pin of tank `from` reads LOW as well, meaning fuel can flow from `from` to `to`.
+ *
+ * A scan drives one pin at a time with direct register writes and reads every pin in the same register read,
+ * so it costs NumTanks drive/read/release steps (see hal::gpioProbeLow, which also lets the lines settle) instead of
+ * a `pinMode` pair and a `digitalRead` per ordered pair.
+ * Scans run every `scanInterval` milliseconds, and a new matrix only becomes the stable one after it was seen
+ * `debounceScans` times in a row, so a wiggling plug cannot flip the connection mid-transfer.
+ *
+ * @tparam NumTanks number of tank sockets, up to 8
+ */
+template <int NumTanks>
+class HoseMatrix
+{
+    static_assert(NumTanks >= 2 && NumTanks <= 8, "the matrix is kept in a 64 bit mask");
+
+public:
+    HoseMatrix(const byte *pins) : _pinsMask(0), _stable(0), _candidate(0), _candidateScans(0), _lastScanTime(0), _scans(0)
+    {
+        for (int i = 0; i < NumTanks; i++)
+        {
+            _pins[i] = pins[i];
+            _pinsMask |= 1ull << pins[i];
+        }
+    }
+
+    void setup()
+    {
+        for (int i = 0; i < NumTanks; i++)
+            hal::pinMode(_pins[i], INPUT_PULLUP);
+    }
+
+    /**
+     * Scans the sockets if the scan interval elapsed.
+     *
+     * @return True if the debounced connection state changed with this scan.
+     */
+    bool scan()
+    {
+        const unsigned long currentTime = hal::millis();
+        if (currentTime - _lastScanTime < scanInterval)
+            return false;
+        _lastScanTime = currentTime;
+        _scans++;
+
+        const uint64_t matrix = sample();
+        if (matrix != _candidate)
+        {
+            _candidate = matrix;
+            _candidateScans = 1;
+        }
+        else if (_candidateScans < debounceScans)
+        {
+            _candidateScans++;
+        }
+
+        if (_candidateScans >= debounceScans && _candidate != _stable)
+        {
+            _stable = _candidate;
+            return true;
+        }
+        return false;
+    }
+
+    bool isConnected(int from, int to) const { return _stable & bit(to, from); }
+
+    /**
+     * Gets the debounced connection. If several hoses are plugged in, the first pair in scan order wins.
+     *
+     * @return True if a hose connects two tanks.
+     */
+    bool connection(int &from, int &to) const
+    {
+        for (int i = 0; i < NumTanks; i++)
+        {
+            for (int j = 0; j < NumTanks; j++)
+            {
+                if (i != j && isConnected(j, i))
+                {
+                    from = j;
+                    to = i;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    unsigned long scans() const { return _scans; }
+
+    static const unsigned long scanInterval = 5;
+    static const int debounceScans = 4;
+
+private:
+    // bit of "driving `driver` LOW pulls `sensed` LOW"
+    static uint64_t bit(int driver, int sensed) { return 1ull << (driver * NumTanks + sensed); }
+
+    uint64_t sample()
+    {
+        uint64_t matrix = 0;
+        for (int i = 0; i < NumTanks; i++)
+        {
+            const uint64_t pulledLow = hal::gpioProbeLow(_pins[i], _pinsMask);
+            for (int j = 0; j < NumTanks; j++)
+            {
+                if (pulledLow & (1ull << _pins[j]))
+                    matrix |= bit(i, j);
+            }
+        }
+        return matrix;
+    }
+
+    byte _pins[NumTanks];
+    uint64_t _pinsMask;
+
+    uint64_t _stable;
+    uint64_t _candidate;
+    int _candidateScans;
+
+    unsigned long _lastScanTime;
+    unsigned long _scans;
+};
+
+#endif /* HOSE_MATRIX_H */
@@ -0,0 +1,92 @@
+#ifndef IDLE_MODE_H
+#define IDLE_MODE_H
+
+#include <Hal.h>
+#include <stdio.h>
+
+/**
+ * @class IdleMode
+ * @brief Lets the game loop sleep through the passes it has nothing to do in, and measures how much it slept.
+ *
+ * The caller works out how long nothing is due (see Room::idle) and sleep() waits that long with hal::idleWait(),
+ * at most maxSleepMs, so housekeeping that is not worth a deadline of its own runs late by no more than that. The
+ * keypad interrupt and the network task end a wait early with hal::idleWake().
+ *
+ * A sleep counts from the wait to the start of the next pass (awake()), which is the same for a firmware task that
+ * blocks and for a host driver that skips passes. format() reports the duty cycle, i.e. the part of the time the
+ * loop was awake, and the module current that makes with the datasheet figures below. The LEDs are not included.
+ */
+class IdleMode
+{
+public:
+    static const unsigned long maxSleepMs = 50;
+    static const uint32_t awakeMilliamps = 68; // ESP32 datasheet, modem sleep at 240 MHz with the CPU running
+    static const uint32_t idleMilliamps = 30;  // same, with the CPU waiting for an interrupt
+
+    IdleMode() : _asleep(false), _sleepStart(0), _sleepUntil(0), _windowStart(0), _sleptMicros(0), _sleeps(0), _woken(0), _maxKeyMs(0) {}
+
+    // at the start of every pass
+    void awake()
+    {
+        if (!_asleep)
+            return;
+        _asleep = false;
+        const int64_t now = hal::esp_timer_get_time();
+        _sleptMicros += now - _sleepStart;
+        if (now < _sleepUntil - 1000) // a tick early
+            _woken++;
+    }
+
+    // at the end of a pass: waits `ms`, or less if something wakes the loop
+    void sleep(unsigned long ms)
+    {
+        if (ms == 0)
+            return;
+        if (ms > maxSleepMs)
+            ms = maxSleepMs;
+        _sleepStart = hal::esp_timer_get_time();
+        _sleepUntil = _sleepStart + (int64_t)ms * 1000;
+        _asleep = true;
+        _sleeps++;
+        hal::idleWait(ms);
+    }
+
+    // how long the loop took to act on a key once it saw it go down
+    void keyHandled(uint32_t ms)
+    {
+        if (ms > _maxKeyMs)
+            _maxKeyMs = ms;
+    }
+
+    /**
+     * @brief The metrics line since the last one, e.g. "IDLE duty=4.1% sleeps=1198 woken=3 key_ms=20 est_ma=31.6".
+     * Starts the next window.
+     */
+    void format(char *text, size_t size)
+    {
+        const int64_t now = hal::esp_timer_get_time();
+        const int64_t window = now - _windowStart;
+        const uint32_t dutyPermille = window > 0 ? (uint32_t)((window - _sleptMicros) * 1000 / window) : 1000;
+        const uint32_t tenthsMilliamps = (awakeMilliamps * dutyPermille + idleMilliamps * (1000 - dutyPermille)) / 100;
+        snprintf(text, size, "IDLE duty=%lu.%lu%% sleeps=%lu woken=%lu key_ms=%lu est_ma=%lu.%lu", (unsigned long)dutyPermille / 10,
+                 (unsigned long)dutyPermille % 10, _sleeps, _woken, (unsigned long)_maxKeyMs, (unsigned long)tenthsMilliamps / 10,
+                 (unsigned long)tenthsMilliamps % 10);
+        _windowStart = now;
+        _sleptMicros = 0;
+        _sleeps = 0;
+        _woken = 0;
+        _maxKeyMs = 0;
+    }
+
+private:
+    bool _asleep;
+    int64_t _sleepStart;
+    int64_t _sleepUntil;
+    int64_t _windowStart;
+    int64_t _sleptMicros;
+    unsigned long _sleeps;
+    unsigned long _woken;
+    uint32_t _maxKeyMs;
+};
+
+#endif /* IDLE_MODE_H */
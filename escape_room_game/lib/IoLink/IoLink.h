@@ -0,0 +1,115 @@
+#ifndef IO_LINK_H
+#define IO_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief The protocol between a room's I/O node and the controller daemon, one TCP connection per room.
+ *
+ * An I/O node (src/node/) is an ESP32 that only does the I/O of a room: it streams the levels of its input pins, the
+ * keypad and the hose sockets to the daemon, and drives the relays, the NeoPixel strip and the timer display as
+ * told. The game logic of many rooms runs in the daemon (src/native/daemon.cpp). The node knows nothing about the
+ * puzzles: which pins are inputs and which are scanned as a diode matrix comes from the daemon in a CONFIG frame.
+ *
+ * Every frame is a type byte, a length byte and up to 255 payload bytes. Pin sets are 40 bit masks, one bit per
+ * GPIO, in 5 bytes LSB first, and other numbers are LSB first too. Inputs are sent on every change and at least every
+ * `heartbeatMs`.
+ */
+namespace iolink
+{
+    const uint8_t version = 2;
+    const uint16_t port = 7300;
+    const size_t maxPayload = 255;
+    const size_t maxFrame = 2 + maxPayload;
+    const unsigned long heartbeatMs = 500;
+    const int numPins = 40;
+
+    enum frameType : uint8_t
+    {
+        // node -> daemon
+        FRAME_HELLO = 1,  // version, room number
+        FRAME_INPUTS = 2, // levels of the input pins (pin set), keypad key index (16 = none), wheel reeds (uint32)
+        FRAME_LINKS = 3,  // (driven pin, pulled pin) pairs: driving the first LOW pulls the second LOW
+        // daemon -> node
+        FRAME_CONFIG = 4,  // scanned pins (pin set), then a (pin, mode) pair per input or output pin
+        FRAME_PINS = 5,    // (pin, level) pairs of the outputs that changed
+        FRAME_LEDS = 6,    // index of the first pixel, then R, G and B per pixel
+        FRAME_DISPLAY = 7, // minute, second
+    };
+
+    const size_t pinSetSize = 5;
+
+    inline void putPinSet(uint8_t *out, uint64_t pins)
+    {
+        for (size_t i = 0; i < pinSetSize; i++)
+            out[i] = pins >> (8 * i);
+    }
+
+    inline uint64_t getPinSet(const uint8_t *in)
+    {
+        uint64_t pins = 0;
+        for (size_t i = 0; i < pinSetSize; i++)
+            pins |= (uint64_t)in[i] << (8 * i);
+        return pins;
+    }
+
+    inline void putUint32(uint8_t *out, uint32_t value)
+    {
+        for (size_t i = 0; i < 4; i++)
+            out[i] = value >> (8 * i);
+    }
+
+    inline uint32_t getUint32(const uint8_t *in) { return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24; }
+
+    // the payload of an INPUTS frame
+    const size_t inputsSize = pinSetSize + 1 + 4;
+
+    /**
+     * Writes a frame into `out`, which must have room for 2 + `length` bytes.
+     *
+     * @return The size of the frame.
+     */
+    inline size_t encode(uint8_t *out, uint8_t type, const uint8_t *payload, size_t length)
+    {
+        out[0] = type;
+        out[1] = length;
+        memcpy(out + 2, payload, length);
+        return 2 + length;
+    }
+
+    /**
+     * @brief Reassembles frames from a byte stream, however it was split up on the way.
+     */
+    class Decoder
+    {
+    public:
+        Decoder() : _received(0) {}
+
+        /**
+         * Takes the next byte of the stream.
+         *
+         * @return True if it completed a frame, which is then in type(), length() and payload() until the next push().
+         */
+        bool push(uint8_t byte)
+        {
+            if (complete())
+                _received = 0;
+            _frame[_received++] = byte;
+            return complete();
+        }
+
+        uint8_t type() const { return _frame[0]; }
+        uint8_t length() const { return _frame[1]; }
+        const uint8_t *payload() const { return _frame + 2; }
+
+    private:
+        bool complete() const { return _received >= 2 && _received == 2u + _frame[1]; }
+
+        uint8_t _frame[maxFrame];
+        size_t _received;
+    };
+}
+
+#endif /* IO_LINK_H */
@@ -0,0 +1,256 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Hal.h>
+#include <atomic>
+
+enum journalEvent
+{
+    EVENT_BOOT,             // a = reset reason
+    EVENT_KEY,              // a = key character
+    EVENT_STAGE,            // a = previous stage, b = new stage
+    EVENT_TRANSFER_START,   // a = from << 4 | to, b = 1 if poured by a hint
+    EVENT_TRANSFER_END,     // a = from << 4 | to, b = fuel levels, 4 bits per tank
+    EVENT_FUEL_RESET,       // a = 1 if global
+    EVENT_COMPARTMENT_OPEN, // a = relay pin
+    EVENT_ADMIN_COMMAND,    // a = adminCommand
+    EVENT_MQTT_STATE,       // a = linkState
+    EVENT_RESUME,           // a = resumed stage, b = remaining seconds
+    EVENT_WHEELS,           // a = aligned wheels, b = closed reeds of the first 16 wheels
+    NUM_EVENTS
+};
+
+struct JournalRecord
+{
+    uint32_t time; // millis() since boot
+    uint8_t event;
+    uint8_t a;
+    uint16_t b;
+};
+static_assert(sizeof(JournalRecord) == 8, "journal records are packed into 8 bytes");
+
+/**
+ * @class Journal
+ * @brief Binary event journal: RAM ring buffer, batched flash persistence and chunked dumps.
+ *
+ * The game loop on core 1 only ever calls `log()` and `requestDump()`: a record goes into the ring with one store
+ * and a release of the head index, so the loop never waits on anything, and in particular not on flash. Everything
+ * that touches flash runs in the network task on core 0, the ring's consumer: `handle()` moves records from the
+ * ring into the current flash block and writes it when a batch is ready or `flushInterval` passed. Blocks are NVS
+ * blobs used round-robin, each stamped with an increasing sequence number, so the last `numBlocks` blocks survive a
+ * reboot. `begin()` runs in setup(), before the network task starts.
+ *
+ * A requested dump starts with the next `handle()`, walks the blocks from oldest to newest and hands out one text
+ * chunk at a time:
+ * `<block sequence> <hex records>` lines followed by `end <record count>`, small enough for one MQTT publish.
+ * `describe()` turns a record back into text for the host decoder.
+ */
+class Journal
+{
+public:
+    static const int ramRecords = 256; // power of two
+    static const int blockRecords = 64;
+    static const int numBlocks = 8;
+    static const int chunkRecords = 12;
+    static const unsigned long flushInterval = 10000;
+
+    Journal() : _head(0), _flushed(0), _dropped(0), _dumpRequested(false), _lastFlushTime(0), _dumpSequence(0), _dumpOffset(0), _dumpEnd(0), _dumpRecords(0), _dumping(false)
+    {
+        _block.sequence = 0;
+        _block.count = 0;
+    }
+
+    /**
+     * Finds the newest block in flash and starts a new one after it.
+     */
+    void begin(uint8_t resetReason)
+    {
+        uint32_t newest = 0;
+        for (int i = 0; i < numBlocks; i++)
+        {
+            if (readBlock(i, _dumpBlock) && _dumpBlock.sequence > newest)
+                newest = _dumpBlock.sequence;
+        }
+        _block.sequence = newest + 1;
+        _block.count = 0;
+        log(EVENT_BOOT, resetReason);
+    }
+
+    void log(uint8_t event, uint8_t a = 0, uint16_t b = 0)
+    {
+        const uint32_t head = _head.load(std::memory_order_relaxed);
+        if (head - _flushed.load(std::memory_order_acquire) >= ramRecords)
+        {
+            _dropped++;
+            return;
+        }
+        _ring[head & (ramRecords - 1)] = {(uint32_t)hal::millis(), event, a, b};
+        _head.store(head + 1, std::memory_order_release);
+    }
+
+    // game loop side: has the network task dump the journal
+    void requestDump() { _dumpRequested.store(true, std::memory_order_release); }
+
+    // network task side
+    void handle()
+    {
+        if (_dumpRequested.exchange(false, std::memory_order_acquire))
+            startDump();
+        const uint32_t pending = _head.load(std::memory_order_acquire) - _flushed.load(std::memory_order_relaxed);
+        const unsigned long currentTime = hal::millis();
+        if (pending >= (uint32_t)(blockRecords - _block.count) || (pending > 0 && currentTime - _lastFlushTime >= flushInterval))
+            flush();
+    }
+
+    void flush()
+    {
+        _lastFlushTime = hal::millis();
+        const uint32_t head = _head.load(std::memory_order_acquire);
+        uint32_t flushed = _flushed.load(std::memory_order_relaxed);
+        while (flushed != head)
+        {
+            _block.records[_block.count++] = _ring[flushed & (ramRecords - 1)];
+            flushed++;
+            if (_block.count == blockRecords)
+            {
+                writeBlock();
+                _block.sequence++;
+                _block.count = 0;
+            }
+        }
+        _flushed.store(flushed, std::memory_order_release);
+        if (_block.count > 0)
+            writeBlock();
+    }
+
+    void startDump()
+    {
+        flush();
+        _dumpEnd = _block.count > 0 ? _block.sequence : _block.sequence - 1;
+        _dumpSequence = _dumpEnd >= numBlocks ? _dumpEnd - numBlocks + 1 : 1;
+        _dumpOffset = 0;
+        _dumpRecords = 0;
+        _dumpBlock.count = 0;
+        _dumpBlock.sequence = 0;
+        _dumping = true;
+    }
+
+    bool dumping() const { return _dumping; }
+
+    /**
+     * Renders the next chunk of the dump.
+     *
+     * @return The length of the chunk, 0 once the dump is over.
+     */
+    int nextDumpChunk(char *buffer, size_t size)
+    {
+        if (!_dumping)
+            return 0;
+
+        // skip to the next block that still holds records
+        while (_dumpSequence <= _dumpEnd && (_dumpBlock.sequence != _dumpSequence || _dumpOffset >= _dumpBlock.count))
+        {
+            if (_dumpBlock.sequence == _dumpSequence)
+            {
+                _dumpSequence++;
+                _dumpOffset = 0;
+            }
+            else if (!readBlock(_dumpSequence % numBlocks, _dumpBlock) || _dumpBlock.sequence != _dumpSequence)
+            {
+                _dumpBlock.sequence = _dumpSequence++;
+                _dumpBlock.count = 0;
+            }
+        }
+
+        if (_dumpSequence > _dumpEnd)
+        {
+            _dumping = false;
+            return snprintf(buffer, size, "end %lu", _dumpRecords);
+        }
+
+        int written = snprintf(buffer, size, "%lu ", (unsigned long)_dumpSequence);
+        for (int i = 0; i < chunkRecords && _dumpOffset < _dumpBlock.count && written + 2 * (int)sizeof(JournalRecord) < (int)size; i++)
+        {
+            const uint8_t *bytes = (const uint8_t *)&_dumpBlock.records[_dumpOffset++];
+            for (size_t j = 0; j < sizeof(JournalRecord); j++)
+                written += snprintf(buffer + written, size - written, "%02x", bytes[j]);
+            _dumpRecords++;
+        }
+        return written;
+    }
+
+    unsigned long dropped() const { return _dropped; }
+
+    static int describe(const JournalRecord &record, char *buffer, size_t size)
+    {
+        static const char *eventNames[NUM_EVENTS] = {"boot", "key", "stage", "transfer_start", "transfer_end", "fuel_reset", "compartment_open", "admin_command", "mqtt_state", "resume", "wheels"};
+        static const char *stageNames[] = {"READY", "WHEELS", "FUEL", "STARS", "SOLVED"};
+        static const char *linkStateNames[] = {"RESOLVING", "CONNECTING", "CONNECTED", "BACKOFF"};
+
+        const unsigned long time = record.time;
+        int written = snprintf(buffer, size, "%6lu.%03lu %-16s ", time / 1000, time % 1000, record.event < NUM_EVENTS ? eventNames[record.event] : "?");
+        switch (record.event)
+        {
+        case EVENT_KEY:
+            return written + snprintf(buffer + written, size - written, "'%c'", record.a);
+        case EVENT_STAGE:
+            return written + snprintf(buffer + written, size - written, "%s -> %s", stageNames[record.a % 5], stageNames[record.b % 5]);
+        case EVENT_TRANSFER_START:
+            return written + snprintf(buffer + written, size - written, "%d -> %d%s", record.a >> 4, record.a & 0x0F, record.b ? " (hint)" : "");
+        case EVENT_TRANSFER_END:
+            return written + snprintf(buffer + written, size - written, "%d -> %d levels %d,%d,%d,%d", record.a >> 4, record.a & 0x0F,
+                                      record.b & 0x0F, (record.b >> 4) & 0x0F, (record.b >> 8) & 0x0F, record.b >> 12);
+        case EVENT_MQTT_STATE:
+            return written + snprintf(buffer + written, size - written, "%s", linkStateNames[record.a % 4]);
+        case EVENT_RESUME:
+            return written + snprintf(buffer + written, size - written, "%s with %u:%02u left", stageNames[record.a % 5], record.b / 60, record.b % 60);
+        case EVENT_WHEELS:
+            return written + snprintf(buffer + written, size - written, "%u aligned, reeds 0x%04x", record.a, record.b);
+        default:
+            return written + snprintf(buffer + written, size - written, "%u %u", record.a, record.b);
+        }
+    }
+
+private:
+    struct Block
+    {
+        uint32_t sequence; // 0 = never written
+        uint16_t count;
+        uint16_t reserved;
+        JournalRecord records[blockRecords];
+    };
+
+    static void blockKey(int index, char *key) { snprintf(key, 12, "journal%d", index); }
+
+    static bool readBlock(int index, Block &block)
+    {
+        char key[12];
+        blockKey(index, key);
+        return hal::storageRead(key, &block, sizeof(Block)) == sizeof(Block) && block.count <= blockRecords;
+    }
+
+    void writeBlock()
+    {
+        char key[12];
+        blockKey(_block.sequence % numBlocks, key);
+        hal::storageWrite(key, &_block, sizeof(Block));
+    }
+
+    JournalRecord _ring[ramRecords];
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _flushed;
+    unsigned long _dropped;
+    std::atomic<bool> _dumpRequested;
+
+    Block _block;
+    unsigned long _lastFlushTime;
+
+    Block _dumpBlock;
+    uint32_t _dumpSequence;
+    uint16_t _dumpOffset;
+    uint32_t _dumpEnd;
+    unsigned long _dumpRecords;
+    bool _dumping;
+};
+
+#endif /* JOURNAL_H */
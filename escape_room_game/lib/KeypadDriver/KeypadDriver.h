@@ -0,0 +1,130 @@
+#ifndef KEYPAD_DRIVER_H
+#define KEYPAD_DRIVER_H
+
+#include <Hal.h>
+#include <SpscQueue.h>
+#include <limits.h>
+
+/** @brief A debounced key press or release, stamped with the millis() it was confirmed at and first seen at. */
+struct KeyEvent
+{
+    uint32_t time;
+    uint32_t seen;
+    char key;
+    bool pressed;
+};
+
+/**
+ * @class KeypadDriver
+ * @brief Turns the PCF8574 keypad into a queue of debounced press and release events.
+ *
+ * The PCF8574 pulls its INT line low whenever an input changes and releases it on the next read, so the keypad is
+ * only scanned over I2C after an interrupt: once to take the new state, and once more `debounceMs` later to confirm
+ * it. An idle keypad costs no I2C traffic at all. A confirmed change is queued as a release of the old key followed
+ * by a press of the new one, and the events wait in the queue until the current stage takes them, so keys pressed
+ * while a stage is busy (e.g. blinking the keypad) are handled afterwards instead of being lost.
+ *
+ * A scan rewrites the PCF8574 port and may raise INT itself, so the interrupt flag is cleared after the scan. A real
+ * change in that window is caught by the confirmation scan.
+ */
+class KeypadDriver
+{
+public:
+    static const uint8_t noKey = 16; // I2C_KEYPAD_NOKEY; 17 is several keys at once
+    static constexpr const char *keyMap = "123 456 789 *0# N";
+    static const unsigned long debounceMs = 20;
+    static const uint32_t queueSize = 16;
+
+    KeypadDriver(hal::Keypad &keypad, const byte intPin)
+        : _keypad(keypad), _intPin(intPin), _interrupted(false), _stable(noKey), _candidate(noKey), _candidateTime(0), _settling(false), _scans(0)
+    {
+    }
+
+    void begin()
+    {
+        hal::pinMode(_intPin, INPUT_PULLUP);
+        hal::attachInterrupt(_intPin, onInterrupt, this, FALLING);
+        _interrupted = true; // take the state the keypad is in now
+    }
+
+    // scans the keypad if it changed since the last scan, or when a change is due to be confirmed
+    void handle()
+    {
+        const unsigned long currentTime = hal::millis();
+        const bool interrupted = hal::trace().flag(_interrupted);
+        if (!interrupted && !(_settling && currentTime - _candidateTime >= debounceMs))
+            return;
+
+        // cleared before the read, so an interrupt during or after it is kept for the next pass
+        _interrupted = false;
+        const uint8_t index = _keypad.getKey();
+        _scans++;
+        if (index > noKey)
+            return;
+
+        if (index != _candidate)
+        {
+            _candidate = index;
+            _candidateTime = currentTime;
+            _settling = true;
+        }
+        else if (_settling && currentTime - _candidateTime >= debounceMs)
+        {
+            _settling = false;
+            if (_candidate != _stable)
+            {
+                if (_stable != noKey)
+                    _events.push({(uint32_t)currentTime, (uint32_t)_candidateTime, keyMap[_stable], false});
+                if (_candidate != noKey)
+                    _events.push({(uint32_t)currentTime, (uint32_t)_candidateTime, keyMap[_candidate], true});
+                _stable = _candidate;
+            }
+        }
+    }
+
+    /**
+     * @return How long the game loop may wait before the next handle(): until the pending change is to be confirmed,
+     * or indefinitely (ULONG_MAX) when nothing is pending. An interrupt ends the wait anyway.
+     */
+    unsigned long idleMs(unsigned long currentTime) const
+    {
+        if (!_settling)
+            return ULONG_MAX;
+        const unsigned long settled = currentTime - _candidateTime;
+        return settled >= debounceMs ? 0 : debounceMs - settled;
+    }
+
+    bool nextEvent(KeyEvent &event) { return _events.pop(event); }
+
+    // drops the events no stage is going to take, so they do not show up in a later one
+    void discardEvents()
+    {
+        KeyEvent event;
+        while (_events.pop(event))
+        {
+        }
+    }
+
+    unsigned long scans() const { return _scans; }
+    unsigned long dropped() const { return _events.dropped(); }
+
+private:
+    // also ends an idle wait of the game loop, so a key is scanned as soon as it goes down
+    static void IRAM_ATTR onInterrupt(void *driver)
+    {
+        ((KeypadDriver *)driver)->_interrupted = true;
+        hal::idleWakeFromIsr();
+    }
+
+    hal::Keypad &_keypad;
+    const byte _intPin;
+    volatile bool _interrupted;
+    uint8_t _stable;
+    uint8_t _candidate;
+    unsigned long _candidateTime;
+    bool _settling;
+    unsigned long _scans;
+    SpscQueue<KeyEvent, queueSize> _events;
+};
+
+#endif /* KEYPAD_DRIVER_H */
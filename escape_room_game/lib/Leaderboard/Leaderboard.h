@@ -0,0 +1,184 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include "RankTree.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief One finished game as it is kept in the leaderboard log: 32 bytes, appended once and never rewritten.
+ */
+struct ScoreRecord
+{
+    uint32_t finishedAt; // unix time
+    uint16_t day;        // days since 1970-01-01 in the venue's time zone
+    uint16_t seconds;    // how long the game took, as published on esp_completion
+    uint8_t room;
+    uint8_t nameLength;
+    char name[18];  // the team, not terminated
+    uint32_t check; // see checksum()
+
+    std::string team() const { return std::string(name, nameLength < sizeof(name) ? nameLength : sizeof(name)); }
+
+    // FNV-1a over everything but the check itself
+    uint32_t checksum() const
+    {
+        const uint8_t *bytes = (const uint8_t *)this;
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < offsetof(ScoreRecord, check); i++)
+            hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+
+    static ScoreRecord make(uint32_t finishedAt, uint16_t day, uint16_t seconds, uint8_t room, const std::string &team)
+    {
+        ScoreRecord record;
+        memset(&record, 0, sizeof(record));
+        record.finishedAt = finishedAt;
+        record.day = day;
+        record.seconds = seconds;
+        record.room = room;
+        record.nameLength = team.size() < sizeof(record.name) ? team.size() : sizeof(record.name);
+        memcpy(record.name, team.data(), record.nameLength);
+        record.check = record.checksum();
+        return record;
+    }
+};
+static_assert(sizeof(ScoreRecord) == 32, "score records are packed into 32 bytes");
+
+/**
+ * @class Leaderboard
+ * @brief Every finished game, ranked overall, per day and per room.
+ *
+ * Each ranking is a RankTree of (time, game number) keys, so equal times rank by who finished first, and the best
+ * N, the rank of a game and a page anywhere in a ranking are all O(log n). A team is ranked by its best game.
+ * Adding a game costs one insert into three trees. A log of hundreds of thousands of games is loaded at once with
+ * load(), which sorts and builds the trees instead.
+ */
+class Leaderboard
+{
+public:
+    struct Key
+    {
+        uint16_t seconds;
+        uint32_t game; // index in games()
+
+        bool operator<(const Key &other) const { return seconds != other.seconds ? seconds < other.seconds : game < other.game; }
+    };
+    typedef RankTree<Key> Ranking;
+
+    enum scope
+    {
+        SCOPE_ALL,
+        SCOPE_DAY,  // of the `which` day
+        SCOPE_ROOM, // of room `which`
+    };
+
+    /**
+     * @return The number of the game.
+     */
+    uint32_t add(const ScoreRecord &record)
+    {
+        const Key key = {record.seconds, (uint32_t)_games.size()};
+        _games.push_back(record);
+        _all.insert(key);
+        _days[record.day].insert(key);
+        _rooms[record.room].insert(key);
+        rankTeam(key.game);
+        return key.game;
+    }
+
+    /**
+     * Fills an empty leaderboard with `count` games at once, as add() one by one would, but in a few sequential
+     * passes: a counting sort by time, and every ranking built from its sorted keys.
+     */
+    void load(const ScoreRecord *records, size_t count)
+    {
+        _games.assign(records, records + count);
+
+        std::vector<uint32_t> starts(0x10000 + 1, 0);
+        for (const ScoreRecord &record : _games)
+            starts[record.seconds + 1]++;
+        for (size_t i = 1; i < starts.size(); i++)
+            starts[i] += starts[i - 1];
+        std::vector<Key> sorted(count);
+        for (uint32_t game = 0; game < count; game++)
+            sorted[starts[_games[game].seconds]++] = keyOf(game);
+        _all.build(sorted.data(), count);
+
+        std::unordered_map<uint32_t, std::vector<Key>> days, rooms;
+        for (const Key &key : sorted)
+        {
+            days[_games[key.game].day].push_back(key);
+            rooms[_games[key.game].room].push_back(key);
+        }
+        for (uint32_t game = 0; game < count; game++)
+            rankTeam(game);
+        for (const auto &day : days)
+            _days[day.first].build(day.second.data(), day.second.size());
+        for (const auto &room : rooms)
+            _rooms[room.first].build(room.second.data(), room.second.size());
+    }
+
+    const std::vector<ScoreRecord> &games() const { return _games; }
+    uint32_t count() const { return _games.size(); }
+
+    // nullptr for a day or room without games
+    const Ranking *ranking(scope s, uint32_t which) const
+    {
+        if (s == SCOPE_ALL)
+            return &_all;
+        if (s == SCOPE_DAY)
+        {
+            auto day = _days.find(which);
+            return day == _days.end() ? nullptr : &day->second;
+        }
+        auto room = _rooms.find(which);
+        return room == _rooms.end() ? nullptr : &room->second;
+    }
+
+    /**
+     * Calls `visit(rank, record)` for the best `count` games of a ranking, ranks from 1.
+     */
+    template <typename Visitor>
+    void top(scope s, uint32_t which, uint32_t count, Visitor visit) const
+    {
+        const Ranking *r = ranking(s, which);
+        if (r)
+            r->visit(0, count, [&](uint32_t rank, const Key &key) { visit(rank + 1, _games[key.game]); });
+    }
+
+    // the rank of a game in a ranking it is in, from 1
+    uint32_t rankOf(scope s, uint32_t which, uint32_t game) const { return ranking(s, which)->rankOf(keyOf(game)) + 1; }
+
+    /**
+     * @return The best game of `team`, or -1 if it never finished one.
+     */
+    int64_t bestGame(const std::string &team) const
+    {
+        auto best = _teams.find(team.substr(0, sizeof(ScoreRecord::name)));
+        return best == _teams.end() ? -1 : (int64_t)best->second;
+    }
+
+private:
+    Key keyOf(uint32_t game) const { return {_games[game].seconds, game}; }
+
+    void rankTeam(uint32_t game)
+    {
+        auto best = _teams.emplace(_games[game].team(), game);
+        if (!best.second && keyOf(game) < keyOf(best.first->second))
+            best.first->second = game;
+    }
+
+    std::vector<ScoreRecord> _games;
+    Ranking _all;
+    std::unordered_map<uint32_t, Ranking> _days;
+    std::unordered_map<uint32_t, Ranking> _rooms;
+    std::unordered_map<std::string, uint32_t> _teams; // best game
+};
+
+#endif /* LEADERBOARD_H */
@@ -0,0 +1,217 @@
+#ifndef RANK_TREE_H
+#define RANK_TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @class RankTree
+ * @brief Order-statistic tree: a sorted set of unique keys that also answers "how many keys are smaller" and "which
+ * key has rank k" in O(log n).
+ *
+ * It is a treap whose nodes count the size of their subtree. The nodes live in one vector and link to each other by
+ * index, so a few hundred thousand keys are a few allocations in all, and priorities come from a fixed xorshift
+ * sequence, so the same inserts always build the same tree. Keys are never removed: scores only ever get added.
+ *
+ * @tparam Key ordered by `operator<`, and unique under it
+ */
+template <typename Key>
+class RankTree
+{
+public:
+    RankTree() : _root(none), _seed(0x9E3779B9u) {}
+
+    void reserve(size_t count) { _nodes.reserve(count); }
+    uint32_t size() const { return sizeOf(_root); }
+
+    void insert(const Key &key)
+    {
+        _nodes.push_back({key, nextPriority(), 1, none, none});
+        _root = insert(_root, (int32_t)_nodes.size() - 1);
+    }
+
+    /**
+     * Builds a balanced tree from `count` sorted keys in O(n), on an empty tree: much faster than inserting them one by
+     * one. The built nodes take priorities above any xorshift value but the very largest, so later inserts end up
+     * below them, as leaves of a balanced tree.
+     */
+    void build(const Key *sorted, size_t count)
+    {
+        _nodes.reserve(_nodes.size() + count);
+        _root = build(sorted, 0, count, 0);
+    }
+
+    /**
+     * @return How many keys are smaller than `key`, i.e. its rank from 0 if it is in the tree.
+     */
+    uint32_t rankOf(const Key &key) const
+    {
+        uint32_t rank = 0;
+        for (int32_t node = _root; node != none;)
+        {
+            const Node &n = _nodes[node];
+            if (n.key < key)
+            {
+                rank += sizeOf(n.left) + 1;
+                node = n.right;
+            }
+            else
+            {
+                node = n.left;
+            }
+        }
+        return rank;
+    }
+
+    /**
+     * @return The key of rank `rank` (from 0), which must be below size().
+     */
+    const Key &select(uint32_t rank) const
+    {
+        int32_t node = _root;
+        for (;;)
+        {
+            const Node &n = _nodes[node];
+            const uint32_t leftSize = sizeOf(n.left);
+            if (rank < leftSize)
+            {
+                node = n.left;
+            }
+            else if (rank == leftSize)
+            {
+                return n.key;
+            }
+            else
+            {
+                rank -= leftSize + 1;
+                node = n.right;
+            }
+        }
+    }
+
+    /**
+     * Calls `visit(rank, key)` for `count` keys in order, from the one of rank `first`, in O(log n + count).
+     */
+    template <typename Visitor>
+    void visit(uint32_t first, uint32_t count, Visitor visit) const
+    {
+        // the path down to `first`: the nodes still to visit after their left subtree
+        int32_t stack[maxDepth];
+        int depth = 0;
+        uint32_t rank = first;
+        for (int32_t node = _root; node != none && depth < maxDepth;)
+        {
+            const Node &n = _nodes[node];
+            const uint32_t leftSize = sizeOf(n.left);
+            if (rank < leftSize)
+            {
+                stack[depth++] = node;
+                node = n.left;
+            }
+            else if (rank == leftSize)
+            {
+                stack[depth++] = node;
+                break;
+            }
+            else
+            {
+                rank -= leftSize + 1;
+                node = n.right;
+            }
+        }
+
+        for (uint32_t i = 0; i < count && depth > 0; i++)
+        {
+            const int32_t node = stack[--depth];
+            visit(first + i, _nodes[node].key);
+            for (int32_t next = _nodes[node].right; next != none && depth < maxDepth; next = _nodes[next].left)
+                stack[depth++] = next;
+        }
+    }
+
+private:
+    static const int32_t none = -1;
+    static const int maxDepth = 128; // a treap of 2^32 keys is far shallower with any sane priorities
+
+    struct Node
+    {
+        Key key;
+        uint32_t priority;
+        uint32_t size;
+        int32_t left;
+        int32_t right;
+    };
+
+    uint32_t sizeOf(int32_t node) const { return node == none ? 0 : _nodes[node].size; }
+    void update(int32_t node) { _nodes[node].size = sizeOf(_nodes[node].left) + sizeOf(_nodes[node].right) + 1; }
+
+    uint32_t nextPriority()
+    {
+        _seed ^= _seed << 13;
+        _seed ^= _seed >> 17;
+        _seed ^= _seed << 5;
+        return _seed;
+    }
+
+    int32_t rotateRight(int32_t node)
+    {
+        const int32_t left = _nodes[node].left;
+        _nodes[node].left = _nodes[left].right;
+        _nodes[left].right = node;
+        update(node);
+        update(left);
+        return left;
+    }
+
+    int32_t rotateLeft(int32_t node)
+    {
+        const int32_t right = _nodes[node].right;
+        _nodes[node].right = _nodes[right].left;
+        _nodes[right].left = node;
+        update(node);
+        update(right);
+        return right;
+    }
+
+    int32_t build(const Key *sorted, size_t begin, size_t end, uint32_t depth)
+    {
+        if (begin == end)
+            return none;
+        const size_t middle = begin + (end - begin) / 2;
+        const int32_t node = _nodes.size();
+        _nodes.push_back({sorted[middle], ~0u - depth, (uint32_t)(end - begin), none, none});
+        const int32_t left = build(sorted, begin, middle, depth + 1);
+        const int32_t right = build(sorted, middle + 1, end, depth + 1);
+        _nodes[node].left = left;
+        _nodes[node].right = right;
+        return node;
+    }
+
+    // inserts `added` below `node`, and returns the new root of that subtree
+    int32_t insert(int32_t node, int32_t added)
+    {
+        if (node == none)
+            return added;
+        if (_nodes[added].key < _nodes[node].key)
+        {
+            _nodes[node].left = insert(_nodes[node].left, added);
+            if (_nodes[_nodes[node].left].priority > _nodes[node].priority)
+                return rotateRight(node);
+        }
+        else
+        {
+            _nodes[node].right = insert(_nodes[node].right, added);
+            if (_nodes[_nodes[node].right].priority > _nodes[node].priority)
+                return rotateLeft(node);
+        }
+        update(node);
+        return node;
+    }
+
+    std::vector<Node> _nodes;
+    int32_t _root;
+    uint32_t _seed;
+};
+
+#endif /* RANK_TREE_H */
@@ -0,0 +1,111 @@
+#ifndef LEDS_H
+#define LEDS_H
+
+#include <Hal.h>
+
+/**
+ * @brief Frame compositor for the NeoPixel strip.
+ *
+ * Owns the strip: modules write pixels through their LedSegment, and `flush()` pushes the frame with a single
+ * `show()` when something actually changed. `loop()` calls `flush()` once at the end of every pass, so a pass
+ * starts at most one transfer no matter how many pixels were touched. The transfer runs in the background
+ * (see hal::Strip); if the previous frame is still on the line, the frame stays dirty and goes out on a later pass.
+ */
+class LedFrame
+{
+public:
+    LedFrame(hal::Strip &strip) : _strip(strip),
+                                  _numPixels(strip.numPixels()),
+                                  _pixels(new uint32_t[strip.numPixels()]()),
+                                  _dirty(true),
+                                  _framesPushed(0),
+                                  _framesThisSecond(0),
+                                  _framesPerSecond(0),
+                                  _secondStart(0)
+    {
+    }
+    ~LedFrame() { delete[] _pixels; }
+    LedFrame(const LedFrame &) = delete;
+    LedFrame &operator=(const LedFrame &) = delete;
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return hal::Strip::Color(r, g, b); }
+
+    void set(uint16_t pixel, uint32_t color)
+    {
+        if (pixel >= _numPixels || _pixels[pixel] == color)
+            return;
+        _pixels[pixel] = color;
+        _strip.setPixelColor(pixel, color); // it only takes effect on the next flush()
+        _dirty = true;
+    }
+
+    uint32_t get(uint16_t pixel) const { return pixel < _numPixels ? _pixels[pixel] : 0; }
+
+    void flush()
+    {
+        const unsigned long currentTime = hal::millis();
+        if (currentTime - _secondStart >= 1000)
+        {
+            _framesPerSecond = _framesThisSecond;
+            _framesThisSecond = 0;
+            _secondStart = currentTime;
+        }
+
+        if (!_dirty || _strip.busy())
+            return;
+        _strip.show();
+        _dirty = false;
+        _framesPushed++;
+        _framesThisSecond++;
+    }
+
+    // a frame that could not go out yet, because the strip was still busy with the last one
+    bool pending() const { return _dirty; }
+
+    unsigned long framesPushed() const { return _framesPushed; }
+    unsigned int framesPerSecond() const { return _framesPerSecond; }
+
+private:
+    hal::Strip &_strip;
+    const uint16_t _numPixels;
+    uint32_t *_pixels;
+    bool _dirty;
+
+    unsigned long _framesPushed;
+    unsigned int _framesThisSecond;
+    unsigned int _framesPerSecond;
+    unsigned long _secondStart;
+};
+
+/**
+ * @brief A named, contiguous run of pixels on the strip.
+ *
+ * Indexes are relative to the start of the segment; writes outside of it are ignored.
+ */
+class LedSegment
+{
+public:
+    LedSegment(LedFrame &frame, uint16_t first, uint16_t length) : _frame(frame), _first(first), _length(length) {}
+
+    void set(uint16_t index, uint32_t color)
+    {
+        if (index < _length)
+            _frame.set(_first + index, color);
+    }
+
+    void fill(uint32_t color)
+    {
+        for (uint16_t i = 0; i < _length; i++)
+            _frame.set(_first + i, color);
+    }
+
+    uint32_t get(uint16_t index) const { return index < _length ? _frame.get(_first + index) : 0; }
+    uint16_t length() const { return _length; }
+
+private:
+    LedFrame &_frame;
+    const uint16_t _first;
+    const uint16_t _length;
+};
+
+#endif /* LEDS_H */
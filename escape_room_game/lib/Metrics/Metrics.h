@@ -0,0 +1,140 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "globals.h"
+
+enum loopSection
+{
+    SECTION_MQTT,
+    SECTION_TIMER,
+    SECTION_ANIMATIONS,
+    SECTION_PLAY,
+    SECTION_LOOP,
+    NUM_SECTIONS
+};
+
+/**
+ * @brief Fixed-bucket log2 latency histogram.
+ *
+ * Bucket 0 counts samples below 2us, bucket i counts samples in [2^i, 2^(i+1)) us and the last bucket
+ * takes everything above. Recording is a count-leading-zeros and an increment, so it can stay enabled.
+ * Percentiles are reported as the upper bound of the bucket they fall in, capped by the exact maximum.
+ */
+class LatencyHistogram
+{
+public:
+    static const int numBuckets = 24;
+
+    LatencyHistogram() { reset(); }
+
+    void reset()
+    {
+        memset(_counts, 0, sizeof(_counts));
+        _samples = 0;
+        _max = 0;
+    }
+
+    void record(uint32_t us)
+    {
+        int bucket = us < 2 ? 0 : 31 - __builtin_clz(us);
+        if (bucket >= numBuckets)
+            bucket = numBuckets - 1;
+        _counts[bucket]++;
+        _samples++;
+        if (us > _max)
+            _max = us;
+    }
+
+    uint32_t percentile(uint32_t permille) const
+    {
+        if (_samples == 0)
+            return 0;
+        uint32_t rank = ((uint64_t)_samples * permille + 999) / 1000;
+        uint32_t seen = 0;
+        for (int i = 0; i < numBuckets; i++)
+        {
+            seen += _counts[i];
+            if (seen >= rank)
+                return std::min<uint32_t>((2u << i) - 1, _max);
+        }
+        return _max;
+    }
+
+    uint32_t samples() const { return _samples; }
+    uint32_t max() const { return _max; }
+
+private:
+    uint32_t _counts[numBuckets];
+    uint32_t _samples;
+    uint32_t _max;
+};
+
+/**
+ * @brief Times the sections of `loop()` per game stage.
+ *
+ * `beginLoop()` stamps the start of a pass and remembers the stage it started in, every `lap()` records the
+ * time since the previous mark into that stage's histogram for the section, and `endLoop()` records the
+ * whole pass. `format()` renders one stage as a single compact line, in microseconds:
+ * `FUEL n=5120 loop=15/63/301 mqtt=3/7/120 timer=7/15/40 anim=1/3/30 play=3/31/150`
+ * where each triple is p50/p99/max.
+ */
+class LoopMetrics
+{
+public:
+    LoopMetrics() : _stage(READY), _loopStart(0), _mark(0) {}
+
+    void beginLoop(stage currentStage)
+    {
+        _stage = currentStage;
+        _loopStart = _mark = hal::esp_timer_get_time();
+    }
+
+    void lap(loopSection section)
+    {
+        int64_t now = hal::esp_timer_get_time();
+        _histograms[_stage][section].record(now - _mark);
+        _mark = now;
+    }
+
+    void endLoop()
+    {
+        _histograms[_stage][SECTION_LOOP].record(hal::esp_timer_get_time() - _loopStart);
+    }
+
+    bool hasSamples(stage s) const { return _histograms[s][SECTION_LOOP].samples() > 0; }
+
+    int format(stage s, char *buffer, size_t size) const
+    {
+        static const char *stageNames[] = {"READY", "WHEELS", "FUEL", "STARS", "SOLVED"};
+        static const char *sectionNames[NUM_SECTIONS] = {"mqtt", "timer", "anim", "play", "loop"};
+
+        const LatencyHistogram *histograms = _histograms[s];
+        int written = snprintf(buffer, size, "%s n=%u", stageNames[s], (unsigned)histograms[SECTION_LOOP].samples());
+        // whole-loop numbers first, then the sections in loop() order
+        for (int i = 0; i < NUM_SECTIONS && written < (int)size; i++)
+        {
+            const int section = (i + SECTION_LOOP) % NUM_SECTIONS;
+            written += snprintf(buffer + written, size - written, " %s=%u/%u/%u", sectionNames[section],
+                                (unsigned)histograms[section].percentile(500),
+                                (unsigned)histograms[section].percentile(990),
+                                (unsigned)histograms[section].max());
+        }
+        return written;
+    }
+
+    void reset(stage s)
+    {
+        for (int i = 0; i < NUM_SECTIONS; i++)
+            _histograms[s][i].reset();
+    }
+
+private:
+    static const int numStages = SOLVED + 1;
+
+    LatencyHistogram _histograms[numStages][NUM_SECTIONS];
+    stage _stage;
+    int64_t _loopStart;
+    int64_t _mark;
+};
+
+#endif /* METRICS_H */
@@ -0,0 +1,252 @@
+#ifndef MQTT_LINK_H
+#define MQTT_LINK_H
+
+#include "GameContext.h"
+
+enum linkState
+{
+    LINK_RESOLVING,
+    LINK_CONNECTING,
+    LINK_CONNECTED,
+    LINK_BACKOFF
+};
+
+/**
+ * @class MqttLink
+ * @brief Non-blocking connection to the MQTT broker.
+ *
+ * `handle()` is called from every pass of the network task and advances a small state machine:
+ * RESOLVING (asynchronous mDNS lookup of the `_mqtt._tcp` service) -> CONNECTING (non-blocking TCP connect, then
+ * MQTT CONNECT, its CONNACK and the `admin` subscription) -> CONNECTED (pumps `mqttClient->loop()`), and on any
+ * failure or lost connection BACKOFF, which waits with exponential backoff before resolving again. CONNECTING only
+ * looks at how the connect or the handshake is going on every pass, each with a time limit of its own, so no pass
+ * ever waits for the socket or the broker.
+ * If the lookup fails but the broker was found before, the last known address is tried.
+ *
+ * The address of the last broker it connected to is kept in NVS, and `begin()` connects to it straight away,
+ * without waiting for mDNS; only when that fails does the link fall back to a lookup.
+ *
+ * The time from starting a lookup to being subscribed and the number of reconnects are kept for reporting.
+ * State changes are passed to the game loop as NET_LINK_STATE events.
+ */
+class MqttLink
+{
+public:
+    typedef void (*ConnectHandler)(void *arg, bool reconnect);
+
+    MqttLink(GameContext &context) : _context(context),
+                                     _state(LINK_BACKOFF),
+                                     _stateTime(0),
+                                     _attemptStart(0),
+                                     _handshaking(false),
+                                     _backoff(0),
+                                     _hasAddress(false),
+                                     _everConnected(false),
+                                     _connects(0),
+                                     _reconnects(0),
+                                     _failures(0),
+                                     _lastConnectLatency(0),
+                                     _onConnect(nullptr),
+                                     _onConnectArg(nullptr)
+    {
+    }
+
+    void begin(ConnectHandler onConnect, void *arg)
+    {
+        _onConnect = onConnect;
+        _onConnectArg = arg;
+        _context.mqttClient->setSocketTimeout(_socketTimeoutSeconds);
+        _context.mqttClient->setKeepAlive(_keepAliveSeconds);
+        hal::mdnsAddService("mqtt", "tcp", mqtt_port);
+        if (hal::storageRead(_storageKey, _cachedAddress, sizeof(_cachedAddress)) == sizeof(_cachedAddress))
+        {
+            _context.mqtt_ip = hal::IPAddress(_cachedAddress[0], _cachedAddress[1], _cachedAddress[2], _cachedAddress[3]);
+            _hasAddress = true;
+            _attemptStart = hal::millis();
+            startConnecting(_attemptStart);
+        }
+        else
+        {
+            startResolving(hal::millis());
+        }
+    }
+
+    void handle()
+    {
+        const unsigned long currentTime = hal::millis();
+        switch (_state)
+        {
+        case LINK_RESOLVING:
+        {
+            hal::mdnsQueryStatus status = hal::mdnsQueryPoll(_context.mqtt_ip);
+            if (status == hal::MDNS_QUERY_PENDING)
+                break;
+            if (status == hal::MDNS_QUERY_FOUND)
+                _hasAddress = true;
+            else
+                Serial.println("MQTT service not found.");
+
+            if (_hasAddress)
+                startConnecting(currentTime);
+            else
+                fail(currentTime);
+            break;
+        }
+        case LINK_CONNECTING:
+        {
+            if (!_handshaking)
+            {
+                const int tcp = _context.espClient.connectPoll();
+                if (tcp == 0 && currentTime - _stateTime < _connectTimeout)
+                    break;
+                if (tcp <= 0 || !_context.espClient.startSession(_clientId, _keepAliveSeconds))
+                {
+                    _context.espClient.stop();
+                    fail(currentTime);
+                    break;
+                }
+                _handshaking = true;
+                _stateTime = currentTime;
+                break;
+            }
+            if (!_context.espClient.sessionAnswered())
+            {
+                if (currentTime - _stateTime >= _handshakeTimeout)
+                {
+                    Serial.println("no CONNACK");
+                    _context.espClient.stop();
+                    fail(currentTime);
+                }
+                break;
+            }
+
+            // the CONNACK is in, so this returns without waiting; the SUBACK is read by loop()
+            if (!_context.mqttClient->connect(_clientId) || !_context.mqttClient->subscribe("admin"))
+            {
+                Serial.print("failed, rc=");
+                Serial.println(_context.mqttClient->state());
+                _context.mqttClient->disconnect();
+                fail(currentTime);
+                break;
+            }
+
+            const unsigned long now = hal::millis();
+            _lastConnectLatency = now - _attemptStart;
+            _backoff = 0;
+            _connects++;
+            const bool reconnect = _everConnected;
+            if (reconnect)
+                _reconnects++;
+            _everConnected = true;
+            setState(LINK_CONNECTED, now);
+            Serial.println("connected");
+            cacheAddress();
+
+            if (_onConnect)
+                _onConnect(_onConnectArg, reconnect);
+            break;
+        }
+        case LINK_CONNECTED:
+        {
+            if (!_context.mqttClient->loop())
+            {
+                Serial.println("MQTT connection lost");
+                _context.mqttClient->disconnect();
+                fail(currentTime);
+            }
+            break;
+        }
+        case LINK_BACKOFF:
+        {
+            if (currentTime - _stateTime >= _backoff)
+                startResolving(currentTime);
+            break;
+        }
+        }
+    }
+
+    bool connected() const { return _state == LINK_CONNECTED; }
+    linkState state() const { return _state; }
+
+    unsigned long connects() const { return _connects; }
+    unsigned long reconnects() const { return _reconnects; }
+    unsigned long failures() const { return _failures; }
+    unsigned long lastConnectLatency() const { return _lastConnectLatency; }
+
+private:
+    void setState(linkState state, unsigned long currentTime)
+    {
+        if (state != _state)
+            _context.post({NET_LINK_STATE, (uint8_t)state});
+        _state = state;
+        _stateTime = currentTime;
+    }
+
+    void startResolving(unsigned long currentTime)
+    {
+        _attemptStart = currentTime;
+        if (!hal::mdnsQueryStart("mqtt", "tcp", _lookupTimeout) && _hasAddress)
+            startConnecting(currentTime);
+        else
+            setState(LINK_RESOLVING, currentTime);
+    }
+
+    void startConnecting(unsigned long currentTime)
+    {
+        Serial.print("Attempting MQTT connection to ");
+        Serial.println(_context.mqtt_ip);
+        _context.mqttClient->setServer(_context.mqtt_ip, mqtt_port);
+        _handshaking = false;
+        if (_context.espClient.connectStart(_context.mqtt_ip, mqtt_port))
+            setState(LINK_CONNECTING, currentTime);
+        else
+            fail(currentTime);
+    }
+
+    void cacheAddress()
+    {
+        const uint8_t address[4] = {_context.mqtt_ip[0], _context.mqtt_ip[1], _context.mqtt_ip[2], _context.mqtt_ip[3]};
+        if (memcmp(address, _cachedAddress, sizeof(address)) == 0)
+            return;
+        memcpy(_cachedAddress, address, sizeof(address));
+        hal::storageWrite(_storageKey, _cachedAddress, sizeof(_cachedAddress));
+    }
+
+    void fail(unsigned long currentTime)
+    {
+        _failures++;
+        _backoff = _backoff == 0 ? _minBackoff : std::min(_backoff * 2, _maxBackoff);
+        setState(LINK_BACKOFF, currentTime);
+    }
+
+    GameContext &_context;
+
+    const char *_clientId = "ESP32Client";
+    const char *_storageKey = "broker";
+    const unsigned long _lookupTimeout = 3000;
+    const unsigned long _connectTimeout = 1000;
+    const unsigned long _handshakeTimeout = 1000;
+    const uint16_t _socketTimeoutSeconds = 1;
+    const uint16_t _keepAliveSeconds = 15; // PubSubClient's default
+    const unsigned long _minBackoff = 500;
+    const unsigned long _maxBackoff = 30000;
+
+    linkState _state;
+    unsigned long _stateTime;
+    unsigned long _attemptStart;
+    bool _handshaking;
+    unsigned long _backoff;
+    bool _hasAddress;
+    bool _everConnected;
+    uint8_t _cachedAddress[4] = {};
+
+    unsigned long _connects;
+    unsigned long _reconnects;
+    unsigned long _failures;
+    unsigned long _lastConnectLatency;
+
+    ConnectHandler _onConnect;
+    void *_onConnectArg;
+};
+
+#endif /* MQTT_LINK_H */
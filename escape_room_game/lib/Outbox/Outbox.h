@@ -0,0 +1,201 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include "globals.h"
+#include <string.h>
+
+/**
+ * @class Outbox
+ * @brief The network task's last step before the broker: decides, per topic, which of the messages the game loop
+ * queued are worth a publish.
+ *
+ * A topic without a policy goes straight through. A topic with one is either
+ * - an event topic: at most `burst` messages go out per window, the rest are dropped. With `dropRepeats`, a payload
+ *   identical to the last one published within the window is a duplicate and dropped as well; a topic whose repeats
+ *   each answer a command of their own (e.g. `global_reset` on ESP_TOPIC) keeps them;
+ * - a state topic (`burst` 0, e.g. the countdown): only its latest value matters. A value that arrives before the
+ *   window since the last publish has passed is held, and replaces the one already held (coalesced); the held
+ *   value goes out from nextDue() once the window is over, so the newest state always gets through. The value
+ *   already published is never published again, except after reconnected(), which republishes it.
+ *
+ * Everything is counted for the OUTBOX metrics line. Only used by the network task.
+ */
+class Outbox
+{
+public:
+    static const int maxPolicies = 6;
+
+    Outbox() : _numPolicies(0), _sent(0), _coalesced(0), _duplicates(0), _dropped(0) {}
+
+    /**
+     * @param interval ms of the rate window
+     * @param burst publishes per window, 0 for a state topic
+     * @param dropRepeats whether an event topic drops a payload repeated within the window
+     */
+    void setPolicy(const char *topic, uint16_t interval, uint8_t burst, bool dropRepeats = true)
+    {
+        if (_numPolicies == maxPolicies)
+            return;
+        Slot &slot = _slots[_numPolicies++];
+        memset(&slot, 0, sizeof(slot));
+        slot.topic = topic;
+        slot.interval = interval;
+        slot.burst = burst;
+        slot.dropRepeats = dropRepeats;
+    }
+
+    /**
+     * @brief Takes a message from the outbound queue.
+     *
+     * @return True if it is to be published now, false if it was held, coalesced or dropped.
+     */
+    bool offer(const OutboundMessage &message, unsigned long now)
+    {
+        Slot *slot = find(message.topic);
+        if (!slot)
+            return true;
+
+        const uint32_t hash = hashOf(message.payload);
+        if (slot->burst == 0)
+        {
+            if (slot->pending)
+                _coalesced++;
+            slot->pending = false;
+            if (repeats(*slot, hash, message.payload))
+            {
+                _duplicates++;
+                return false;
+            }
+            if (slot->published && now - slot->lastAt < slot->interval)
+            {
+                slot->held = message;
+                slot->pending = true;
+                return false;
+            }
+            slot->held = message; // for reconnected()
+            stamp(*slot, hash, message.payload, now);
+            return true;
+        }
+
+        if (now - slot->windowStart >= slot->interval)
+        {
+            slot->windowStart = now;
+            slot->inWindow = 0;
+        }
+        if (slot->dropRepeats && repeats(*slot, hash, message.payload) && now - slot->lastAt < slot->interval)
+        {
+            _duplicates++;
+            return false;
+        }
+        if (slot->inWindow >= slot->burst)
+        {
+            _dropped++;
+            return false;
+        }
+        slot->inWindow++;
+        stamp(*slot, hash, message.payload, now);
+        return true;
+    }
+
+    /**
+     * @brief Hands out a held state whose window is over, one per call.
+     *
+     * @return False when there is none.
+     */
+    bool nextDue(OutboundMessage &message, unsigned long now)
+    {
+        for (int i = 0; i < _numPolicies; i++)
+        {
+            Slot &slot = _slots[i];
+            if (slot.pending && (!slot.published || now - slot.lastAt >= slot.interval))
+            {
+                message = slot.held;
+                slot.pending = false;
+                stamp(slot, hashOf(message.payload), message.payload, now);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief After a (re)connect the broker may have missed the last state values: they are due again.
+     */
+    void reconnected()
+    {
+        for (int i = 0; i < _numPolicies; i++)
+        {
+            Slot &slot = _slots[i];
+            if (slot.burst == 0 && slot.published)
+                slot.pending = true; // `held` is the last value
+            slot.published = false;
+        }
+    }
+
+    // the caller's part of the count: whether a message offer() let through got out, or was lost with the connection
+    void countSent() { _sent++; }
+    void countDropped() { _dropped++; }
+    unsigned long sent() const { return _sent; }
+    unsigned long coalesced() const { return _coalesced; }
+    unsigned long duplicates() const { return _duplicates; }
+    unsigned long dropped() const { return _dropped; }
+
+private:
+    struct Slot
+    {
+        const char *topic;
+        uint16_t interval;
+        uint8_t burst;
+        uint8_t inWindow;
+        bool dropRepeats;
+        unsigned long windowStart;
+        bool published; // lastHash, lastAt and lastPayload are valid
+        bool pending;   // `held` waits for its window, or for the connection
+        uint32_t lastHash;
+        unsigned long lastAt;
+        char lastPayload[sizeof(OutboundMessage::payload)];
+        OutboundMessage held; // state topics: the value waiting, or else the last one published
+    };
+
+    // the topics are the constants from globals.h, so the pointer is the topic
+    Slot *find(const char *topic)
+    {
+        for (int i = 0; i < _numPolicies; i++)
+        {
+            if (_slots[i].topic == topic)
+                return &_slots[i];
+        }
+        return nullptr;
+    }
+
+    // whether `payload` is the one last published; the hash only saves most of the string compares
+    static bool repeats(const Slot &slot, uint32_t hash, const char *payload)
+    {
+        return slot.published && hash == slot.lastHash && strcmp(payload, slot.lastPayload) == 0;
+    }
+
+    void stamp(Slot &slot, uint32_t hash, const char *payload, unsigned long now)
+    {
+        slot.published = true;
+        slot.lastHash = hash;
+        slot.lastAt = now;
+        strcpy(slot.lastPayload, payload); // both are OutboundMessage payloads
+    }
+
+    static uint32_t hashOf(const char *payload)
+    {
+        uint32_t hash = 2166136261u; // FNV-1a
+        for (; *payload; payload++)
+            hash = (hash ^ (uint8_t)*payload) * 16777619u;
+        return hash;
+    }
+
+    Slot _slots[maxPolicies];
+    int _numPolicies;
+    unsigned long _sent;
+    unsigned long _coalesced;
+    unsigned long _duplicates;
+    unsigned long _dropped;
+};
+
+#endif /* OUTBOX_H */
@@ -0,0 +1,193 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "GameContext.h"
+#include <tuple>
+#include <utility>
+
+/**
+ * @class PuzzlePipeline
+ * @brief The game flow: the puzzles in the order they are played, from READY through SOLVED.
+ *
+ * Every puzzle type provides `setup()`, `reset()`, `hint()`, `solve()` and `bool play()` (true once the players
+ * solved it), `uint16_t snapshot()` and `resume(uint16_t)` to keep its state across a reset, a `compartment`, and
+ * three constants: its stage `id`, a short `name` and the `solvedMessage` published on ESP_TOPIC. The list is fixed
+ * at compile time, and `play()` reaches the current puzzle through a chain of compile-time comparisons over the list,
+ * so there is no virtual call on the hot path.
+ *
+ * Finishing a puzzle, whether by playing it or by `solve()` from the admin panel, always goes through `complete()`:
+ * open its compartment, publish its solved message and move on to the next stage. After the last puzzle the game is
+ * SOLVED and the finish handler runs. The time spent in every stage of the current game is recorded on each change.
+ *
+ * @tparam Puzzles the puzzle types, in playing order; their stages must follow READY in the same order
+ */
+template <typename... Puzzles>
+class PuzzlePipeline
+{
+public:
+    static const int numPuzzles = sizeof...(Puzzles);
+    typedef void (*FinishHandler)(void *arg);
+
+    PuzzlePipeline(GameContext &context, Puzzles &...puzzles)
+        : _context(context), _puzzles(puzzles...), _stageStart(0), _stageMillis(), _onFinish(nullptr), _onFinishArg(nullptr)
+    {
+    }
+
+    void setup(FinishHandler onFinish, void *arg)
+    {
+        _onFinish = onFinish;
+        _onFinishArg = arg;
+        forEach([](auto &puzzle) { puzzle.setup(); });
+    }
+
+    // every puzzle back to its initial state, waiting for a new game
+    void reset()
+    {
+        forEach([](auto &puzzle) { puzzle.reset(); });
+        for (unsigned long &millis : _stageMillis)
+            millis = 0;
+        _stageStart = hal::millis();
+        _context.currentStage = READY;
+    }
+
+    void start() { enter(firstStage); }
+
+    bool inPuzzle() const { return _context.currentStage >= firstStage && _context.currentStage < SOLVED; }
+
+    void play()
+    {
+        playAt(_context.currentStage - firstStage, std::index_sequence_for<Puzzles...>());
+    }
+
+    template <typename Puzzle>
+    Puzzle &puzzle() { return std::get<Puzzle &>(_puzzles); }
+
+    template <typename Puzzle>
+    void hint() { puzzle<Puzzle>().hint(); }
+
+    // solves the puzzle from the admin panel, but only while it is being played
+    template <typename Puzzle>
+    void solve()
+    {
+        if (_context.currentStage != Puzzle::id)
+            return;
+        puzzle<Puzzle>().solve();
+        complete(puzzle<Puzzle>());
+    }
+
+    // one state word per puzzle, in playing order, for a GameSnapshot
+    void capture(uint16_t *states) const
+    {
+        int i = 0;
+        forEach([&](const auto &puzzle) { states[i++] = puzzle.snapshot(); });
+    }
+
+    /**
+     * Picks up a game from a snapshot after a reset: the puzzles take their state words back and the game continues
+     * in stage `s`. The compartments of the finished puzzles are not opened again. The stage times start over.
+     */
+    void resume(stage s, const uint16_t *states)
+    {
+        int i = 0;
+        forEach([&](auto &puzzle) { puzzle.resume(states[i++]); });
+        for (unsigned long &millis : _stageMillis)
+            millis = 0;
+        _stageStart = hal::millis();
+        _context.currentStage = s;
+    }
+
+    // publishes the solved message of every puzzle finished in this game, so the dashboard catches up after a resume
+    void announceCompleted() const
+    {
+        forEach([&](const auto &puzzle)
+                {
+                    typedef std::decay_t<decltype(puzzle)> Puzzle;
+                    if (Puzzle::id < _context.currentStage)
+                        _context.publish(ESP_TOPIC, Puzzle::solvedMessage);
+                });
+    }
+
+    // time spent in a stage during the current game, including the running one
+    unsigned long stageMillis(stage s) const
+    {
+        return _stageMillis[s] + (s == _context.currentStage ? hal::millis() - _stageStart : 0);
+    }
+
+    /**
+     * Renders the time spent on every puzzle of the current game as `STAGES wheels=12.3 fuel=40.0 stars=0.0`, in seconds.
+     */
+    int format(char *buffer, size_t size) const
+    {
+        int written = snprintf(buffer, size, "STAGES");
+        forEach([&](const auto &puzzle)
+                {
+                    typedef std::decay_t<decltype(puzzle)> Puzzle;
+                    const unsigned long millis = stageMillis(Puzzle::id);
+                    if (written < (int)size)
+                        written += snprintf(buffer + written, size - written, " %s=%lu.%lu", Puzzle::name, millis / 1000, millis % 1000 / 100);
+                });
+        return written;
+    }
+
+private:
+    static const stage firstStage = (stage)(READY + 1);
+
+    template <size_t... I>
+    static constexpr bool stagesInOrder(std::index_sequence<I...>)
+    {
+        return ((std::tuple_element_t<I, std::tuple<Puzzles...>>::id == firstStage + (int)I) && ...) && firstStage + numPuzzles == SOLVED;
+    }
+    static_assert(stagesInOrder(std::index_sequence_for<Puzzles...>()), "the puzzle stages must follow READY in playing order and end at SOLVED");
+
+    template <size_t... I>
+    void playAt(int index, std::index_sequence<I...>)
+    {
+        ((index == (int)I ? playPuzzle(std::get<I>(_puzzles)) : void()), ...);
+    }
+
+    template <typename Puzzle>
+    void playPuzzle(Puzzle &puzzle)
+    {
+        if (puzzle.play())
+            complete(puzzle);
+    }
+
+    template <typename Puzzle>
+    void complete(Puzzle &puzzle)
+    {
+        puzzle.compartment.open();
+        enter((stage)(Puzzle::id + 1));
+        _context.publish(ESP_TOPIC, Puzzle::solvedMessage);
+        if (_context.currentStage == SOLVED && _onFinish)
+            _onFinish(_onFinishArg);
+    }
+
+    void enter(stage next)
+    {
+        const unsigned long currentTime = hal::millis();
+        _stageMillis[_context.currentStage] += currentTime - _stageStart;
+        _stageStart = currentTime;
+        _context.currentStage = next;
+    }
+
+    template <typename Function>
+    void forEach(Function function)
+    {
+        std::apply([&](auto &...puzzles) { (function(puzzles), ...); }, _puzzles);
+    }
+
+    template <typename Function>
+    void forEach(Function function) const
+    {
+        std::apply([&](const auto &...puzzles) { (function(puzzles), ...); }, _puzzles);
+    }
+
+    GameContext &_context;
+    std::tuple<Puzzles &...> _puzzles;
+    unsigned long _stageStart;
+    unsigned long _stageMillis[SOLVED + 1];
+    FinishHandler _onFinish;
+    void *_onFinishArg;
+};
+
+#endif /* PIPELINE_H */
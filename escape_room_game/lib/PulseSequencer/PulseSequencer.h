@@ -0,0 +1,89 @@
+#ifndef PULSE_SEQUENCER_H
+#define PULSE_SEQUENCER_H
+
+#include <Hal.h>
+#include <mutex>
+
+/** @brief One step of a pulse sequence: drive the pin to `level` for `durationMs`. */
+struct Pulse
+{
+    uint8_t level;
+    uint16_t durationMs;
+};
+
+/**
+ * @class PulseSequencer
+ * @brief Plays a fixed sequence of levels on an output pin from a hardware one-shot timer, then leaves it LOW.
+ *
+ * Each edge is written from the timer callback at a deadline computed from the start of the sequence, so the
+ * pulse lengths do not depend on how long a `loop()` pass takes and the error of one edge does not carry over to
+ * the next. `start()` while a sequence is running restarts it from the first step. The callback runs on the esp_timer
+ * task, maybe on the other core, so it and `start()` each hold `_lock` throughout. A callback that already fired
+ * when the sequence restarts either finishes first, and `start()` stops the timer it armed, or waits for `start()`
+ * and then finds the new deadline still ahead, and leaves the sequence alone.
+ *
+ * @tparam NumPulses the number of steps in the sequence
+ */
+template <size_t NumPulses>
+class PulseSequencer
+{
+public:
+    PulseSequencer(const uint8_t pin, const Pulse (&pulses)[NumPulses]) : _pin(pin), _step(NumPulses), _start(0), _armed(0), _timer(onTimer, this)
+    {
+        for (size_t i = 0; i < NumPulses; i++)
+            _pulses[i] = pulses[i];
+    }
+
+    void start()
+    {
+        std::lock_guard<hal::Spinlock> lock(_lock);
+        _timer.stop();
+        _step = 0;
+        _start = hal::esp_timer_get_time();
+        hal::digitalWrite(_pin, _pulses[0].level);
+        _armed = deadline(0);
+        _timer.startAt(_armed);
+    }
+
+    bool running() const { return _step < NumPulses; }
+
+private:
+    // end of step `index`, in esp_timer_get_time() microseconds
+    int64_t deadline(size_t index) const
+    {
+        int64_t end = _start;
+        for (size_t i = 0; i <= index; i++)
+            end += (int64_t)_pulses[i].durationMs * 1000;
+        return end;
+    }
+
+    static void onTimer(void *arg)
+    {
+        PulseSequencer *sequencer = static_cast<PulseSequencer *>(arg);
+        std::lock_guard<hal::Spinlock> lock(sequencer->_lock);
+        if (sequencer->_step >= NumPulses || hal::esp_timer_get_time() < sequencer->_armed)
+            return; // fired for a sequence that has been restarted since
+        const size_t next = sequencer->_step + 1;
+        if (next < NumPulses)
+        {
+            hal::digitalWrite(sequencer->_pin, sequencer->_pulses[next].level);
+            sequencer->_armed = sequencer->deadline(next);
+            sequencer->_timer.startAt(sequencer->_armed);
+        }
+        else
+        {
+            hal::digitalWrite(sequencer->_pin, LOW);
+        }
+        sequencer->_step = next;
+    }
+
+    const uint8_t _pin;
+    Pulse _pulses[NumPulses];
+    volatile size_t _step;
+    int64_t _start;
+    int64_t _armed; // the deadline the timer is set for
+    hal::OneShotTimer _timer;
+    hal::Spinlock _lock;
+};
+
+#endif /* PULSE_SEQUENCER_H */
@@ -0,0 +1,110 @@
+#ifndef REED_BANK_H
+#define REED_BANK_H
+
+#include <Hal.h>
+
+/**
+ * @class ReedLine
+ * @brief Reed switches wired together on one input pin, which reads HIGH once all of them are closed.
+ *
+ * A ReedBank source like hal::ShiftInChain: `read()` has every switch closed or every switch open, because the line
+ * cannot tell which one is still open.
+ */
+class ReedLine
+{
+public:
+    ReedLine(uint8_t pin) : _pin(pin) {}
+
+    void begin() { hal::pinMode(_pin, INPUT_PULLUP); }
+    uint32_t read() { return hal::digitalRead(_pin) == HIGH ? ~0u : 0; }
+
+private:
+    const uint8_t _pin;
+};
+
+/**
+ * @class ReedBank
+ * @brief Debounced states of a bank of reed switches, one bit per switch.
+ *
+ * A scan reads the switches from the `Source`, by default the whole 74HC165 chain in one SPI transaction (see
+ * hal::ShiftInChain), or a ReedLine for switches wired on a single pin, every `scanInterval` milliseconds.
+ * A switch only changes in the stable mask once the last `debounceScans` scans all agree on its new state, which
+ * is worked out for all switches at once: the AND of the recent scans has the switches closed in all of them, the
+ * OR the ones closed in any. A reed that chatters as its magnet passes the edge therefore flips nothing.
+ *
+ * @tparam NumReeds number of switches, up to 32 on four registers
+ * @tparam Source what the switches are read from
+ */
+template <int NumReeds, typename Source = hal::ShiftInChain>
+class ReedBank
+{
+    static_assert(NumReeds >= 1 && NumReeds <= 32, "the switches are kept in a 32 bit mask");
+
+public:
+    static const uint32_t allReeds = NumReeds == 32 ? ~0u : (1u << NumReeds) - 1;
+
+    ReedBank(const Source &source) : _source(source), _next(0), _lastScanTime(0), _scans(0) { reset(); }
+
+    // a chain of as many registers as the switches need
+    static hal::ShiftInChain chain(uint8_t latchPin) { return hal::ShiftInChain(latchPin, (NumReeds + 7) / 8); }
+
+    void setup() { _source.begin(); }
+
+    /**
+     * Forgets what the switches looked like: all of them count as open again until `debounceScans` scans say
+     * otherwise, so a mask left over from the last game cannot carry into the next.
+     */
+    void reset()
+    {
+        _stable = 0;
+        for (int i = 0; i < debounceScans; i++)
+            _recent[i] = 0;
+    }
+
+    /**
+     * Scans the switches if the scan interval elapsed.
+     *
+     * @return True if the debounced states changed with this scan.
+     */
+    bool scan()
+    {
+        const unsigned long currentTime = hal::millis();
+        if (currentTime - _lastScanTime < scanInterval)
+            return false;
+        _lastScanTime = currentTime;
+        _scans++;
+
+        _recent[_next] = _source.read() & allReeds;
+        _next = (_next + 1) % debounceScans;
+        uint32_t closedInAll = allReeds, closedInAny = 0;
+        for (int i = 0; i < debounceScans; i++)
+        {
+            closedInAll &= _recent[i];
+            closedInAny |= _recent[i];
+        }
+
+        const uint32_t stable = closedInAll | (_stable & closedInAny);
+        if (stable == _stable)
+            return false;
+        _stable = stable;
+        return true;
+    }
+
+    // the debounced switches, a set bit for a closed one
+    uint32_t closed() const { return _stable; }
+
+    unsigned long scans() const { return _scans; }
+
+    static const unsigned long scanInterval = 5; // ms
+    static const int debounceScans = 4;
+
+private:
+    Source _source;
+    uint32_t _stable;
+    uint32_t _recent[debounceScans];
+    int _next;
+    unsigned long _lastScanTime;
+    unsigned long _scans;
+};
+
+#endif /* REED_BANK_H */
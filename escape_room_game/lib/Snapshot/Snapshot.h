@@ -0,0 +1,122 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Hal.h>
+#include <SpscQueue.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * @brief What it takes to pick a game up again after a reset: the stage, the clock and every puzzle's state word.
+ */
+struct GameSnapshot
+{
+    static const int maxPuzzles = 4;
+
+    uint32_t magic;
+    uint32_t sequence;
+    uint8_t stage;
+    uint8_t reserved[3];
+    uint16_t gameDuration;        // seconds
+    uint16_t remaining;           // seconds left on the countdown
+    uint16_t puzzles[maxPuzzles]; // see PuzzlePipeline::capture()
+    uint32_t checksum;
+};
+static_assert(sizeof(GameSnapshot) == 28, "snapshots have no padding, so they can be compared and hashed as bytes");
+
+/**
+ * @class SnapshotStore
+ * @brief Keeps the latest GameSnapshot in RTC memory and mirrors it to NVS at a limited rate.
+ *
+ * `save()` is cheap enough to call on every pass of the game loop: it only writes when the snapshot changed, and
+ * then only to RTC memory, which survives every reset but a power-on, and hands the new snapshot over to the network
+ * task. There `handle()` mirrors the newest one to NVS at most every `mirrorInterval`, for the resets that lose RTC
+ * memory; it can be that much behind. An NVS write can take tens of milliseconds, which the game loop never waits
+ * for. When the handoff queue is full, the loop hands the snapshot over again on its next pass.
+ *
+ * `load()` prefers RTC memory. The NVS copy is only used after a reset that was not a power-on (brownout, watchdog,
+ * panic, reset button): a room switched off in the middle of a game starts a new one when it is switched back on.
+ */
+class SnapshotStore
+{
+public:
+    static const uint32_t magic = 0x45534331; // "ESC1"
+    static const unsigned long mirrorInterval = 5000;
+    static const uint8_t powerOnReset = 1; // ESP_RST_POWERON
+    static_assert(sizeof(GameSnapshot) <= hal::rtcMemorySize, "the snapshot must fit in the reserved RTC memory");
+
+    SnapshotStore() : _current(), _handedOver(true), _mirror(), _mirrored(true), _lastMirrorTime(0) {}
+
+    bool load(uint8_t resetReason, GameSnapshot &snapshot)
+    {
+        memcpy(&snapshot, hal::rtcMemory(), sizeof(snapshot));
+        bool found = valid(snapshot);
+        if (!found && resetReason != powerOnReset)
+            found = hal::storageRead(storageKey, &snapshot, sizeof(snapshot)) == sizeof(snapshot) && valid(snapshot);
+        if (found)
+            _current = snapshot;
+        return found;
+    }
+
+    void save(GameSnapshot snapshot)
+    {
+        snapshot.magic = magic;
+        snapshot.sequence = _current.sequence;
+        snapshot.checksum = _current.checksum;
+        if (memcmp(&snapshot, &_current, sizeof(snapshot)) != 0)
+        {
+            snapshot.sequence++;
+            snapshot.checksum = checksum(snapshot);
+            _current = snapshot;
+            memcpy(hal::rtcMemory(), &_current, sizeof(_current));
+            _handedOver = false;
+        }
+        if (!_handedOver)
+            _handedOver = _handoff.push(_current);
+    }
+
+    // network task side: mirrors the newest snapshot handed over to NVS when it is due
+    void handle()
+    {
+        GameSnapshot snapshot;
+        while (_handoff.pop(snapshot))
+        {
+            _mirror = snapshot;
+            _mirrored = false;
+        }
+        const unsigned long currentTime = hal::millis();
+        if (_mirrored || currentTime - _lastMirrorTime < mirrorInterval)
+            return;
+        hal::storageWrite(storageKey, &_mirror, sizeof(_mirror));
+        _lastMirrorTime = currentTime;
+        _mirrored = true;
+    }
+
+    uint32_t sequence() const { return _current.sequence; }
+
+private:
+    static constexpr const char *storageKey = "snapshot";
+
+    // FNV-1a over everything but the checksum itself
+    static uint32_t checksum(const GameSnapshot &snapshot)
+    {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&snapshot);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < offsetof(GameSnapshot, checksum); i++)
+            hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+
+    static bool valid(const GameSnapshot &snapshot) { return snapshot.magic == magic && snapshot.checksum == checksum(snapshot); }
+
+    // game loop side
+    GameSnapshot _current;
+    bool _handedOver;
+    SpscQueue<GameSnapshot, 4> _handoff;
+    // network task side
+    GameSnapshot _mirror;
+    bool _mirrored;
+    unsigned long _lastMirrorTime;
+};
+
+#endif /* SNAPSHOT_H */
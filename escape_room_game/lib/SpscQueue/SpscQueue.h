@@ -0,0 +1,72 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @class SpscQueue
+ * @brief Bounded lock-free queue between exactly one producer and one consumer, e.g. two tasks on different cores.
+ *
+ * The producer only writes `_head` and the consumer only writes `_tail`. A slot is filled before `_head` is
+ * released and read before `_tail` is released, so neither side ever waits on the other. A push into a full queue
+ * fails and is counted instead of blocking the producer.
+ *
+ * @tparam T trivially copyable element
+ * @tparam Capacity number of slots, a power of two
+ */
+template <typename T, uint32_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "the capacity must be a power of two");
+
+public:
+    SpscQueue() : _head(0), _tail(0), _dropped(0), _peak(0) {}
+
+    // producer side
+    bool push(const T &item)
+    {
+        const uint32_t head = _head.load(std::memory_order_relaxed);
+        const uint32_t used = head - _tail.load(std::memory_order_acquire);
+        if (used >= Capacity)
+        {
+            _dropped++;
+            return false;
+        }
+        _items[head & (Capacity - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        if (used + 1 > _peak)
+            _peak = used + 1;
+        return true;
+    }
+
+    // producer side
+    uint32_t space() const { return Capacity - (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire)); }
+
+    // consumer side
+    bool pop(T &item)
+    {
+        const uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+        item = _items[tail & (Capacity - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // producer side counters
+    unsigned long dropped() const { return _dropped; }
+    uint32_t peak() const { return _peak; }
+
+    static const uint32_t capacity = Capacity;
+
+private:
+    T _items[Capacity];
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _tail;
+    unsigned long _dropped;
+    uint32_t _peak;
+};
+
+#endif /* SPSC_QUEUE_H */
@@ -1,7 +1,7 @@
 #ifndef STARS_H
 #define STARS_H
 
-#include "globals.h"
+#include "GameContext.h"
 #include "utils.h"
 #include <Compartment.h>
 
@@ -10,96 +10,66 @@
  * @brief Represents a puzzle in an escape room game.
  * 
  * The Stars class is responsible for managing the puzzle related to stars in an escape room game.
- * It handles the setup, reset, hint, solve, blinkStars, displayPasscodeLeds, and play functions.
+ * It handles the setup, reset, hint, solve, displayPasscodeLeds, and play functions.
  * The class also maintains the state of the puzzle, including the solve time, whether it is solved, whether a hint has been given,
  * whether the correct passcode has been entered, the state of blinking the keypad and stars, and the input string for the passcode.
- * The Stars class uses the ws2812b library to control the color of the stars and keypad LEDs.
- * It also interacts with an MQTT client to publish messages when the puzzle is solved.
+ * The Stars class writes the color of the keypad LEDs into the `keypadLeds` segment, and chases the stars across
+ * the `starLeds` segment with an Animation: one star at a time lights up, and a hint makes the chase four times faster.
  */
 class Stars
 {
 public:
-    Stars() : _hintGiven(false),
-              _correctPasscode(false),
-              _blinkKeypadState(false),
-              _starsBlinkInterval(1000),
-              _lastBlinkStarsTime(0),
-              _blinkStarsledNum(0),
-              _blinkStars(false),
-              _blinkPause(0),
-              compartment(_relayPin)
+    static const stage id = STARS;
+    static constexpr const char *name = "stars";
+    static constexpr const char *solvedMessage = STARS_SOLVE;
+
+    Stars(GameContext &context) : _context(context),
+                                  _hintGiven(false),
+                                  _correctPasscode(false),
+                                  _blinkKeypadState(false),
+                                  _starChase(context.animator, context.starLeds),
+                                  compartment(context, _relayPin)
     {
     }
     void setup()
     {
-        pinMode(_relayPin, OUTPUT);
-        digitalWrite(_relayPin, LOW);
+        hal::pinMode(_relayPin, OUTPUT);
+        hal::digitalWrite(_relayPin, LOW);
+        _starChase.start(_chase, ~0u, 2 * _chaseTickMs);
     }
 
     void reset()
     {
+        inputString = "";
         _correctPasscode = false;
         _blinkKeypadState = false;
         _hintGiven = false;
-        _starsBlinkInterval = 1000;
+        _starChase.start(_chase, ~0u, 2 * _chaseTickMs);
     }
 
     void hint()
     {
         _hintGiven = true;
-        _starsBlinkInterval = 250;
+        _starChase.start(_hintChase, ~0u, 2 * _hintChaseTickMs);
     }
 
-    /**
-     * Solves the puzzle and triggers the corresponding actions.
-     * If the puzzle is not yet solved, it sets the solve time, marks it as solved, and activates the relay pin.
-     * If the puzzle is already solved and the time since the last solve is greater than or equal to 1000 milliseconds,
-     * it updates the solve time, deactivates the relay pin, sets the current stage to SOLVED, and publishes a message to the MQTT client.
-     */
-    void solve()
+    // whether a hint was given, for the game snapshot; a passcode being typed is not kept
+    uint16_t snapshot() const { return _hintGiven; }
+
+    void resume(uint16_t state)
     {
-        if (currentStage != STARS)
-            return;
-        compartment.open();
-        currentStage = SOLVED;
-        mqttClient->publish(ESP_TOPIC, STARS_SOLVE);
+        if (state)
+            hint();
     }
 
     /**
-     * @brief Function to blink the stars.
-     * 
-     * This function blinks the stars by changing their color. It uses the ws2812b library to set the color of the stars.
-     * The stars blink at a specific interval defined by _starsBlinkInterval.
-     * 
-     * @note This function requires the ws2812b library to be included.
+     * Called when the admin panel solves the puzzle: stops the keypad feedback of a passcode in progress.
      */
-    void blinkStars()
+    void solve()
     {
-        unsigned long currentTime = millis();
-        const float colorLow = 0.1;
-        if (currentTime - _lastBlinkStarsTime >= _starsBlinkInterval)
-        {
-            _lastBlinkStarsTime = currentTime;
-            if (_blinkPause < 8)
-            {
-                if (_blinkStars)
-                {
-                    ws2812b.setPixelColor(_blinkingStars[_blinkStarsledNum], ws2812b.Color(245 * colorLow, 100 * colorLow, 10 * colorLow)); // it only takes effect if pixels.show() is called
-                    _blinkStarsledNum = (_blinkStarsledNum + 1) % 4;
-                }
-                else
-                {
-                    ws2812b.setPixelColor(_blinkingStars[_blinkStarsledNum], ws2812b.Color(245, 100, 10)); // it only takes effect if pixels.show() is called
-                }
-                ws2812b.show();
-                _blinkStars = !_blinkStars;
-                _blinkPause++;
-            }
-            else
-            {
-                _blinkPause = 0;
-            }
-        }
+        _blinkKeypadState = false;
+        _context.keypadAnimation.stop();
+        utils::setKeyPadLEDColors(_context, 0, 0, 0);
     }
 
     /**
@@ -113,13 +83,12 @@ public:
         {
             if (i < inputLen)
             {
-                ws2812b.setPixelColor(keypadLeds[i], ws2812b.Color(25, 0, 0)); // it only takes effect if pixels.show() is called
+                _context.keypadLeds.set(i, LedFrame::Color(25, 0, 0));
             }
             else
             {
-                ws2812b.setPixelColor(keypadLeds[i], ws2812b.Color(0, 0, 0)); // it only takes effect if pixels.show() is called
+                _context.keypadLeds.set(i, LedFrame::Color(0, 0, 0));
             }
-            ws2812b.show();
         }
     }
 
@@ -127,73 +96,69 @@ public:
      * @brief Plays the game by handling keypad input and checking the passcode.
      * 
      * This function is responsible for handling keypad input and checking the passcode entered by the user.
-     * It takes the input from the keypad and updates the passcode accordingly.
+     * It takes the key presses queued by the keypad driver and updates the passcode accordingly. While the keypad
+     * blinks, the presses stay queued and are taken afterwards.
      * If the passcode length reaches 4, it checks if the entered passcode matches the correct solution.
      * If the passcode is correct, it sets the `_correctPasscode` flag to true.
      * If the passcode is incorrect, it resets the input string.
      * The function also handles blinking the keypad LEDs based on the `_blinkKeypadState` flag.
-     * If the passcode is correct or the game is already solved, it calls the `solve()` function.
+     * Once the keypad stopped blinking after the correct passcode, the puzzle is reported as solved.
      * 
-     * @note This function assumes that the `keypad` object and `starSolution` string are properly initialized.
+     * @note This function assumes that the `keypadDriver` object and `starSolution` string are properly initialized.
+     *
+     * @return True once the correct passcode was entered.
      */
-    void play()
+    bool play()
     {
-        char keys[] = "123 456 789 *0# N";
-        uint8_t index = keypad.getKey();
-        unsigned long currentTime = millis();
-
-        if (!_blinkKeypadState && currentTime - keypadLastDebounceTime > 50)
+        KeyEvent event;
+        while (!_blinkKeypadState && !_correctPasscode && _context.keypadDriver.nextEvent(event))
         {
-            if (keys[prevKeyIndex] == 'N' && keys[index] != 'N')
-            { // N = Not pressed
-                char key = keys[index];
-                if (key)
+            if (!event.pressed)
+                continue;
+            _context.journal.log(EVENT_KEY, event.key);
+            inputString += event.key;
+            displayPasscodeLeds(inputString.length());
+            if (inputString.length() >= 4)
+            {
+                _blinkKeypadState = true;
+                if (inputString == starSolution)
                 {
-                    inputString += key;
-                    displayPasscodeLeds(inputString.length());
+                    _correctPasscode = true;
                 }
-                if (inputString.length() >= 4)
+                else
                 {
-                    _blinkKeypadState = true;
-                    if (inputString == starSolution)
-                    {
-                        _correctPasscode = true;
-                    }
-                    else
-                    {
-                        inputString = "";
-                    }
+                    inputString = "";
                 }
+                utils::blinkKeypadLeds(_context, _correctPasscode);
             }
-            keypadLastDebounceTime = currentTime;
-            prevKeyIndex = index;
         }
 
         if (_blinkKeypadState)
         {
-            _blinkKeypadState = utils::blinkKeypadLeds(_correctPasscode);
-        }
-        else if (_correctPasscode)
-        {
-            solve();
+            _blinkKeypadState = _context.keypadAnimation.running();
+            return false;
         }
+        return _correctPasscode;
     }
 
 private:
+    GameContext &_context;
     bool _hintGiven;
 
     bool _correctPasscode;
     bool _blinkKeypadState;
 
-    unsigned long _starsBlinkInterval;
-    unsigned long _lastBlinkStarsTime;
-    int _blinkStarsledNum;
-    bool _blinkStars;
-    int _blinkPause;
+    // each star lights up for a tick, two ticks after the one before it, and the round ends with a dark tick
+    static const uint16_t _chaseTickMs = 1000;
+    static const uint16_t _hintChaseTickMs = 250;
+    static constexpr uint32_t _starColor = animations::rgb(245, 100, 10);
+    static constexpr uint32_t _starRestColor = animations::rgb(245 * 0.1, 100 * 0.1, 10 * 0.1);
+    static constexpr auto _chase = animations::chase<_chaseTickMs, 2 * numStarLeds + 1>(_starColor, _starRestColor);
+    static constexpr auto _hintChase = animations::chase<_hintChaseTickMs, 2 * numStarLeds + 1>(_starColor, _starRestColor);
+    Animation _starChase;
 
-    String inputString;
-    const String starSolution = "7031";
-    const int _blinkingStars[4] = {16, 17, 18, 19};
+    std::string inputString;
+    const std::string starSolution = "7031";
     const byte _relayPin = 14;
 public:
     Compartment compartment;
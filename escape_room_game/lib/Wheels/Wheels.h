@@ -1,69 +1,166 @@
 #ifndef WHEELS_H
 #define WHEELS_H
 
-#include "globals.h"
+#include "GameContext.h"
 #include <Compartment.h>
+#include <ReedBank.h>
 
+/**
+ * @class Wheels
+ * @brief The constellation wheels: solved once every wheel is turned to its constellation.
+ *
+ * Each wheel has a reed switch that its magnet closes at the solution. The reeds are read together through a
+ * ReedBank, and the debounced mask is compared with the solution mask, so the puzzle knows which wheels are still
+ * wrong. Whenever that changes during the stage, the progress is published on ESP_WHEELS_TOPIC, e.g.
+ * `aligned=5/7 reeds=1101101` (wheel 1 first), and journaled. The hint flashes the hint LED once per wheel up to
+ * the first misaligned one, e.g. three times for wheel 3, and follows along as the players turn the wheels.
+ *
+ * That takes the 74HC165 chain (-DWHEELS_REED_CHAIN). With the original wiring, all reeds on one line, the puzzle
+ * only knows whether every wheel is aligned: nothing is published until it is solved, and the hint lights the LED.
+ */
 class Wheels
 {
 public:
-    Wheels() : _hintGiven(false), compartment(_relayPin) {}
+#ifdef WHEELS_REED_CHAIN
+    typedef ReedBank<numWheels> Reeds;
+    static const bool perWheel = true;
+#else
+    typedef ReedBank<numWheels, ReedLine> Reeds;
+    static const bool perWheel = false;
+#endif
+
+    static const stage id = WHEELS;
+    static constexpr const char *name = "wheels";
+    static constexpr const char *solvedMessage = WHEELS_SOLVE;
+
+    Wheels(GameContext &context) : _context(context),
+                                   _hintGiven(false),
+                                   _hintWheel(-1),
+                                   _reported(~0u),
+                                   _hintPulse(context.animator, context.wheelsHintLed),
+#ifdef WHEELS_REED_CHAIN
+                                   _reeds(Reeds::chain(wheelReedsLatchPin)),
+#else
+                                   _reeds(ReedLine(wheelsLinePin)),
+#endif
+                                   compartment(context, _relayPin)
+    {
+    }
     void setup()
     {
-        pinMode(_puzzlePin, INPUT_PULLUP);
+        _reeds.setup();
 
-        pinMode(_relayPin, OUTPUT);
-        digitalWrite(_relayPin, LOW);
+        hal::pinMode(_relayPin, OUTPUT);
+        hal::digitalWrite(_relayPin, LOW);
 
         // Set hint LED
-        ws2812b.setPixelColor(_hintLedIndex, ws2812b.Color(0, 0, 0));
-        ws2812b.show();
+        _context.wheelsHintLed.set(0, LedFrame::Color(0, 0, 0));
     }
 
     void reset()
     {
         _hintGiven = false;
-        ws2812b.setPixelColor(_hintLedIndex, ws2812b.Color(0, 0, 0));
-        ws2812b.show();
+        _hintWheel = -1;
+        _reported = ~0u;
+        _reeds.reset(); // the wheels are scrambled for the next game while nobody scans them
+        _hintPulse.stop();
+        _context.wheelsHintLed.set(0, LedFrame::Color(0, 0, 0));
     }
 
-    void play()
+    /**
+     * @return True once all wheels are aligned.
+     */
+    bool play()
     {
-        if (digitalRead(_puzzlePin) == HIGH)
+        _reeds.scan();
+        const uint32_t wrong = misaligned();
+        if (wrong != _reported && perWheel)
         {
-            solve();
+            _reported = wrong;
+            reportProgress();
+            if (_hintGiven)
+                showHint();
         }
+        return wrong == 0;
     }
 
     void hint()
     {
-        ws2812b.setPixelColor(_hintLedIndex, ws2812b.Color(0, 200, 255));
-        ws2812b.show();
         _hintGiven = true;
+        _hintWheel = -1;
+        showHint();
+    }
+
+    // a set bit for every wheel that is not at its constellation
+    uint32_t misaligned() const { return (_reeds.closed() ^ _solution) & Reeds::allReeds; }
+
+    // whether a hint was given, for the game snapshot
+    uint16_t snapshot() const { return _hintGiven; }
+
+    void resume(uint16_t state)
+    {
+        if (state)
+            hint();
     }
 
     /**
-     * Solves the puzzle by activating the wheels.
-     * If the puzzle has not been solved yet, it sets the solve time, marks the puzzle as solved,
-     * and activates the relay pin.
-     * If the puzzle has already been solved and the time since the last solve is greater than or equal to 1000 milliseconds,
-     * it updates the solve time, deactivates the relay pin, sets the current stage to FUEL,
-     * and publishes a message to the MQTT topic.
+     * Called when the admin panel solves the puzzle. The wheels are physical, so there is nothing to undo;
+     * the pipeline opens the compartment and moves on.
      */
     void solve()
     {
-        if (currentStage != WHEELS)
-            return;
-        compartment.open();
-        currentStage = FUEL;
-        mqttClient->publish(ESP_TOPIC, WHEELS_SOLVE);
     }
 
 private:
+    void reportProgress()
+    {
+        const uint32_t wrong = _reported;
+        const int aligned = numWheels - __builtin_popcount(wrong);
+        char progress[32 + numWheels];
+        int length = snprintf(progress, sizeof(progress), "aligned=%d/%d reeds=", aligned, numWheels);
+        for (int wheel = 0; wheel < numWheels; wheel++)
+            progress[length++] = wrong & (1u << wheel) ? '0' : '1';
+        progress[length] = '\0';
+        _context.publish(ESP_WHEELS_TOPIC, progress);
+        _context.journal.log(EVENT_WHEELS, aligned, (uint16_t)(_reeds.closed() & 0xFFFF));
+    }
+
+    // flashes the number of the first misaligned wheel; while all of them look aligned, the LED breathes
+    void showHint()
+    {
+        if (!perWheel)
+        {
+            _context.wheelsHintLed.set(0, _hintColor);
+            return;
+        }
+        const int wheel = _reported != 0 && _reported != ~0u ? __builtin_ctz(_reported) : -1;
+        if (wheel == _hintWheel && _hintPulse.running())
+            return;
+        _hintWheel = wheel;
+        if (wheel < 0)
+        {
+            _hintPulse.start(_hintBreathing);
+            return;
+        }
+        _hintPulse.start(_hintFlashes[wheel]);
+    }
+
+    GameContext &_context;
     bool _hintGiven;
+    int _hintWheel;     // the wheel the hint LED points at, -1 for none
+    uint32_t _reported; // misaligned wheels as last published, ~0 for none yet
+    // the hint LED shows cyan until the next game
+    static constexpr uint32_t _hintColor = animations::rgb(0, 200, 255);
+    static constexpr auto _hintBreathing = animations::pulse<2000>(_hintColor, 0.3);
+    static const uint32_t _hintFlashMs = 200;
+    static const uint32_t _hintPeriodMs = 2 * _hintFlashMs * numWheels + 1200;
+    // the clip for wheel `w` flashes w + 1 times
+    static constexpr auto _hintFlashes = animations::countedFlashes<_hintFlashMs, _hintFlashMs, _hintPeriodMs, numWheels>(_hintColor);
+    Animation _hintPulse;
+    // the reed of every wheel closes at its constellation
+    static const uint32_t _solution = Reeds::allReeds;
+    Reeds _reeds;
     const byte _relayPin = 13;
-    const byte _puzzlePin = 15;
-    const int _hintLedIndex = 20;
 public:
     Compartment compartment;
 };
@@ -0,0 +1,294 @@
+/**
+ * @brief Host micro-benchmarks (`[env:native_bench]`).
+ *
+ * Runs the hot paths of the firmware in tight loops against the simulated HAL: the fuel and star puzzles, the LED
+ * animations, admin command dispatch (`callback()`, plus the compile-time command table against the previous
+ * `std::string` + substring-scan chain) and the countdown display. For each one it reports ns per operation, heap
+ * allocations per operation and the simulated I/O per operation: GPIO reads, I2C transactions and strip `show()`s.
+ *
+ * The benchmarks drive the Room of main.cpp, which is compiled into this file, and reach into its puzzles.
+ * Operations that depend on time advance the virtual clock by a fixed step each, and `clock step` measures what
+ * that step costs on its own.
+ *
+ * `program --json > results.json` writes the results as JSON, one benchmark per line, and
+ * `program --baseline results.json` compares a run against such a file.
+ */
+#include "../main.cpp"
+#include "scenario.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    if (void *p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+// not inlined, or GCC takes the free() for a mismatch with the new in the standard containers it inlines
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace
+{
+    volatile unsigned sink = 0;
+
+    struct Result
+    {
+        std::string name;
+        unsigned long ops;
+        double nsPerOp;
+        double allocsPerOp;
+        double pinReadsPerOp;
+        double i2cPerOp;
+        double spiPerOp;
+        double showsPerOp;
+    };
+    std::vector<Result> results;
+
+    /**
+     * Runs `op` `ops` times after a short warm-up, advancing the virtual clock by `stepMicros` before each run,
+     * and records the cost per run.
+     */
+    template <typename Op>
+    void bench(const char *name, unsigned long ops, int64_t stepMicros, Op op)
+    {
+        for (unsigned long i = 0; i < ops / 10; i++)
+        {
+            hal::sim::advanceMicros(stepMicros);
+            op();
+        }
+
+        const unsigned long allocationsBefore = allocations;
+        const unsigned long pinReadsBefore = hal::sim::pinReads;
+        const unsigned long i2cBefore = hal::sim::i2cTransactions;
+        const unsigned long spiBefore = hal::sim::spiTransactions;
+        const unsigned long showsBefore = hal::sim::framesShown;
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < ops; i++)
+        {
+            hal::sim::advanceMicros(stepMicros);
+            op();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        results.push_back({name, ops, seconds * 1e9 / ops, (double)(allocations - allocationsBefore) / ops,
+                           (double)(hal::sim::pinReads - pinReadsBefore) / ops, (double)(hal::sim::i2cTransactions - i2cBefore) / ops,
+                           (double)(hal::sim::spiTransactions - spiBefore) / ops, (double)(hal::sim::framesShown - showsBefore) / ops});
+    }
+
+    // what callback() did before the command table
+    adminCommand legacyLookup(const uint8_t *payload, unsigned int length)
+    {
+        const std::string payloadString((const char *)payload, length);
+        for (int i = 0; i < NUM_COMMANDS; i++)
+        {
+            if (payloadString.find(commands::table[i].name) != std::string::npos)
+                return (adminCommand)i;
+        }
+        return CMD_UNKNOWN;
+    }
+
+    std::vector<std::string> adminPayloads()
+    {
+        std::vector<std::string> payloads;
+        for (const commands::Entry &entry : commands::table)
+            payloads.push_back(entry.name);
+        // long enough to defeat the small string optimisation of the legacy path, like most real payloads
+        payloads.push_back("unknown_admin_command");
+        payloads.push_back("fuel_hint_and_more_text");
+        payloads.push_back("x");
+        return payloads;
+    }
+
+    void drainQueues()
+    {
+        NetEvent event;
+        while (room.netEvents.pop(event))
+        {
+        }
+        OutboundMessage message;
+        while (room.outbound.pop(message))
+        {
+        }
+    }
+
+    // a game in the fuel stage, with the countdown running and nobody touching anything
+    void enterFuelStage()
+    {
+        uint16_t states[GameSnapshot::maxPuzzles] = {};
+        room.pipeline.capture(states);
+        room.pipeline.resume(FUEL, states);
+        room.timerCountDown.start(room.gameDuration);
+        drainQueues();
+    }
+
+    void runAll()
+    {
+        setup();
+        drainQueues();
+        enterFuelStage();
+
+        bench("clock step 1ms", 2000000, 1000, [] {});
+
+        // a reed that chatters every millisecond never gets through the debouncing, so nothing is published
+        bench("wheels.play chattering reed", 2000000, 1000, []
+              {
+                  hal::sim::shiftInputs ^= 1;
+                  sink += room.pipeline.puzzle<Wheels>().play();
+              });
+        hal::sim::shiftInputs = 0;
+
+        bench("fuel.play idle", 2000000, 1000, [] { sink += room.pipeline.puzzle<Fuel>().play(); });
+        hal::sim::linkPins(scenario::fillingPins[1], scenario::fillingPins[0]); // a hose from tank 0 to tank 1
+        bench("fuel.play hose plugged", 2000000, 1000, [] { sink += room.pipeline.puzzle<Fuel>().play(); });
+        hal::sim::unlinkPin(scenario::fillingPins[0]);
+        bench("fuel.updateDisplay", 2000000, 0, [] { room.pipeline.puzzle<Fuel>().updateDisplay(); });
+
+        bench("stars.play idle", 5000000, 0, [] { sink += room.pipeline.puzzle<Stars>().play(); });
+        bench("animator.update star chase", 200000, animations::frameMs * 1000, [] { room.animator.update(); });
+        bench("leds.flush", 200000, 0, []
+              {
+                  room.starLeds.set(0, sink++);
+                  room.leds.flush();
+              });
+
+        const std::vector<std::string> payloads = adminPayloads();
+        size_t next = 0;
+        bench("callback dispatch", 2000000, 0, [&]
+              {
+                  const std::string &payload = payloads[next++ % payloads.size()];
+                  room.callback((char *)"admin", (byte *)payload.data(), payload.size());
+                  NetEvent event;
+                  while (room.netEvents.pop(event))
+                      sink += event.value;
+              });
+        bench("command table lookup", 2000000, 0, [&]
+              {
+                  const std::string &payload = payloads[next++ % payloads.size()];
+                  sink += commands::lookup((const uint8_t *)payload.data(), payload.size());
+              });
+        bench("string + find chain lookup", 2000000, 0, [&]
+              {
+                  const std::string &payload = payloads[next++ % payloads.size()];
+                  sink += legacyLookup((const uint8_t *)payload.data(), payload.size());
+              });
+
+        uint32_t seconds = 0;
+        bench("formatTime", 5000000, 0, [&]
+              {
+                  seconds = (seconds + 1) % 900;
+                  char text[Room::timeTextSize];
+                  Room::formatTime(seconds / 60, seconds % 60, text);
+                  sink += text[4];
+              });
+        // the countdown through the network task's outbox: a new value every call, most of them held and coalesced
+        Outbox outbox;
+        outbox.setPolicy(ESP_TIMER_TOPIC, 500, 0);
+        OutboundMessage tick;
+        unsigned long now = 0;
+        bench("outbox offer", 2000000, 0, [&]
+              {
+                  seconds = (seconds + 1) % 900;
+                  Room::formatTime(seconds / 60, seconds % 60, tick.payload);
+                  tick.topic = ESP_TIMER_TOPIC;
+                  now += 10;
+                  sink += outbox.offer(tick, now) + outbox.nextDue(tick, now);
+              });
+        bench("displayRemainingTime", 2000000, 1000, []
+              {
+                  room.displayRemainingTime();
+                  drainQueues();
+              });
+
+        bench("loop pass fuel stage", 500000, 1000, []
+              {
+                  loop();
+                  drainQueues();
+              });
+    }
+
+    // {"name": ..., "ns_per_op": ...} pairs from a file written by --json
+    std::map<std::string, double> readBaseline(const char *path)
+    {
+        std::map<std::string, double> baseline;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            const size_t name = line.find("\"name\": \"");
+            const size_t ns = line.find("\"ns_per_op\": ");
+            if (name == std::string::npos || ns == std::string::npos)
+                continue;
+            const size_t nameStart = name + 9;
+            baseline[line.substr(nameStart, line.find('"', nameStart) - nameStart)] = atof(line.c_str() + ns + 13);
+        }
+        return baseline;
+    }
+
+    void printJson()
+    {
+        printf("{\n  \"suite\": \"escape_room_game native_bench\",\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &r = results[i];
+            printf("    {\"name\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, \"pin_reads_per_op\": %.3f, "
+                   "\"i2c_per_op\": %.3f, \"spi_per_op\": %.3f, \"shows_per_op\": %.3f}%s\n",
+                   r.name.c_str(), r.ops, r.nsPerOp, r.allocsPerOp, r.pinReadsPerOp, r.i2cPerOp, r.spiPerOp, r.showsPerOp, i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    }
+
+    void printTable(const std::map<std::string, double> &baseline)
+    {
+        printf("%-28s %10s %9s %9s %9s %9s %9s%s\n", "benchmark", "ns/op", "allocs", "pin rd", "i2c", "spi", "show", baseline.empty() ? "" : "  vs baseline");
+        for (const Result &r : results)
+        {
+            printf("%-28s %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f", r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.pinReadsPerOp, r.i2cPerOp, r.spiPerOp,
+                   r.showsPerOp);
+            auto before = baseline.find(r.name);
+            if (before != baseline.end() && before->second > 0)
+                printf("  %+6.1f%%", (r.nsPerOp / before->second - 1) * 100);
+            printf("\n");
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    std::map<std::string, double> baseline;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline = readBaseline(argv[++i]);
+    }
+
+    for (const std::string &payload : adminPayloads())
+    {
+        adminCommand fast = commands::lookup((const uint8_t *)payload.data(), payload.size());
+        adminCommand legacy = legacyLookup((const uint8_t *)payload.data(), payload.size());
+        if (fast != legacy && payload != "fuel_hint_and_more_text")
+        {
+            fprintf(stderr, "mismatch on '%s'\n", payload.c_str());
+            return 1;
+        }
+    }
+
+    runAll();
+    if (json)
+        printJson();
+    else
+        printTable(baseline);
+    return 0;
+}
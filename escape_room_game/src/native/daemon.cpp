@@ -0,0 +1,630 @@
+/**
+ * @brief Multi-room controller daemon (`[env:native_daemon]`, Linux).
+ *
+ * Runs the game logic of many rooms on one host, while each room only has an I/O node (src/node/): an ESP32 that
+ * streams its inputs and drives its outputs over the protocol in lib/IoLink/IoLink.h. Changing a puzzle means
+ * restarting the daemon instead of reflashing every room.
+ *
+ * Every room is the unchanged Room of the firmware on a simulated board (lib/Hal/HalNative.h) that mirrors its node:
+ * the levels, keypad key and hose links the node reports are applied to the virtual pins, and whatever the game
+ * drives there (relays, pixels, the timer display) is sent back. The rooms are spread over a pool of worker threads.
+ * A worker runs an event loop: it waits for its nodes' sockets until the next tick, and every tick gives each of its
+ * rooms a turn, with that room's board swapped in: take the node's frames, advance the room's clock to the wall
+ * clock, one `loop()` pass unless the room sleeps (see Room::idle) and one pass of its network task, send what changed.
+ *
+ *     .pio/build/native_daemon/program --rooms 24 --workers 2 [--broker 127.0.0.1]
+ *
+ * Nodes connect to port 7300 and say which room they are in their HELLO frame. A room without a node keeps running
+ * with its inputs idle. With `--broker` every room is bridged to a real MQTT broker under its own client ID
+ * (`room<i>`) and topic prefix (`room<i>/`), as in the load generator; without it the rooms talk to their virtual
+ * broker only. Every `--report` seconds each worker prints how busy it was and, per room, the turn latency
+ * (p50/p99/max in microseconds), the ticks it missed and the frames to and from its node.
+ *
+ * `.pio/build/native_iosim/program` plays games through simulated nodes against it on the same machine.
+ */
+#include "../../include/Room.h"
+#include "mqtt_socket.h"
+#include <IoLink.h>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct Options
+    {
+        int rooms = 8;
+        int workers = std::max(1u, std::thread::hardware_concurrency());
+        uint16_t port = iolink::port;
+        unsigned tickMicros = 1000;
+        unsigned reportSeconds = 10;
+        std::string broker;
+        uint16_t brokerPort = 1883;
+    };
+
+    std::atomic<bool> running(true);
+    std::mutex printLock;
+    Clock::time_point daemonStart;
+
+    int64_t microsSince(Clock::time_point start) { return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count(); }
+
+    /**
+     * @brief One room: its firmware, its board while it is not its turn, and the connection to its node.
+     */
+    struct RoomSlot
+    {
+        int number = 0;
+        std::unique_ptr<Room> room;
+        hal::sim::Board board;
+
+        // the node, -1 while none is connected
+        int node = -1;
+        iolink::Decoder decoder;
+        std::string inbox;
+        std::string outbox;
+
+        // what the node was told last, so only changes go out
+        bool configured = false;
+        uint64_t configuredScanned = 0;
+        uint8_t configuredModes[iolink::numPins] = {};
+        int8_t sentLevels[iolink::numPins] = {};
+        std::vector<uint32_t> sentPixels;
+        int sentMinute = -1;
+        int sentSecond = -1;
+
+        // the bridge to a real broker, with --broker
+        std::unique_ptr<MqttSocket> mqtt;
+        std::string prefix;
+
+        // since the last report
+        LatencyHistogram turns;
+        unsigned long framesIn = 0;
+        unsigned long framesOut = 0;
+
+        // a new node gets the whole state, not only what changed
+        void attach(int fd)
+        {
+            if (node >= 0)
+                ::close(node);
+            node = fd;
+            inbox.clear();
+            outbox.clear();
+            decoder = iolink::Decoder();
+            configured = false;
+            std::fill(std::begin(sentLevels), std::end(sentLevels), -1);
+            sentPixels.clear();
+            sentMinute = sentSecond = -1;
+        }
+
+        void detach()
+        {
+            if (node >= 0)
+                ::close(node);
+            node = -1;
+        }
+
+        void send(uint8_t type, const uint8_t *payload, size_t length)
+        {
+            uint8_t frame[iolink::maxFrame];
+            outbox.append((const char *)frame, iolink::encode(frame, type, payload, length));
+            framesOut++;
+        }
+    };
+
+    bool isInput(uint8_t mode) { return mode == INPUT || mode == INPUT_PULLUP; }
+
+    // the pins the node leaves alone: the keypad's INT line, which the node reads itself, and the strip's data line
+    bool nodeOwned(int pin) { return nodeOwnedPins & (1ull << pin); }
+
+    // NODE -> ROOM, during the room's turn
+    void applyFrame(RoomSlot &slot, const iolink::Decoder &frame)
+    {
+        slot.framesIn++;
+        switch (frame.type())
+        {
+        case iolink::FRAME_INPUTS:
+        {
+            if (frame.length() < iolink::inputsSize)
+                break;
+            const uint64_t levels = iolink::getPinSet(frame.payload());
+            for (int pin = 0; pin < iolink::numPins; pin++)
+            {
+                const int level = (levels >> pin) & 1;
+                const bool nodeReads = slot.configured && isInput(slot.configuredModes[pin]) && !(slot.configuredScanned & (1ull << pin)) && !nodeOwned(pin);
+                if (nodeReads && hal::sim::pins[pin].forcedLevel != level)
+                    hal::sim::setPin(pin, level);
+            }
+            hal::sim::changeKey(frame.payload()[iolink::pinSetSize]);
+            hal::sim::shiftInputs = iolink::getUint32(frame.payload() + iolink::pinSetSize + 1);
+            break;
+        }
+        case iolink::FRAME_LINKS:
+        {
+            for (int pin = 0; pin < iolink::numPins; pin++)
+            {
+                if (hal::sim::scannedPins & (1ull << pin))
+                    hal::sim::unlinkPin(pin);
+            }
+            for (int i = 0; i + 1 < frame.length(); i += 2)
+            {
+                const uint8_t driven = frame.payload()[i];
+                const uint8_t pulled = frame.payload()[i + 1];
+                if (driven < iolink::numPins && pulled < iolink::numPins)
+                    hal::sim::linkPins(driven, pulled);
+            }
+            break;
+        }
+        }
+    }
+
+    // ROOM -> NODE, at the end of the room's turn
+    void collectOutputs(RoomSlot &slot)
+    {
+        uint8_t payload[iolink::maxPayload];
+
+        bool modesChanged = !slot.configured || slot.configuredScanned != hal::sim::scannedPins;
+        for (int pin = 0; pin < iolink::numPins && !modesChanged; pin++)
+            modesChanged = !(hal::sim::scannedPins & (1ull << pin)) && !nodeOwned(pin) && slot.configuredModes[pin] != hal::sim::pins[pin].mode;
+        if (modesChanged)
+        {
+            size_t length = iolink::pinSetSize;
+            iolink::putPinSet(payload, hal::sim::scannedPins);
+            for (int pin = 0; pin < iolink::numPins; pin++)
+            {
+                const uint8_t mode = hal::sim::pins[pin].mode;
+                const bool scanned = hal::sim::scannedPins & (1ull << pin);
+                slot.configuredModes[pin] = scanned || nodeOwned(pin) ? (uint8_t)INPUT : mode;
+                if (scanned || nodeOwned(pin) || (!isInput(mode) && mode != OUTPUT))
+                    continue;
+                payload[length++] = pin;
+                payload[length++] = mode;
+            }
+            for (int pin = 0; pin < iolink::numPins; pin++)
+            {
+                // a pin the firmware started to scan only ever took the levels the node reported while it was an input
+                if ((hal::sim::scannedPins & ~slot.configuredScanned & (1ull << pin)) && hal::sim::pins[pin].forcedLevel >= 0)
+                    hal::sim::releasePin(pin);
+            }
+            slot.configuredScanned = hal::sim::scannedPins;
+            slot.configured = true;
+            slot.send(iolink::FRAME_CONFIG, payload, length);
+        }
+
+        size_t length = 0;
+        for (int pin = 0; pin < iolink::numPins; pin++)
+        {
+            const hal::sim::Pin &p = hal::sim::pins[pin];
+            if (p.mode != OUTPUT || nodeOwned(pin) || (hal::sim::scannedPins & (1ull << pin)) || slot.sentLevels[pin] == p.level)
+                continue;
+            slot.sentLevels[pin] = p.level;
+            payload[length++] = pin;
+            payload[length++] = p.level;
+        }
+        if (length > 0)
+            slot.send(iolink::FRAME_PINS, payload, length);
+        hal::sim::edges.clear(); // only the levels go out, the edges would pile up
+
+        const std::vector<uint32_t> &frame = hal::sim::frame;
+        slot.sentPixels.resize(frame.size(), ~0u);
+        size_t first = 0;
+        while (first < frame.size())
+        {
+            while (first < frame.size() && slot.sentPixels[first] == frame[first])
+                first++;
+            if (first == frame.size())
+                break;
+            size_t last = first;
+            length = 1;
+            payload[0] = first;
+            for (size_t i = first; i < frame.size() && length + 3 <= sizeof(payload); i++)
+            {
+                if (slot.sentPixels[i] != frame[i])
+                    last = i;
+                else if (i > last + 2)
+                    break; // a run of unchanged pixels ends the frame
+                length += 3;
+            }
+            length = 1;
+            for (size_t i = first; i <= last; i++)
+            {
+                payload[length++] = frame[i] >> 16;
+                payload[length++] = frame[i] >> 8;
+                payload[length++] = frame[i];
+                slot.sentPixels[i] = frame[i];
+            }
+            slot.send(iolink::FRAME_LEDS, payload, length);
+            first = last + 1;
+        }
+
+        if (hal::sim::displayedMinute != slot.sentMinute || hal::sim::displayedSecond != slot.sentSecond)
+        {
+            slot.sentMinute = hal::sim::displayedMinute;
+            slot.sentSecond = hal::sim::displayedSecond;
+            const uint8_t time[2] = {(uint8_t)slot.sentMinute, (uint8_t)slot.sentSecond};
+            if (slot.sentMinute >= 0)
+                slot.send(iolink::FRAME_DISPLAY, time, sizeof(time));
+        }
+
+        std::vector<hal::sim::Message> &published = hal::sim::broker.published;
+        if (slot.mqtt)
+        {
+            for (const hal::sim::Message &message : published)
+                slot.mqtt->publish(slot.prefix + message.topic, message.payload);
+        }
+        published.clear();
+    }
+
+    /**
+     * One turn of a room, with its board swapped in.
+     *
+     * @return The length of the turn in microseconds.
+     */
+    uint32_t turn(RoomSlot &slot, bool mqttReadable)
+    {
+        const Clock::time_point start = Clock::now();
+        hal::sim::swapBoard(slot.board);
+
+        for (char byte : slot.inbox)
+        {
+            if (slot.decoder.push(byte))
+                applyFrame(slot, slot.decoder);
+        }
+        slot.inbox.clear();
+        if (slot.mqtt && mqttReadable)
+            slot.mqtt->poll(0);
+
+        const int64_t now = microsSince(daemonStart);
+        if (now > hal::sim::nowMicros)
+            hal::sim::advanceMicros(now - hal::sim::nowMicros);
+        if (!hal::sim::sleeping())
+            slot.room->loop();
+        hal::sim::stepTasks();
+        collectOutputs(slot);
+
+        hal::sim::swapBoard(slot.board);
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    }
+
+    /**
+     * @brief A worker thread and the rooms it runs. Nodes for its rooms are handed over by the acceptor.
+     */
+    class Worker
+    {
+    public:
+        Worker(int index, const Options &options) : _index(index), _options(options) {}
+
+        void addRoom(int number)
+        {
+            _rooms.emplace_back(new RoomSlot());
+            _rooms.back()->number = number;
+        }
+
+        RoomSlot *room(int number)
+        {
+            for (auto &slot : _rooms)
+            {
+                if (slot->number == number)
+                    return slot.get();
+            }
+            return nullptr;
+        }
+
+        // from the acceptor thread
+        void handOver(int number, int fd)
+        {
+            std::lock_guard<std::mutex> lock(_pendingLock);
+            _pending.push_back({number, fd});
+        }
+
+        void start() { _thread = std::thread([this] { run(); }); }
+        void join() { _thread.join(); }
+
+    private:
+        void run()
+        {
+            for (auto &slot : _rooms)
+            {
+                hal::sim::swapBoard(slot->board);
+                hal::sim::nowMicros = microsSince(daemonStart);
+                slot->room.reset(new Room());
+                slot->room->setup();
+                collectOutputs(*slot);
+                hal::sim::swapBoard(slot->board);
+            }
+
+            const int64_t tick = _options.tickMicros;
+            int64_t nextTick = microsSince(daemonStart);
+            int64_t reportStart = nextTick;
+            int64_t busyMicros = 0;
+            unsigned long ticks = 0;
+            unsigned long missedTicks = 0;
+            std::vector<pollfd> descriptors;
+            std::vector<bool> mqttReadable(_rooms.size());
+
+            while (running)
+            {
+                takePending();
+
+                // take what the nodes send until the tick is due
+                std::fill(mqttReadable.begin(), mqttReadable.end(), false);
+                for (int64_t wait; (wait = nextTick - microsSince(daemonStart)) > 0;)
+                {
+                    descriptors.clear();
+                    for (auto &slot : _rooms)
+                    {
+                        descriptors.push_back({slot->node, POLLIN, 0});
+                        descriptors.push_back({slot->mqtt ? slot->mqtt->fd() : -1, POLLIN, 0});
+                    }
+                    const timespec timeout = {(time_t)(wait / 1000000), (long)(wait % 1000000) * 1000};
+                    if (::ppoll(descriptors.data(), descriptors.size(), &timeout, nullptr) <= 0)
+                        continue; // poll() would only wait whole milliseconds
+                    for (size_t i = 0; i < _rooms.size(); i++)
+                    {
+                        if (descriptors[2 * i].revents & (POLLIN | POLLHUP | POLLERR))
+                            receive(*_rooms[i]);
+                        if (descriptors[2 * i + 1].revents & POLLIN)
+                            mqttReadable[i] = true;
+                    }
+                }
+
+                const int64_t tickStart = microsSince(daemonStart);
+                for (size_t i = 0; i < _rooms.size(); i++)
+                {
+                    RoomSlot &slot = *_rooms[i];
+                    slot.turns.record(turn(slot, mqttReadable[i] || ticks % 1000 == 0));
+                    transmit(slot);
+                }
+                busyMicros += microsSince(daemonStart) - tickStart;
+                ticks++;
+
+                nextTick += tick;
+                const int64_t now = microsSince(daemonStart);
+                if (now > nextTick)
+                {
+                    // too slow for the tick: skip the missed ones instead of running them back to back
+                    missedTicks += (now - nextTick) / tick + 1;
+                    nextTick += ((now - nextTick) / tick + 1) * tick;
+                }
+
+                if (now - reportStart >= (int64_t)_options.reportSeconds * 1000000)
+                {
+                    report(now - reportStart, busyMicros, ticks, missedTicks);
+                    reportStart = now;
+                    busyMicros = 0;
+                    ticks = 0;
+                    missedTicks = 0;
+                }
+            }
+
+            for (auto &slot : _rooms)
+            {
+                slot->detach();
+                hal::sim::swapBoard(slot->board);
+                slot->room.reset(); // its timers leave the board it runs on
+                hal::sim::swapBoard(slot->board);
+            }
+        }
+
+        void takePending()
+        {
+            std::lock_guard<std::mutex> lock(_pendingLock);
+            for (const auto &handed : _pending)
+            {
+                RoomSlot *slot = room(handed.first);
+                fcntl(handed.second, F_SETFL, fcntl(handed.second, F_GETFL) | O_NONBLOCK);
+                slot->attach(handed.second);
+            }
+            _pending.clear();
+        }
+
+        void receive(RoomSlot &slot)
+        {
+            char buffer[4096];
+            for (;;)
+            {
+                const ssize_t n = ::recv(slot.node, buffer, sizeof(buffer), 0);
+                if (n > 0)
+                {
+                    slot.inbox.append(buffer, n);
+                    continue;
+                }
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    slot.detach();
+                return;
+            }
+        }
+
+        void transmit(RoomSlot &slot)
+        {
+            if (slot.node < 0)
+            {
+                slot.outbox.clear();
+                return;
+            }
+            while (!slot.outbox.empty())
+            {
+                const ssize_t n = ::send(slot.node, slot.outbox.data(), slot.outbox.size(), MSG_NOSIGNAL);
+                if (n <= 0)
+                {
+                    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                        slot.detach();
+                    break;
+                }
+                slot.outbox.erase(0, n);
+            }
+            if (slot.outbox.size() > 64 * 1024)
+                slot.detach(); // the node stopped reading
+        }
+
+        void report(int64_t periodMicros, int64_t busyMicros, unsigned long ticks, unsigned long missedTicks)
+        {
+            std::lock_guard<std::mutex> lock(printLock);
+            printf("worker %d: %zu rooms, busy %.1f%%, %lu ticks, %lu missed\n", _index, _rooms.size(), 100.0 * busyMicros / periodMicros, ticks,
+                   missedTicks);
+            for (auto &slot : _rooms)
+            {
+                printf("  room %-3d node %-4s turn_us=%u/%u/%u frames_in=%lu frames_out=%lu\n", slot->number, slot->node >= 0 ? "up" : "down",
+                       slot->turns.percentile(500), slot->turns.percentile(990), slot->turns.max(), slot->framesIn, slot->framesOut);
+                slot->turns.reset();
+                slot->framesIn = 0;
+                slot->framesOut = 0;
+            }
+            fflush(stdout);
+        }
+
+        const int _index;
+        const Options &_options;
+        std::vector<std::unique_ptr<RoomSlot>> _rooms;
+        std::thread _thread;
+        std::mutex _pendingLock;
+        std::vector<std::pair<int, int>> _pending;
+    };
+
+    int listenOn(uint16_t port)
+    {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        const int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (fd < 0 || ::bind(fd, (sockaddr *)&address, sizeof(address)) != 0 || ::listen(fd, 64) != 0)
+            return -1;
+        return fd;
+    }
+
+    // the HELLO of a new node, within a second: its room number, or -1
+    int readHello(int fd)
+    {
+        iolink::Decoder decoder;
+        const Clock::time_point start = Clock::now();
+        while (Clock::now() - start < std::chrono::seconds(1))
+        {
+            pollfd descriptor = {fd, POLLIN, 0};
+            if (::poll(&descriptor, 1, 100) <= 0)
+                continue;
+            uint8_t byte;
+            if (::recv(fd, &byte, 1, 0) != 1)
+                return -1;
+            if (decoder.push(byte))
+            {
+                if (decoder.type() != iolink::FRAME_HELLO || decoder.length() < 2 || decoder.payload()[0] != iolink::version)
+                    return -1;
+                return decoder.payload()[1];
+            }
+        }
+        return -1;
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            const std::string name = argv[i];
+            const char *value = argv[i + 1];
+            if (name == "--rooms")
+                options.rooms = atoi(value);
+            else if (name == "--workers")
+                options.workers = atoi(value);
+            else if (name == "--port")
+                options.port = atoi(value);
+            else if (name == "--tick-us")
+                options.tickMicros = atoi(value);
+            else if (name == "--report")
+                options.reportSeconds = atoi(value);
+            else if (name == "--broker")
+                options.broker = value;
+            else if (name == "--broker-port")
+                options.brokerPort = atoi(value);
+            else
+                return false;
+        }
+        return (argc - 1) % 2 == 0 && options.rooms >= 1 && options.rooms <= 255 && options.workers >= 1 && options.tickMicros >= 100 &&
+               options.reportSeconds >= 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s [--rooms N] [--workers N] [--port P] [--tick-us US] [--report S] [--broker HOST [--broker-port P]]\n", argv[0]);
+        return 2;
+    }
+    options.workers = std::min(options.workers, options.rooms);
+
+    const int listener = listenOn(options.port);
+    if (listener < 0)
+    {
+        fprintf(stderr, "cannot listen on port %u\n", options.port);
+        return 1;
+    }
+    signal(SIGINT, [](int) { running = false; });
+    signal(SIGTERM, [](int) { running = false; });
+
+    daemonStart = Clock::now();
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int w = 0; w < options.workers; w++)
+        workers.emplace_back(new Worker(w, options));
+    for (int r = 0; r < options.rooms; r++)
+    {
+        Worker &worker = *workers[r % options.workers];
+        worker.addRoom(r);
+        if (options.broker.empty())
+            continue;
+        RoomSlot &slot = *worker.room(r);
+        slot.prefix = "room" + std::to_string(r) + "/";
+        slot.mqtt.reset(new MqttSocket());
+        // admin messages go to the room's virtual broker during its turn, when its board is swapped in
+        slot.mqtt->onMessage([&slot](const std::string &topic, const std::string &payload)
+                             { hal::sim::broker.inject(topic.substr(slot.prefix.size()), payload); });
+        if (!slot.mqtt->connect(options.broker.c_str(), options.brokerPort, "room" + std::to_string(r)) || !slot.mqtt->subscribe(slot.prefix + "admin"))
+        {
+            fprintf(stderr, "room %d cannot reach the broker at %s:%u\n", r, options.broker.c_str(), options.brokerPort);
+            return 1;
+        }
+    }
+    for (auto &worker : workers)
+        worker->start();
+    printf("%d rooms on %d workers, nodes on port %u, a tick every %u us\n", options.rooms, options.workers, options.port, options.tickMicros);
+    fflush(stdout);
+
+    while (running)
+    {
+        pollfd descriptor = {listener, POLLIN, 0};
+        if (::poll(&descriptor, 1, 200) <= 0)
+            continue;
+        const int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        const int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        const int number = readHello(fd);
+        if (number < 0 || number >= options.rooms)
+        {
+            ::close(fd);
+            continue;
+        }
+        workers[number % options.workers]->handOver(number, fd);
+        std::lock_guard<std::mutex> lock(printLock);
+        printf("node of room %d connected\n", number);
+        fflush(stdout);
+    }
+
+    for (auto &worker : workers)
+        worker->join();
+    ::close(listener);
+    return 0;
+}
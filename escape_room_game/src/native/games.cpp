@@ -0,0 +1,144 @@
+/**
+ * @brief Many rooms in one process (`[env:native_games]`).
+ *
+ * Plays the scripted game of sim.cpp ('*', the wheels with a hint, the optimal pours with a hint, the star passcode)
+ * in thousands of rooms, on a pool of worker threads that take the next game from a shared counter. Every worker has
+ * its own virtual board (see hal::sim) and plays one Room on it at a time, from a power-on reset, so the games share
+ * nothing but the code. The pool runs with 1, 2, 4... threads up to `--threads`, and reports the games per second
+ * and the speedup over one thread for each:
+ *
+ *     .pio/build/native_games/program --games 2000 --threads 8
+ *
+ * Every game must be solved and report the same completion time as the others; a room that saw anything of another
+ * one would not. The exit status is 1 if one did not.
+ */
+#include "scenario.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace scenario;
+
+namespace
+{
+    struct Outcome
+    {
+        bool solved;
+        std::string completion; // the esp_completion payload, "mm:ss"
+        unsigned long passes;
+    };
+
+    Outcome playGame()
+    {
+        hal::sim::reset();
+        std::unique_ptr<Room> game(new Room());
+        scenario::room = game.get();
+        const unsigned long loopsBefore = loops;
+
+        misalignWheels();
+        setup();
+        run(1000);
+        tapKey('*');
+        hal::sim::broker.inject("admin", "wheels_hint");
+        alignWheels();
+        bool solved = runUntilPublished(ESP_TOPIC, WHEELS_SOLVE, 1000);
+        pour(0, 1);
+        hal::sim::broker.inject("admin", "fuel_hint");
+        run(3000);
+        for (const auto &p : poursAfterHint)
+            pour(p[0], p[1]);
+        solved = solved && runUntilPublished(ESP_TOPIC, FUEL_SOLVE, 5000);
+        for (char key : {'7', '0', '3', '1'})
+            tapKey(key);
+        solved = solved && runUntilPublished(ESP_TOPIC, STARS_SOLVE, 5000);
+        run(1000); // the completion time goes out with the next pass of the network task
+
+        Outcome outcome = {solved, "", loops - loopsBefore};
+        for (const hal::sim::Message &message : hal::sim::broker.published)
+        {
+            if (message.topic == ESP_COMPLETION_TOPIC)
+                outcome.completion = message.payload;
+        }
+        scenario::room = nullptr;
+        return outcome;
+    }
+
+    struct PoolRun
+    {
+        double wallSeconds;
+        unsigned long passes;
+        unsigned long failures;
+    };
+
+    // `games` games on `threads` workers, each checked against `expected`
+    PoolRun runPool(unsigned games, unsigned threads, const std::string &expected)
+    {
+        std::atomic<unsigned> next(0);
+        std::atomic<unsigned long> passes(0);
+        std::atomic<unsigned long> failures(0);
+        std::vector<std::thread> workers;
+
+        const auto wallStart = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&]
+                                 {
+                                     while (next.fetch_add(1, std::memory_order_relaxed) < games)
+                                     {
+                                         const Outcome outcome = playGame();
+                                         passes += outcome.passes;
+                                         if (!outcome.solved || outcome.completion != expected)
+                                             failures++;
+                                     }
+                                 });
+        }
+        for (std::thread &worker : workers)
+            worker.join();
+        const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        return {wallSeconds, passes, failures};
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned games = 1000;
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--games") == 0)
+            games = std::max(1, atoi(argv[i + 1]));
+        else if (strcmp(argv[i], "--threads") == 0)
+            maxThreads = std::max(1, atoi(argv[i + 1]));
+    }
+
+    // the reference game, on this thread
+    const Outcome reference = playGame();
+    if (!reference.solved || reference.completion.empty())
+    {
+        fprintf(stderr, "the reference game was not solved\n");
+        return 1;
+    }
+    printf("%u games of %lu passes each, solved in %s, on up to %u threads\n", games, reference.passes, reference.completion.c_str(), maxThreads);
+    printf("%8s %10s %12s %14s %9s %9s\n", "threads", "wall s", "games/s", "passes/s", "speedup", "failures");
+
+    double singleThreadRate = 0;
+    bool allSolved = true;
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads))
+    {
+        const PoolRun pool = runPool(games, threads, reference.completion);
+        const double rate = games / pool.wallSeconds;
+        if (threads == 1)
+            singleThreadRate = rate;
+        printf("%8u %10.2f %12.1f %14.0f %8.2fx %9lu\n", threads, pool.wallSeconds, rate, pool.passes / pool.wallSeconds, rate / singleThreadRate,
+               pool.failures);
+        fflush(stdout);
+        allSolved = allSolved && pool.failures == 0;
+        if (threads == maxThreads)
+            break;
+    }
+    return allSolved ? 0 : 1;
+}
@@ -0,0 +1,412 @@
+/**
+ * @brief Simulated I/O nodes for the controller daemon (`[env:native_iosim]`, Linux).
+ *
+ * Stands in for the ESP32 nodes of src/node/ on the same machine: one TCP connection per room to the daemon
+ * (src/native/daemon.cpp), speaking lib/IoLink/IoLink.h. Every node keeps the levels of its pins as a board would,
+ * with the pull-ups the daemon configured, and plays the same game with real-time waits:
+ * the wheels, '*', the six pours of the fuel puzzle and the star passcode. Between the steps it waits for the relay
+ * of each puzzle to open. All nodes run in one event loop, so a few hundred rooms fit on one core.
+ *
+ *     .pio/build/native_daemon/program --rooms 24 &
+ *     .pio/build/native_iosim/program --rooms 24
+ *
+ * It reports how many rooms were solved and how long a key press took to show on the keypad LEDs, from the INPUTS
+ * frame going out to the LEDS frame coming back (p50/p99/max in microseconds): a full trip through the daemon.
+ * The exit status is 0 if every room was solved.
+ */
+#include <IoLink.h>
+#include <Metrics.h>
+#include "../../include/globals.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const uint8_t noKey = 16;
+    const char keys[] = "123 456 789 *0# N";
+    const uint8_t transferButtonPin = 35;
+    const uint8_t fillingPins[3] = {25, 26, 27};
+    const uint8_t relayPins[3] = {13, 12, 14}; // wheels, fuel, stars
+    const int firstKeypadLed = numFuelLeds + numStarLeds + 1;
+
+    enum stepType
+    {
+        STEP_WAIT,   // ms
+        STEP_PIN,    // pin, level (-1 = released)
+        STEP_REEDS,  // closed wheel reeds
+        STEP_KEY,    // key, held for ms
+        STEP_LINK,   // driven pin, pulled pin
+        STEP_UNLINK, // pulled pin
+        STEP_AWAIT,  // relay pin HIGH within ms
+    };
+
+    struct Step
+    {
+        stepType type;
+        int a;
+        int b;
+        unsigned long ms;
+    };
+
+    // 8,0,0 -> 3,5,0 -> 3,2,3 -> 6,2,0 -> 6,0,2 -> 1,5,2 -> 1,4,3
+    const int pours[][2] = {{0, 1}, {1, 2}, {2, 0}, {1, 2}, {0, 1}, {1, 2}};
+
+    std::vector<Step> gameScript()
+    {
+        std::vector<Step> script = {{STEP_WAIT, 0, 0, 1000}, {STEP_KEY, '*', 0, 100}, {STEP_WAIT, 0, 0, 100},
+                                    {STEP_REEDS, (1 << numWheels) - 1, 0, 0}, {STEP_AWAIT, relayPins[0], 0, 5000}};
+        for (const auto &p : pours)
+        {
+            // the hose has a diode in it: the fuel flows from `from` when `to` drives its end low
+            script.push_back({STEP_LINK, fillingPins[p[1]], fillingPins[p[0]], 0});
+            script.push_back({STEP_WAIT, 0, 0, 50});
+            script.push_back({STEP_PIN, transferButtonPin, LOW, 0});
+            script.push_back({STEP_WAIT, 0, 0, 10});
+            script.push_back({STEP_PIN, transferButtonPin, -1, 0});
+            script.push_back({STEP_WAIT, 0, 0, 3000});
+            script.push_back({STEP_UNLINK, fillingPins[p[0]], 0, 0});
+            script.push_back({STEP_WAIT, 0, 0, 10});
+        }
+        script.push_back({STEP_AWAIT, relayPins[1], 0, 5000});
+        for (char key : {'7', '0', '3', '1'})
+        {
+            script.push_back({STEP_KEY, key, 0, 100});
+            script.push_back({STEP_WAIT, 0, 0, 100});
+        }
+        script.push_back({STEP_AWAIT, relayPins[2], 0, 5000});
+        return script;
+    }
+
+    int64_t microsSince(Clock::time_point start) { return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count(); }
+
+    Clock::time_point simStart;
+    LatencyHistogram keyLatency;
+
+    /**
+     * @brief One simulated node: its pins as the daemon configured them, and where it is in the game.
+     */
+    struct Node
+    {
+        int room = 0;
+        int fd = -1;
+        iolink::Decoder decoder;
+        std::string outbox;
+
+        uint8_t modes[iolink::numPins] = {};
+        uint64_t scanned = 0;
+        int8_t forced[iolink::numPins];
+        uint8_t levels[iolink::numPins] = {};
+        std::vector<std::pair<uint8_t, uint8_t>> links;
+        uint8_t key = noKey;
+        uint32_t reeds = 0; // every wheel off its constellation, on the chain and on the line of the original wiring
+        std::vector<uint32_t> pixels;
+
+        uint64_t sentInputs = ~0ull;
+        uint8_t sentKey = 0xff;
+        uint32_t sentReeds = 0;
+        int64_t sentAt = 0;
+        bool linksChanged = true;
+
+        const std::vector<Step> *script = nullptr;
+        size_t step = 0;
+        int64_t stepStart = 0;
+        bool keyHeld = false;
+        bool failed = false;
+        int64_t pressedAt = -1; // a key press waiting for the keypad LEDs
+
+        Node()
+        {
+            std::fill(std::begin(forced), std::end(forced), -1);
+            forced[wheelsLinePin] = LOW;
+        }
+
+        bool done() const { return failed || step >= script->size(); }
+
+        void send(uint8_t type, const uint8_t *payload, size_t length)
+        {
+            uint8_t frame[iolink::maxFrame];
+            outbox.append((const char *)frame, iolink::encode(frame, type, payload, length));
+        }
+
+        // what a GPIO of the board reads: the button or switch on it, else its pull-up
+        uint64_t inputs() const
+        {
+            uint64_t set = 0;
+            for (int pin = 0; pin < iolink::numPins; pin++)
+            {
+                const int level = forced[pin] >= 0 ? forced[pin] : modes[pin] == INPUT_PULLUP;
+                if (level)
+                    set |= 1ull << pin;
+            }
+            return set;
+        }
+
+        void sendInputs(int64_t now)
+        {
+            const uint64_t set = inputs();
+            if (set != sentInputs || key != sentKey || reeds != sentReeds || now - sentAt >= (int64_t)iolink::heartbeatMs * 1000)
+            {
+                uint8_t payload[iolink::inputsSize];
+                iolink::putPinSet(payload, set);
+                payload[iolink::pinSetSize] = key;
+                iolink::putUint32(payload + iolink::pinSetSize + 1, reeds);
+                send(iolink::FRAME_INPUTS, payload, sizeof(payload));
+                sentInputs = set;
+                sentKey = key;
+                sentReeds = reeds;
+                sentAt = now;
+                if (keyHeld && pressedAt < 0 && key != noKey)
+                    pressedAt = now;
+            }
+            if (linksChanged)
+            {
+                uint8_t payload[2 * iolink::numPins];
+                size_t length = 0;
+                for (const auto &link : links)
+                {
+                    payload[length++] = link.first;
+                    payload[length++] = link.second;
+                }
+                send(iolink::FRAME_LINKS, payload, length);
+                linksChanged = false;
+            }
+        }
+
+        void receive(const iolink::Decoder &frame, int64_t now)
+        {
+            const uint8_t *payload = frame.payload();
+            switch (frame.type())
+            {
+            case iolink::FRAME_CONFIG:
+                if (frame.length() < iolink::pinSetSize)
+                    break;
+                scanned = iolink::getPinSet(payload);
+                std::fill(std::begin(modes), std::end(modes), 0);
+                for (int i = iolink::pinSetSize; i + 1 < frame.length(); i += 2)
+                {
+                    if (payload[i] < iolink::numPins)
+                        modes[payload[i]] = payload[i + 1];
+                }
+                break;
+            case iolink::FRAME_PINS:
+                for (int i = 0; i + 1 < frame.length(); i += 2)
+                {
+                    if (payload[i] < iolink::numPins)
+                        levels[payload[i]] = payload[i + 1];
+                }
+                break;
+            case iolink::FRAME_LEDS:
+            {
+                if (frame.length() < 1)
+                    break;
+                const size_t first = payload[0];
+                const size_t count = (frame.length() - 1) / 3;
+                if (pixels.size() < first + count)
+                    pixels.resize(first + count);
+                bool keypadChanged = false;
+                for (size_t i = 0; i < count; i++)
+                {
+                    const uint32_t color = (uint32_t)payload[1 + 3 * i] << 16 | (uint32_t)payload[2 + 3 * i] << 8 | payload[3 + 3 * i];
+                    const size_t index = first + i;
+                    if (index >= (size_t)firstKeypadLed && index < (size_t)firstKeypadLed + numKeypadLeds && pixels[index] != color)
+                        keypadChanged = true;
+                    pixels[index] = color;
+                }
+                if (keypadChanged && pressedAt >= 0)
+                {
+                    keyLatency.record(now - pressedAt);
+                    pressedAt = -1;
+                }
+                break;
+            }
+            }
+        }
+
+        // runs the script as far as it goes right now
+        void play(int64_t now)
+        {
+            while (!done())
+            {
+                const Step &s = (*script)[step];
+                const int64_t elapsed = now - stepStart;
+                switch (s.type)
+                {
+                case STEP_WAIT:
+                    if (elapsed < (int64_t)s.ms * 1000)
+                        return;
+                    break;
+                case STEP_PIN:
+                    forced[s.a] = s.b;
+                    break;
+                case STEP_REEDS:
+                    reeds = s.a;
+                    forced[wheelsLinePin] = reeds == (1u << numWheels) - 1 ? HIGH : LOW;
+                    break;
+                case STEP_KEY:
+                    if (!keyHeld)
+                    {
+                        key = strchr(keys, s.a) - keys;
+                        keyHeld = true;
+                        pressedAt = -1;
+                        return;
+                    }
+                    if (elapsed < (int64_t)s.ms * 1000)
+                        return;
+                    key = noKey;
+                    keyHeld = false;
+                    break;
+                case STEP_LINK:
+                    links.push_back({(uint8_t)s.a, (uint8_t)s.b});
+                    linksChanged = true;
+                    break;
+                case STEP_UNLINK:
+                    links.erase(std::remove_if(links.begin(), links.end(), [&](const std::pair<uint8_t, uint8_t> &link) { return link.second == s.a; }),
+                                links.end());
+                    linksChanged = true;
+                    break;
+                case STEP_AWAIT:
+                    if (levels[s.a] != HIGH)
+                    {
+                        if (elapsed >= (int64_t)s.ms * 1000)
+                        {
+                            fprintf(stderr, "room %d: relay %d did not open (step %zu)\n", room, s.a, step);
+                            failed = true;
+                        }
+                        return;
+                    }
+                    break;
+                }
+                step++;
+                stepStart = now;
+            }
+        }
+    };
+
+    int connectTo(const char *host, uint16_t port)
+    {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (fd < 0 || inet_pton(AF_INET, host, &address.sin_addr) != 1 || ::connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            return -1;
+        }
+        const int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = iolink::port;
+    int rooms = 8;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--host") == 0)
+            host = argv[i + 1];
+        else if (strcmp(argv[i], "--port") == 0)
+            port = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--rooms") == 0)
+            rooms = std::min(255, std::max(1, atoi(argv[i + 1])));
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    const std::vector<Step> script = gameScript();
+    std::vector<Node> nodes(rooms);
+    simStart = Clock::now();
+    for (int r = 0; r < rooms; r++)
+    {
+        Node &node = nodes[r];
+        node.room = r;
+        node.script = &script;
+        node.fd = connectTo(host.c_str(), port);
+        if (node.fd < 0)
+        {
+            fprintf(stderr, "cannot reach the daemon at %s:%u\n", host.c_str(), port);
+            return 1;
+        }
+        const uint8_t hello[2] = {iolink::version, (uint8_t)r};
+        node.send(iolink::FRAME_HELLO, hello, sizeof(hello));
+    }
+    printf("%d nodes connected to %s:%u\n", rooms, host.c_str(), port);
+    fflush(stdout);
+
+    std::vector<pollfd> descriptors(rooms);
+    for (;;)
+    {
+        const int64_t now = microsSince(simStart);
+        bool allDone = true;
+        for (int r = 0; r < rooms; r++)
+        {
+            Node &node = nodes[r];
+            node.play(now);
+            node.sendInputs(now);
+            allDone = allDone && node.done();
+            descriptors[r] = {node.fd, (short)(POLLIN | (node.outbox.empty() ? 0 : POLLOUT)), 0};
+        }
+        if (allDone)
+            break;
+
+        ::poll(descriptors.data(), descriptors.size(), 1);
+        const int64_t received = microsSince(simStart);
+        for (int r = 0; r < rooms; r++)
+        {
+            Node &node = nodes[r];
+            if (descriptors[r].revents & (POLLHUP | POLLERR))
+            {
+                fprintf(stderr, "room %d: the daemon closed the connection\n", r);
+                return 1;
+            }
+            if (descriptors[r].revents & POLLIN)
+            {
+                uint8_t buffer[4096];
+                ssize_t n;
+                while ((n = ::recv(node.fd, buffer, sizeof(buffer), 0)) > 0)
+                {
+                    for (ssize_t i = 0; i < n; i++)
+                    {
+                        if (node.decoder.push(buffer[i]))
+                            node.receive(node.decoder, received);
+                    }
+                }
+            }
+            if (!node.outbox.empty())
+            {
+                const ssize_t n = ::send(node.fd, node.outbox.data(), node.outbox.size(), MSG_NOSIGNAL);
+                if (n > 0)
+                    node.outbox.erase(0, n);
+            }
+        }
+    }
+
+    int solved = 0;
+    for (const Node &node : nodes)
+    {
+        solved += !node.failed;
+        ::close(node.fd);
+    }
+    printf("solved %d/%d in %.1f s, key to keypad LEDs us p50=%u p99=%u max=%u (n=%u)\n", solved, rooms, microsSince(simStart) / 1e6, keyLatency.percentile(500),
+           keyLatency.percentile(990), keyLatency.max(), keyLatency.samples());
+    return solved == rooms ? 0 : 1;
+}
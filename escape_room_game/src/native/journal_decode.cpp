@@ -0,0 +1,101 @@
+/**
+ * @brief Host decoder for event journal dumps (`[env:journal_decode]`).
+ *
+ * Reads the chunks published on `esp_journal` after a `journal_dump` admin command, one per line, from a file
+ * or stdin, and prints every record as text:
+ *
+ *     mosquitto_sub -t esp_journal -C 100 | .pio/build/journal_decode/program
+ *
+ * Lines are `<block sequence> <hex records>` and a final `end <record count>` (see Journal::nextDumpChunk).
+ * Anything else on a line before the sequence number (e.g. a topic printed by `mosquitto_sub -v`) is skipped.
+ * Records are dumped in the ESP32's byte order, which is little-endian like the hosts this runs on.
+ */
+#include <Journal.h>
+#include <Commands.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    void printRecord(unsigned long block, const JournalRecord &record)
+    {
+        char text[120];
+        if (record.event == EVENT_ADMIN_COMMAND)
+        {
+            const unsigned long time = record.time;
+            snprintf(text, sizeof(text), "%6lu.%03lu %-16s %s", time / 1000, time % 1000, "admin_command",
+                     record.a < NUM_COMMANDS ? commands::table[record.a].name : "unknown");
+        }
+        else
+        {
+            Journal::describe(record, text, sizeof(text));
+        }
+        printf("#%-4lu %s\n", block, text);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = argc > 1 ? fopen(argv[1], "r") : stdin;
+    if (!input)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char line[512];
+    unsigned long decoded = 0;
+    long expected = -1;
+    while (fgets(line, sizeof(line), input))
+    {
+        char *cursor = line;
+        if (char *end = strstr(cursor, "end "))
+        {
+            expected = strtol(end + 4, nullptr, 10);
+            continue;
+        }
+        while (*cursor && !isdigit((unsigned char)*cursor))
+            cursor++;
+        if (!*cursor)
+            continue;
+
+        const unsigned long block = strtoul(cursor, &cursor, 10);
+        while (*cursor == ' ')
+            cursor++;
+
+        uint8_t bytes[sizeof(JournalRecord)];
+        size_t filled = 0;
+        for (; hexValue(cursor[0]) >= 0 && hexValue(cursor[1]) >= 0; cursor += 2)
+        {
+            bytes[filled++] = hexValue(cursor[0]) << 4 | hexValue(cursor[1]);
+            if (filled == sizeof(JournalRecord))
+            {
+                JournalRecord record;
+                memcpy(&record, bytes, sizeof(record));
+                printRecord(block, record);
+                decoded++;
+                filled = 0;
+            }
+        }
+    }
+
+    if (expected >= 0 && (unsigned long)expected != decoded)
+    {
+        fprintf(stderr, "decoded %lu records, the dump announced %ld\n", decoded, expected);
+        return 1;
+    }
+    return 0;
+}
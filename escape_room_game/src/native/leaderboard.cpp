@@ -0,0 +1,500 @@
+/**
+ * @brief Local leaderboard service (`[env:native_leaderboard]`, Linux).
+ *
+ * Ranks every finished game without a round trip to the cloud database. It subscribes to `esp_completion` of a
+ * room, and of every room of the daemon or load generator under its `room<i>/` prefix. Each completion time is
+ * appended to a log file and ranked in a Leaderboard (lib/Leaderboard): overall, per day and per room. The team
+ * playing a room is whatever was last published on its `team` topic (`room<i>/team`), e.g. by the dashboard,
+ * and `room<i>` if nothing was.
+ *
+ *     .pio/build/native_leaderboard/program --broker 127.0.0.1 --log scores.log --socket /tmp/escape-leaderboard.sock
+ *
+ * The log is a header and one 32 byte ScoreRecord per game, only ever appended. At startup it is mapped into memory
+ * and loaded straight from the mapping in one go (Leaderboard::load); a torn record at its end (a crash in the
+ * middle of a write) is cut off, and a damaged record before that is skipped without touching the rest.
+ *
+ * Queries are lines of text on the Unix socket, and every answer ends with a line holding a single `.`:
+ *
+ *     TOP <n> [DAY <yyyy-mm-dd> | ROOM <r>]   the best n games: "<rank> <mm:ss> <room> <yyyy-mm-dd> <team>" each
+ *     RANK <team>                             the rank of the team's best game overall, or "none"
+ *     COUNT                                   the number of games
+ *     WATCH                                   from then on, a "NEW <rank> <mm:ss> <room> <yyyy-mm-dd> <team>" line
+ *                                             for every finished game, as soon as it is ranked, e.g. for a rank screen
+ *
+ * `--query "TOP 10"` sends one query to a running service and prints the answer and how long it took.
+ * `--generate <n>` appends n made-up games over the last two years to the log, to try the startup with a big one.
+ */
+#include <Leaderboard.h>
+#include "mqtt_socket.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const char logMagic[8] = {'E', 'S', 'C', 'S', 'C', 'O', 'R', '2'};
+    const unsigned long reconnectInterval = 5000; // ms
+
+    struct Options
+    {
+        std::string broker = "127.0.0.1";
+        uint16_t brokerPort = 1883;
+        std::string log = "leaderboard.log";
+        std::string socket = "/tmp/escape-leaderboard.sock";
+        std::string query;
+        long generate = 0;
+    };
+
+    volatile sig_atomic_t running = 1;
+    Leaderboard leaderboard;
+    int logFd = -1;
+
+    double millisSince(Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); }
+
+    uint16_t dayOf(time_t t)
+    {
+        tm local;
+        localtime_r(&t, &local);
+        return (t + local.tm_gmtoff) / 86400;
+    }
+
+    std::string formatDay(uint16_t day)
+    {
+        const time_t t = (time_t)day * 86400;
+        tm date;
+        gmtime_r(&t, &date);
+        char text[16];
+        strftime(text, sizeof(text), "%Y-%m-%d", &date);
+        return text;
+    }
+
+    // -1 if it is not a date
+    int parseDay(const std::string &text)
+    {
+        tm date = {};
+        if (sscanf(text.c_str(), "%d-%d-%d", &date.tm_year, &date.tm_mon, &date.tm_mday) != 3)
+            return -1;
+        date.tm_year -= 1900;
+        date.tm_mon -= 1;
+        return timegm(&date) / 86400;
+    }
+
+    std::string formatGame(uint32_t rank, const ScoreRecord &game)
+    {
+        char line[96];
+        snprintf(line, sizeof(line), "%u %02u:%02u %u %s %s\n", rank, game.seconds / 60, game.seconds % 60, game.room, formatDay(game.day).c_str(),
+                 game.team().c_str());
+        return line;
+    }
+
+    // LOG
+    /**
+     * Opens the log, creating it if needed, and replays it into the leaderboard from a read-only mapping.
+     *
+     * @return False if it is not a leaderboard log.
+     */
+    bool openLog(const std::string &path)
+    {
+        logFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        struct stat info;
+        if (logFd < 0 || fstat(logFd, &info) != 0)
+            return false;
+        if (info.st_size == 0)
+            return ::write(logFd, logMagic, sizeof(logMagic)) == sizeof(logMagic);
+        if ((size_t)info.st_size < sizeof(logMagic))
+            return false;
+
+        const Clock::time_point start = Clock::now();
+        void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, logFd, 0);
+        if (mapped == MAP_FAILED)
+            return false;
+        madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+        const uint8_t *bytes = (const uint8_t *)mapped;
+        if (memcmp(bytes, logMagic, sizeof(logMagic)) != 0)
+        {
+            munmap(mapped, info.st_size);
+            return false;
+        }
+
+        // A write torn by a crash leaves a partial record, or a last record that fails its check, which is cut off.
+        // A bad record before that is damage to the file: it is skipped, but left where it is with everything after it.
+        size_t records = (info.st_size - sizeof(logMagic)) / sizeof(ScoreRecord);
+        const ScoreRecord *record = (const ScoreRecord *)(bytes + sizeof(logMagic));
+        if (records > 0 && record[records - 1].check != record[records - 1].checksum())
+            records--;
+        std::vector<ScoreRecord> valid;
+        size_t skipped = 0;
+        for (size_t i = 0; i < records; i++)
+        {
+            if (record[i].check == record[i].checksum())
+            {
+                if (skipped > 0)
+                    valid.push_back(record[i]);
+                continue;
+            }
+            if (skipped++ == 0)
+                valid.assign(record, record + i);
+            fprintf(stderr, "skipped the damaged record %zu of the log\n", i);
+        }
+        if (skipped == 0)
+            leaderboard.load(record, records);
+        else
+            leaderboard.load(valid.data(), valid.size());
+        munmap(mapped, info.st_size);
+
+        const off_t end = sizeof(logMagic) + records * sizeof(ScoreRecord);
+        if (end != info.st_size)
+        {
+            fprintf(stderr, "cut a torn record of %lld bytes off the end of the log\n", (long long)(info.st_size - end));
+            if (ftruncate(logFd, end) != 0)
+                return false;
+        }
+        printf("replayed %u games from %s in %.1f ms\n", leaderboard.count(), path.c_str(), millisSince(start));
+        return true;
+    }
+
+    bool append(const ScoreRecord &record)
+    {
+        return ::write(logFd, &record, sizeof(record)) == sizeof(record) && fdatasync(logFd) == 0;
+    }
+
+    // CLIENTS
+    struct Client
+    {
+        int fd;
+        std::string in;
+        bool watching;
+    };
+    std::vector<Client> clients;
+
+    void reply(Client &client, const std::string &text)
+    {
+        // answers are small and the clients are local, a blocking send is enough
+        const std::string answer = text + ".\n";
+        if (::send(client.fd, answer.data(), answer.size(), MSG_NOSIGNAL) != (ssize_t)answer.size())
+        {
+            ::close(client.fd);
+            client.fd = -1;
+        }
+    }
+
+    std::string answer(Client &client, const std::string &line)
+    {
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+        std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+        if (command == "TOP")
+        {
+            long count = 10;
+            std::string scopeName, which;
+            words >> count >> scopeName >> which;
+            std::transform(scopeName.begin(), scopeName.end(), scopeName.begin(), ::toupper);
+            Leaderboard::scope s = Leaderboard::SCOPE_ALL;
+            long value = 0;
+            if (scopeName == "DAY")
+            {
+                s = Leaderboard::SCOPE_DAY;
+                value = parseDay(which);
+            }
+            else if (scopeName == "ROOM")
+            {
+                s = Leaderboard::SCOPE_ROOM;
+                value = which.empty() ? -1 : atol(which.c_str());
+            }
+            else if (!scopeName.empty())
+            {
+                return "error: TOP <n> [DAY <yyyy-mm-dd> | ROOM <r>]\n";
+            }
+            if (count < 0 || value < 0)
+                return "error: TOP <n> [DAY <yyyy-mm-dd> | ROOM <r>]\n";
+            std::string text;
+            leaderboard.top(s, value, count, [&](uint32_t rank, const ScoreRecord &game) { text += formatGame(rank, game); });
+            return text;
+        }
+        if (command == "RANK")
+        {
+            std::string team;
+            std::getline(words >> std::ws, team);
+            const int64_t game = leaderboard.bestGame(team);
+            if (game < 0)
+                return "none\n";
+            return formatGame(leaderboard.rankOf(Leaderboard::SCOPE_ALL, 0, game), leaderboard.games()[game]);
+        }
+        if (command == "COUNT")
+            return std::to_string(leaderboard.count()) + "\n";
+        if (command == "WATCH")
+        {
+            client.watching = true;
+            return "";
+        }
+        return "error: unknown command\n";
+    }
+
+    void serve(Client &client)
+    {
+        char buffer[1024];
+        const ssize_t n = ::recv(client.fd, buffer, sizeof(buffer), 0);
+        if (n <= 0 || client.in.size() > 4096)
+        {
+            ::close(client.fd);
+            client.fd = -1;
+            return;
+        }
+        client.in.append(buffer, n);
+        for (size_t end; client.fd >= 0 && (end = client.in.find('\n')) != std::string::npos;)
+        {
+            std::string line = client.in.substr(0, end);
+            client.in.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            reply(client, answer(client, line));
+        }
+    }
+
+    // COMPLETIONS
+    std::map<uint8_t, std::string> teams; // the team in each room
+
+    // the room of a topic: 0 without a prefix, -1 if it is not one of a room
+    int roomOf(const std::string &topic, const std::string &subtopic)
+    {
+        if (topic == subtopic)
+            return 0;
+        unsigned room;
+        char rest[32];
+        if (sscanf(topic.c_str(), "room%u/%31s", &room, rest) != 2 || room > 255 || subtopic != rest)
+            return -1;
+        return room;
+    }
+
+    void onMessage(const std::string &topic, const std::string &payload)
+    {
+        int room = roomOf(topic, "team");
+        if (room >= 0)
+        {
+            teams[room] = payload;
+            return;
+        }
+        room = roomOf(topic, "esp_completion");
+        unsigned minute, second;
+        char end;
+        if (room < 0 || sscanf(payload.c_str(), "%u:%u%c", &minute, &second, &end) != 2 || second >= 60 || minute * 60 + second > 0xFFFF)
+            return;
+
+        auto team = teams.find(room);
+        const std::string name = team != teams.end() ? team->second : "room" + std::to_string(room);
+        if (team != teams.end())
+            teams.erase(team); // one game per team; the next one gets its own
+        const time_t now = time(nullptr);
+        const ScoreRecord record = ScoreRecord::make(now, dayOf(now), minute * 60 + second, room, name);
+        if (!append(record))
+            perror("cannot append to the log");
+        const uint32_t game = leaderboard.add(record);
+
+        const std::string line = "NEW " + formatGame(leaderboard.rankOf(Leaderboard::SCOPE_ALL, 0, game), record);
+        printf("%s", line.c_str());
+        fflush(stdout);
+        for (Client &client : clients)
+        {
+            if (client.watching && client.fd >= 0 && ::send(client.fd, line.data(), line.size(), MSG_NOSIGNAL) != (ssize_t)line.size())
+            {
+                ::close(client.fd);
+                client.fd = -1;
+            }
+        }
+    }
+
+    int listenOn(const std::string &path)
+    {
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        ::unlink(path.c_str());
+        if (fd < 0 || ::bind(fd, (sockaddr *)&address, sizeof(address)) != 0 || ::listen(fd, 16) != 0)
+            return -1;
+        return fd;
+    }
+
+    int query(const Options &options)
+    {
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, options.socket.c_str(), sizeof(address.sun_path) - 1);
+        if (fd < 0 || ::connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            fprintf(stderr, "no leaderboard at %s\n", options.socket.c_str());
+            return 1;
+        }
+        const Clock::time_point start = Clock::now();
+        const std::string line = options.query + "\n";
+        if (::send(fd, line.data(), line.size(), 0) != (ssize_t)line.size())
+            return 1;
+        std::string answer;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        {
+            answer.append(buffer, n);
+            fwrite(buffer, 1, n, stdout);
+            fflush(stdout);
+            const bool complete = answer == ".\n" || (answer.size() >= 3 && answer.compare(answer.size() - 3, 3, "\n.\n") == 0);
+            if (complete && strncasecmp(options.query.c_str(), "WATCH", 5) != 0)
+                break;
+        }
+        fprintf(stderr, "answered in %.3f ms\n", millisSince(start));
+        ::close(fd);
+        return 0;
+    }
+
+    bool generate(long count)
+    {
+        uint32_t seed = 12345;
+        auto random = [&seed](uint32_t range)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed % range;
+        };
+        const time_t now = time(nullptr);
+        std::vector<ScoreRecord> batch;
+        for (long i = 0; i < count; i++)
+        {
+            const time_t finished = now - random(2 * 365 * 86400);
+            const std::string team = "team" + std::to_string(random(count));
+            batch.push_back(ScoreRecord::make(finished, dayOf(finished), 5 * 60 + random(10 * 60), random(16), team));
+            if (batch.size() == 4096 || i + 1 == count)
+            {
+                const size_t size = batch.size() * sizeof(ScoreRecord);
+                if (::write(logFd, batch.data(), size) != (ssize_t)size)
+                    return false;
+                batch.clear();
+            }
+        }
+        return fdatasync(logFd) == 0;
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            const std::string name = argv[i];
+            const char *value = argv[i + 1];
+            if (name == "--broker")
+                options.broker = value;
+            else if (name == "--broker-port")
+                options.brokerPort = atoi(value);
+            else if (name == "--log")
+                options.log = value;
+            else if (name == "--socket")
+                options.socket = value;
+            else if (name == "--query")
+                options.query = value;
+            else if (name == "--generate")
+                options.generate = atol(value);
+            else
+                return false;
+        }
+        return (argc - 1) % 2 == 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s [--broker HOST] [--broker-port P] [--log FILE] [--socket PATH] [--generate N] [--query TEXT]\n", argv[0]);
+        return 2;
+    }
+    if (!options.query.empty())
+        return query(options);
+
+    if (!openLog(options.log))
+    {
+        fprintf(stderr, "%s is not a leaderboard log\n", options.log.c_str());
+        return 1;
+    }
+    if (options.generate > 0)
+    {
+        const bool written = generate(options.generate);
+        printf("%s %ld games to %s\n", written ? "appended" : "failed to append", options.generate, options.log.c_str());
+        return written ? 0 : 1;
+    }
+
+    const int listener = listenOn(options.socket);
+    if (listener < 0)
+    {
+        fprintf(stderr, "cannot listen on %s\n", options.socket.c_str());
+        return 1;
+    }
+    signal(SIGINT, [](int) { running = 0; });
+    signal(SIGTERM, [](int) { running = 0; });
+    signal(SIGPIPE, SIG_IGN);
+
+    MqttSocket mqtt;
+    mqtt.onMessage(onMessage);
+    Clock::time_point lastAttempt = Clock::now() - std::chrono::milliseconds(reconnectInterval);
+    printf("%u games, queries on %s\n", leaderboard.count(), options.socket.c_str());
+    fflush(stdout);
+
+    std::vector<pollfd> descriptors;
+    while (running)
+    {
+        if (!mqtt.connected() && millisSince(lastAttempt) >= reconnectInterval)
+        {
+            lastAttempt = Clock::now();
+            if (mqtt.connect(options.broker.c_str(), options.brokerPort, "leaderboard"))
+            {
+                for (const char *filter : {"esp_completion", "+/esp_completion", "team", "+/team"})
+                    mqtt.subscribe(filter);
+                printf("connected to the broker at %s:%u\n", options.broker.c_str(), options.brokerPort);
+                fflush(stdout);
+            }
+        }
+
+        descriptors.clear();
+        descriptors.push_back({listener, POLLIN, 0});
+        descriptors.push_back({mqtt.fd(), POLLIN, 0});
+        for (const Client &client : clients)
+            descriptors.push_back({client.fd, POLLIN, 0});
+        ::poll(descriptors.data(), descriptors.size(), 1000);
+
+        if (mqtt.connected())
+            mqtt.poll(0); // also keeps the connection alive
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            if (descriptors[2 + i].revents & (POLLIN | POLLHUP | POLLERR))
+                serve(clients[i]);
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client &client) { return client.fd < 0; }), clients.end());
+        if (descriptors[0].revents & POLLIN)
+        {
+            const int fd = ::accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+                clients.push_back({fd, "", false});
+        }
+    }
+
+    for (const Client &client : clients)
+        ::close(client.fd);
+    ::close(listener);
+    ::unlink(options.socket.c_str());
+    ::close(logFd);
+    return 0;
+}
@@ -0,0 +1,327 @@
+/**
+ * @brief Multi-room MQTT load generator (`[env:native_loadgen]`).
+ *
+ * Runs N virtual escape rooms against a real broker (e.g. a local mosquitto) to find where one broker and one
+ * Node-RED instance stop keeping up. Every room is a forked process running the unchanged firmware against the
+ * simulated HAL, bridged to the broker under its own client ID (`room<i>`) and topic prefix (`room<i>/`):
+ * whatever the firmware publishes is forwarded, and `room<i>/admin` is fed back in as the `admin` topic.
+ * A second connection per room plays the dashboard: it sends the admin commands and counts what arrives.
+ *
+ * Each room plays `--games` scripted games: '*' on the keypad, `wheels_solved` from the dashboard, the fuel pours
+ * with a `fuel_hint`, the star passcode, then three `global_reset`s. `wheels_solved` and `global_reset` are probes:
+ * the time from the dashboard sending them to the dashboard seeing the room's answer on `esp` is the end-to-end
+ * admin latency. `--speed` is virtual milliseconds per wall millisecond (1 = real time, 0 = as fast as possible).
+ *
+ *     .pio/build/native_loadgen/program --host 127.0.0.1 --rooms 1,4,8,12 --games 2 --speed 10
+ *
+ * For every room count it prints the publish throughput through the broker, the admin latency percentiles,
+ * probes that never got an answer, publishes dropped by the firmware's outbound queue (from its QUEUE metrics
+ * line) and publishes the dashboard never received.
+ */
+#include "scenario.h"
+#include "mqtt_socket.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+
+using namespace scenario;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct Options
+    {
+        std::string host = "127.0.0.1";
+        uint16_t port = 1883;
+        std::vector<int> rooms = {1, 2, 4, 8, 12};
+        int games = 2;
+        double speed = 1;
+    };
+
+    struct RoomReport
+    {
+        unsigned long published = 0;
+        unsigned long observed = 0;
+        unsigned long queueDropped = 0;
+        unsigned long games = 0;
+        unsigned long timeouts = 0;
+        double wallSeconds = 0;
+        std::vector<double> latenciesMs;
+        bool connected = false;
+    };
+
+    // ROOM PROCESS
+    std::string prefix;
+    MqttSocket link;      // the room's own connection to the broker
+    MqttSocket dashboard; // admin commands in, everything the room publishes out
+    size_t forwarded = 0; // into hal::sim::broker.published
+    double speed = 1;
+    Clock::time_point roomStart;
+    RoomReport report;
+
+    std::string awaitedPayload;
+    Clock::time_point probeSent;
+    bool probeAnswered = false;
+
+    double millisSince(Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); }
+
+    void onDashboardMessage(const std::string &topic, const std::string &payload)
+    {
+        if (topic.compare(0, prefix.size(), prefix) != 0)
+            return;
+        const std::string subtopic = topic.substr(prefix.size());
+        if (subtopic == "admin")
+            return;
+        report.observed++;
+        if (subtopic == "esp" && !probeAnswered && payload == awaitedPayload)
+        {
+            probeAnswered = true;
+            report.latenciesMs.push_back(millisSince(probeSent));
+        }
+        const size_t dropped = payload.find(" dropped=");
+        if (subtopic == "esp_metrics" && payload.rfind("QUEUE ", 0) == 0 && dropped != std::string::npos)
+            report.queueDropped = strtoul(payload.c_str() + dropped + 9, nullptr, 10);
+    }
+
+    // after every loop() pass: forward the publishes, take in admin messages and keep to the requested speed
+    void bridge()
+    {
+        const std::vector<hal::sim::Message> &published = hal::sim::broker.published;
+        for (; forwarded < published.size(); forwarded++)
+            link.publish(prefix + published[forwarded].topic, published[forwarded].payload);
+
+        double aheadMs = speed > 0 ? hal::millis() / speed - millisSince(roomStart) : 0;
+        do
+        {
+            pollfd descriptors[2] = {{link.fd(), POLLIN, 0}, {dashboard.fd(), POLLIN, 0}};
+            ::poll(descriptors, 2, aheadMs >= 1 ? (int)aheadMs : 0);
+            link.poll(0);
+            dashboard.poll(0);
+            aheadMs = speed > 0 ? hal::millis() / speed - millisSince(roomStart) : 0;
+        } while (aheadMs >= 1);
+    }
+
+    bool runUntilPublishedSince(size_t since, const char *topic, const char *payload, unsigned long timeoutMs)
+    {
+        const std::vector<hal::sim::Message> &published = hal::sim::broker.published;
+        for (unsigned long i = 0; i <= timeoutMs; i++)
+        {
+            for (size_t m = since; m < published.size(); m++)
+            {
+                if (published[m].topic == topic && published[m].payload == payload)
+                    return true;
+            }
+            since = published.size();
+            run(1);
+        }
+        return false;
+    }
+
+    bool probe(const char *command, const char *answer)
+    {
+        awaitedPayload = answer;
+        probeAnswered = false;
+        probeSent = Clock::now();
+        dashboard.publish(prefix + "admin", command);
+        while (!probeAnswered && millisSince(probeSent) < 5000)
+            run(1);
+        if (!probeAnswered)
+            report.timeouts++;
+        return probeAnswered;
+    }
+
+    bool playGame()
+    {
+        tapKey('*');
+        bool solved = probe("wheels_solved", "wheels_solved");
+
+        pour(0, 1);
+        dashboard.publish(prefix + "admin", "fuel_hint");
+        run(3000);
+        const size_t beforePours = hal::sim::broker.published.size();
+        for (const auto &p : poursAfterHint)
+            pour(p[0], p[1]);
+        solved = solved && runUntilPublishedSince(beforePours, "esp", "fuel_solved", 5000);
+
+        const size_t beforeKeys = hal::sim::broker.published.size();
+        for (char key : {'7', '0', '3', '1'})
+            tapKey(key);
+        solved = solved && runUntilPublishedSince(beforeKeys, "esp", "star_solved", 5000);
+
+        for (int i = 0; i < 3; i++)
+        {
+            probe("global_reset", "global_reset");
+            run(200);
+        }
+        return solved;
+    }
+
+    std::string runRoom(int index, const Options &options)
+    {
+        prefix = "room" + std::to_string(index) + "/";
+        speed = options.speed;
+        dashboard.onMessage(onDashboardMessage);
+        link.onMessage([](const std::string &topic, const std::string &payload)
+                       { hal::sim::broker.inject(topic.substr(prefix.size()), payload); });
+
+        const std::string clientId = "room" + std::to_string(index);
+        report.connected = dashboard.connect(options.host.c_str(), options.port, clientId + "-dashboard") &&
+                           dashboard.subscribe(prefix + "#") &&
+                           link.connect(options.host.c_str(), options.port, clientId) &&
+                           link.subscribe(prefix + "admin");
+        if (report.connected)
+        {
+            roomStart = Clock::now();
+            afterPass = bridge;
+            misalignWheels(); // only the dashboard solves the wheels
+            setup();
+            run(1000);
+            for (int g = 0; g < options.games; g++)
+            {
+                if (playGame())
+                    report.games++;
+            }
+            run(10000); // one more metrics summary
+            report.wallSeconds = millisSince(roomStart) / 1000;
+
+            // let the last publishes reach the dashboard
+            const Clock::time_point drainStart = Clock::now();
+            while (millisSince(drainStart) < 1000)
+                dashboard.poll(50);
+            report.published = link.published();
+        }
+
+        std::ostringstream line;
+        line << report.connected << ' ' << report.published << ' ' << report.observed << ' ' << report.queueDropped << ' '
+             << report.games << ' ' << report.timeouts << ' ' << report.wallSeconds;
+        for (double latency : report.latenciesMs)
+            line << ' ' << latency;
+        line << '\n';
+        return line.str();
+    }
+
+    // PARENT PROCESS
+    RoomReport parseReport(const std::string &line)
+    {
+        RoomReport room;
+        std::istringstream in(line);
+        in >> room.connected >> room.published >> room.observed >> room.queueDropped >> room.games >> room.timeouts >> room.wallSeconds;
+        double latency;
+        while (in >> latency)
+            room.latenciesMs.push_back(latency);
+        return room;
+    }
+
+    double percentile(std::vector<double> &values, double fraction)
+    {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+    }
+
+    bool runRooms(int numRooms, const Options &options)
+    {
+        std::vector<pid_t> children;
+        std::vector<int> pipes;
+        for (int i = 0; i < numRooms; i++)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+                return false;
+            const pid_t pid = fork();
+            if (pid == 0)
+            {
+                ::close(fds[0]);
+                const std::string line = runRoom(i + 1, options);
+                if (write(fds[1], line.data(), line.size()) < 0)
+                    _exit(1);
+                _exit(0);
+            }
+            ::close(fds[1]);
+            children.push_back(pid);
+            pipes.push_back(fds[0]);
+        }
+
+        RoomReport total;
+        double wallSeconds = 0;
+        int connected = 0;
+        for (int i = 0; i < numRooms; i++)
+        {
+            std::string line;
+            char buffer[4096];
+            ssize_t n;
+            while ((n = read(pipes[i], buffer, sizeof(buffer))) > 0)
+                line.append(buffer, n);
+            ::close(pipes[i]);
+            waitpid(children[i], nullptr, 0);
+
+            const RoomReport room = parseReport(line);
+            connected += room.connected;
+            total.published += room.published;
+            total.observed += room.observed;
+            total.queueDropped += room.queueDropped;
+            total.games += room.games;
+            total.timeouts += room.timeouts;
+            total.latenciesMs.insert(total.latenciesMs.end(), room.latenciesMs.begin(), room.latenciesMs.end());
+            wallSeconds = std::max(wallSeconds, room.wallSeconds);
+        }
+
+        if (connected < numRooms)
+        {
+            fprintf(stderr, "%d of %d rooms could not connect to %s:%u\n", numRooms - connected, numRooms, options.host.c_str(), options.port);
+            return false;
+        }
+        printf("%5d %7lu/%-3d %10.0f %9.2f %9.2f %9.2f %8lu %11lu %12lu\n", numRooms, total.games, numRooms * options.games,
+               wallSeconds > 0 ? total.published / wallSeconds : 0, percentile(total.latenciesMs, 0.5),
+               percentile(total.latenciesMs, 0.99), percentile(total.latenciesMs, 1.0), total.timeouts, total.queueDropped,
+               total.published > total.observed ? total.published - total.observed : 0);
+        fflush(stdout);
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string flag = argv[i];
+        const char *value = argv[i + 1];
+        if (flag == "--host")
+            options.host = value;
+        else if (flag == "--port")
+            options.port = atoi(value);
+        else if (flag == "--games")
+            options.games = atoi(value);
+        else if (flag == "--speed")
+            options.speed = atof(value);
+        else if (flag == "--rooms")
+        {
+            options.rooms.clear();
+            std::istringstream list(value);
+            std::string count;
+            while (std::getline(list, count, ','))
+                options.rooms.push_back(atoi(count.c_str()));
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--host h] [--port p] [--rooms 1,2,4] [--games n] [--speed x]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("broker %s:%u, %d games per room, speed %gx\n", options.host.c_str(), options.port, options.games, options.speed);
+    printf("rooms   games  publish/s   p50 (ms)  p99 (ms)  max (ms) timeouts queue drops broker drops\n");
+    for (int rooms : options.rooms)
+    {
+        if (!runRooms(rooms, options))
+            return 1;
+    }
+    return 0;
+}
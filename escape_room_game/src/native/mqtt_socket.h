@@ -0,0 +1,259 @@
+#ifndef MQTT_SOCKET_H
+#define MQTT_SOCKET_H
+
+/**
+ * @brief Minimal MQTT 3.1.1 client over a POSIX TCP socket, for the host tools that talk to a real broker.
+ *
+ * QoS 0 only: CONNECT with a clean session, SUBSCRIBE, PUBLISH and PINGREQ. `poll()` reads whatever arrived,
+ * hands every PUBLISH to the message handler and keeps the connection alive; everything else the broker sends
+ * (CONNACK, SUBACK, PINGRESP) is consumed silently.
+ */
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class MqttSocket
+{
+public:
+    typedef std::function<void(const std::string &topic, const std::string &payload)> MessageHandler;
+
+    MqttSocket() : _fd(-1), _keepAlive(30), _published(0), _received(0) {}
+    ~MqttSocket() { close(); }
+
+    bool connect(const char *host, uint16_t port, const std::string &clientId, uint16_t keepAliveSeconds = 30)
+    {
+        close();
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &addresses) != 0)
+            return false;
+        for (addrinfo *address = addresses; address && _fd < 0; address = address->ai_next)
+        {
+            _fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (_fd >= 0 && ::connect(_fd, address->ai_addr, address->ai_addrlen) != 0)
+                close();
+        }
+        freeaddrinfo(addresses);
+        if (_fd < 0)
+            return false;
+
+        const int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+
+        _keepAlive = keepAliveSeconds;
+        std::string body;
+        appendString(body, "MQTT");
+        body += (char)4;    // protocol level 3.1.1
+        body += (char)0x02; // clean session
+        body += (char)(keepAliveSeconds >> 8);
+        body += (char)(keepAliveSeconds & 0xFF);
+        appendString(body, clientId);
+        if (!sendPacket(0x10, body))
+            return false;
+
+        // wait for CONNACK
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            if (!poll(50))
+                return false;
+            if (_connackCode >= 0)
+                return _connackCode == 0;
+        }
+        close();
+        return false;
+    }
+
+    bool connected() const { return _fd >= 0; }
+    int fd() const { return _fd; }
+
+    void close()
+    {
+        if (_fd >= 0)
+            ::close(_fd);
+        _fd = -1;
+        _in.clear();
+        _connackCode = -1;
+    }
+
+    void onMessage(MessageHandler handler) { _handler = handler; }
+
+    bool subscribe(const std::string &filter)
+    {
+        if (++_packetId == 0)
+            _packetId = 1;
+        std::string body;
+        body += (char)(_packetId >> 8);
+        body += (char)(_packetId & 0xFF);
+        appendString(body, filter);
+        body += (char)0; // QoS 0
+        return sendPacket(0x82, body);
+    }
+
+    bool publish(const std::string &topic, const std::string &payload)
+    {
+        std::string body;
+        appendString(body, topic);
+        body += payload;
+        if (!sendPacket(0x30, body))
+            return false;
+        _published++;
+        return true;
+    }
+
+    /**
+     * Waits up to `timeoutMs` for data and processes every complete packet.
+     *
+     * @return False if the connection is gone.
+     */
+    bool poll(int timeoutMs)
+    {
+        if (_fd < 0)
+            return false;
+        pollfd descriptor = {_fd, POLLIN, 0};
+        if (::poll(&descriptor, 1, timeoutMs) > 0)
+        {
+            char buffer[4096];
+            for (;;)
+            {
+                const ssize_t n = recv(_fd, buffer, sizeof(buffer), 0);
+                if (n > 0)
+                {
+                    _in.append(buffer, n);
+                    continue;
+                }
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    close();
+                    return false;
+                }
+                break;
+            }
+            parse();
+        }
+
+        if (std::chrono::steady_clock::now() - _lastSent > std::chrono::seconds(_keepAlive / 2))
+            sendPacket(0xC0, std::string());
+        return _fd >= 0;
+    }
+
+    unsigned long published() const { return _published; }
+    unsigned long received() const { return _received; }
+
+private:
+    static void appendString(std::string &out, const std::string &text)
+    {
+        out += (char)(text.size() >> 8);
+        out += (char)(text.size() & 0xFF);
+        out += text;
+    }
+
+    bool sendPacket(uint8_t header, const std::string &body)
+    {
+        std::string packet(1, (char)header);
+        size_t length = body.size();
+        do
+        {
+            uint8_t digit = length % 128;
+            length /= 128;
+            packet += (char)(length > 0 ? digit | 0x80 : digit);
+        } while (length > 0);
+        packet += body;
+
+        size_t sent = 0;
+        while (_fd >= 0 && sent < packet.size())
+        {
+            const ssize_t n = send(_fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                sent += n;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                pollfd descriptor = {_fd, POLLOUT, 0};
+                ::poll(&descriptor, 1, 100);
+            }
+            else
+            {
+                close();
+            }
+        }
+        _lastSent = std::chrono::steady_clock::now();
+        return _fd >= 0;
+    }
+
+    void parse()
+    {
+        size_t offset = 0;
+        for (;;)
+        {
+            // fixed header: type and flags, then the remaining length in 1-4 bytes
+            size_t length = 0, position = offset + 1;
+            int shift = 0;
+            bool complete = false;
+            while (position < _in.size() && shift <= 21)
+            {
+                const uint8_t digit = _in[position++];
+                length |= (size_t)(digit & 0x7F) << shift;
+                shift += 7;
+                if (!(digit & 0x80))
+                {
+                    complete = true;
+                    break;
+                }
+            }
+            if (!complete || _in.size() - position < length)
+                break;
+
+            const uint8_t header = _in[offset];
+            const std::string body = _in.substr(position, length);
+            offset = position + length;
+
+            switch (header >> 4)
+            {
+            case 2: // CONNACK
+                _connackCode = body.size() >= 2 ? (uint8_t)body[1] : 0xFF;
+                break;
+            case 3: // PUBLISH
+            {
+                if (body.size() < 2)
+                    break;
+                const size_t topicLength = (uint8_t)body[0] << 8 | (uint8_t)body[1];
+                const size_t payloadStart = 2 + topicLength + (((header >> 1) & 0x03) ? 2 : 0);
+                _received++;
+                if (_handler && payloadStart <= body.size())
+                    _handler(body.substr(2, topicLength), body.substr(payloadStart));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        _in.erase(0, offset);
+    }
+
+    int _fd;
+    uint16_t _keepAlive;
+    uint16_t _packetId = 0;
+    int _connackCode = -1;
+    std::string _in;
+    std::chrono::steady_clock::time_point _lastSent;
+    MessageHandler _handler;
+    unsigned long _published;
+    unsigned long _received;
+};
+
+#endif /* MQTT_SOCKET_H */
@@ -0,0 +1,52 @@
+/**
+ * @brief Host replayer for input traces (`[env:native_replay]`).
+ *
+ * Drives the unchanged game logic from a trace recorded by an `INPUT_TRACE` build (see lib/Hal/InputTrace.h), on the
+ * virtual clock, so a 15 minute game replays in well under a second:
+ *
+ *     .pio/build/native_replay/program game.trace > game.outputs
+ *
+ * Prints every LED frame, output edge (relays, the transfer LED) and publish of the game loop, one per line, so two
+ * replays, or the replays of two firmware versions, can be compared with `diff`. A summary goes to stderr, and the
+ * exit status is 1 if the firmware read something else than what was recorded, e.g. after a change to the game
+ * logic. `-v` mixes the firmware's serial output into the outputs.
+ */
+#include "scenario.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+            hal::sim::verbose = true;
+        else
+            path = argv[i];
+    }
+    if (!path)
+    {
+        fprintf(stderr, "usage: %s [-v] <trace file>\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    const std::string recorded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file.good() && !file.eof())
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 2;
+    }
+
+    const auto wallStart = std::chrono::steady_clock::now();
+    const bool replayed = scenario::replay(recorded);
+    const double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+
+    fwrite(scenario::outputs.data(), 1, scenario::outputs.size(), stdout);
+    fprintf(stderr, "%s: %zu bytes, %lu passes, %.1f s of play replayed in %.0f ms%s\n", path, recorded.size(), scenario::loops,
+            hal::sim::nowMicros / 1e6, wallMs, replayed ? "" : ", DIVERGED from the recording");
+    return replayed ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+/**
+ * @brief Building blocks for scripted games against the simulated HAL, shared by the native host tools.
+ *
+ * Each millisecond of the virtual clock runs one `loop()` pass, unless the loop sleeps (see Room::idle), and one pass of
+ * the cooperative tasks. A tool can hook `afterPass` to do its own work between passes (pacing, bridging to a real
+ * broker).
+ *
+ * The helpers play `scenario::room`: the one of main.cpp, unless the thread runs a room of its own (see games.cpp).
+ */
+#include "../../include/Room.h"
+#include <cstring>
+#include <string>
+
+extern Room room;
+
+namespace scenario
+{
+    const char keys[] = "123 456 789 *0# N";
+
+    const uint8_t transferButtonPin = 35;
+    const uint8_t fillingPins[3] = {25, 26, 27};
+    const uint8_t relayPins[3] = {13, 12, 14}; // wheels, fuel, stars
+
+    // 8,0,0 -> 3,5,0 -> (hint) 3,2,3 -> 6,2,0 -> 6,0,2 -> 1,5,2 -> 1,4,3
+    const int poursAfterHint[][2] = {{2, 0}, {1, 2}, {0, 1}, {1, 2}};
+
+    inline thread_local Room *room = &::room;
+    inline thread_local unsigned long loops = 0;
+    inline void (*afterPass)() = nullptr;
+
+    // boots the room, like the firmware's setup()
+    inline void setup() { room->setup(); }
+
+    inline void run(unsigned long ms)
+    {
+        for (unsigned long i = 0; i < ms; i++)
+        {
+            if (!hal::sim::sleeping())
+            {
+                room->loop();
+                loops++;
+            }
+            hal::sim::stepTasks(); // the network task
+            hal::sim::advanceMillis(1);
+            if (afterPass)
+                afterPass();
+        }
+    }
+
+    // the wheel reeds, both on the shift register chain and on the single line of the original wiring (HIGH once all
+    // are closed): every wheel off its constellation, one turned to it, or all
+    inline void setWheelReeds(uint32_t closed)
+    {
+        hal::sim::shiftInputs = closed;
+        hal::sim::setPin(wheelsLinePin, closed == Wheels::Reeds::allReeds ? HIGH : LOW);
+    }
+    inline void misalignWheels() { setWheelReeds(0); }
+    inline void alignWheel(int wheel) { setWheelReeds(hal::sim::shiftInputs | 1u << wheel); }
+    inline void alignWheels() { setWheelReeds(Wheels::Reeds::allReeds); }
+
+    inline bool runUntilPublished(const char *topic, const char *payload, unsigned long timeoutMs)
+    {
+        for (unsigned long i = 0; i < timeoutMs; i++)
+        {
+            if (hal::sim::broker.sawPublish(topic, payload))
+                return true;
+            run(1);
+        }
+        return hal::sim::broker.sawPublish(topic, payload);
+    }
+
+    // INPUT TRACES
+    // A recording collects the trace and the outputs of the game loop (see hal::sim::outputLog) into strings.
+    inline std::string trace;
+    inline std::string outputs;
+
+    inline void logPublish(const char *topic, const char *payload) { hal::sim::logOutput("publish %s %s", topic, payload); }
+
+    inline inputtrace::Writer &startRecording()
+    {
+        static inputtrace::Writer writer([](const uint8_t *data, size_t size) { trace.append((const char *)data, size); });
+        hal::sim::outputLog = &outputs;
+        hal::trace().onPublish = logPublish;
+        hal::sim::record(writer);
+        return writer;
+    }
+
+    /**
+     * Plays `recorded` back through setup() and one loop() pass per recorded pass, with the outputs going to
+     * `outputs`. Needs a fresh room, i.e. one that has not run setup() yet.
+     *
+     * @return False if the trace is not one, or the firmware read something else than what was recorded.
+     */
+    inline bool replay(const std::string &recorded)
+    {
+        static inputtrace::Reader reader(nullptr, 0);
+        reader = inputtrace::Reader((const uint8_t *)recorded.data(), recorded.size());
+        hal::sim::outputLog = &outputs;
+        hal::trace().onPublish = logPublish;
+        if (!reader.valid() || !hal::sim::replay(reader))
+            return false;
+        setup();
+        while (reader.nextPass() && hal::trace().replaying())
+        {
+            room->loop();
+            hal::sim::stepTasks();
+            loops++;
+        }
+        return !reader.diverged();
+    }
+
+    inline void tapKey(char key, unsigned long holdMs = 100)
+    {
+        hal::sim::pressKey(strchr(keys, key) - keys);
+        run(holdMs);
+        hal::sim::releaseKey();
+        run(holdMs);
+    }
+
+    inline void pour(int from, int to)
+    {
+        // the hose has a diode in it: the fuel flows from `from` when `to` drives its end low
+        hal::sim::linkPins(fillingPins[to], fillingPins[from]);
+        run(50); // let the hose scanner debounce the new connection
+        hal::sim::setPin(transferButtonPin, LOW);
+        run(10);
+        hal::sim::releasePin(transferButtonPin);
+        run(3000);
+        hal::sim::unlinkPin(fillingPins[from]);
+        run(10);
+    }
+}
+
+#endif /* SCENARIO_H */
@@ -0,0 +1,413 @@
+/**
+ * @brief Host-side driver for the native build.
+ *
+ * Runs the unchanged firmware (`setup()` / `loop()` from main.cpp) against the simulated HAL and plays a
+ * scripted game from READY through SOLVED: '*' on the keypad, aligning the wheels, the optimal fuel pours
+ * (one of them poured by a hint), a wrong star passcode and then the right one, typed quickly while the keypad
+ * still blinks for the wrong one, then asks for a journal dump. Every `loop()` pass advances the virtual clock
+ * by one millisecond, so a full game runs at native speed and can be profiled with the usual host tools.
+ *
+ * The keypad must not be scanned while nobody touches it, and every compartment relay must have played its opening
+ * sequence exactly once, with every edge on the microsecond. After the game, '#' and then '*' must be acted on within
+ * keyBoundMs of the key going down, although the loop sleeps in between (see Room::idle), and the idle room's duty
+ * cycle is reported. The wheels are scrambled before that second game, which must not take them as still solved.
+ *
+ * Before that, two forked processes check resuming after a brownout in the fuel puzzle: the first plays up to it and
+ * hands its RTC memory and NVS over, the second boots from scratch with them, must show the same stage, fuel LEDs and
+ * countdown within a few hundred milliseconds, and plays the game to the end. This is done once with the RTC memory
+ * and once with only the NVS copy. The second boot must also take the fast path: the cached access point and broker,
+ * without the WiFiManager portal or an mDNS lookup.
+ *
+ * A third pair records the input trace of a whole game and replays it in a fresh process, which must produce
+ * byte-identical LED frames, output edges and publishes.
+ */
+#include "scenario.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace scenario;
+
+namespace
+{
+    // everything that survives a brownout, plus what the board showed right before it
+    struct CrashState
+    {
+        uint8_t rtcMemory[sizeof(hal::sim::rtcMemory)];
+        int displayedMinute;
+        int displayedSecond;
+        uint32_t fuelPixels[16];
+    };
+
+    // the payload after `prefix` of the latest publish on `topic` that starts with it
+    const char *lastPublished(const char *topic, const char *prefix)
+    {
+        for (auto it = hal::sim::broker.published.rbegin(); it != hal::sim::broker.published.rend(); ++it)
+        {
+            if (it->topic == topic && it->payload.rfind(prefix, 0) == 0)
+                return it->payload.c_str() + strlen(prefix);
+        }
+        return nullptr;
+    }
+
+    // one debounce time, and a pass to act on the key
+    const unsigned long keyBoundMs = KeypadDriver::debounceMs + 2;
+
+    // holds `key` down until the room leaves `from`: how many ms that took, or 0 if it did not
+    unsigned long keyLatency(char key, stage from)
+    {
+        hal::sim::pressKey(strchr(keys, key) - keys);
+        unsigned long ms = 0;
+        while (scenario::room->currentStage == from && ms < 200)
+        {
+            run(1);
+            ms++;
+        }
+        hal::sim::releaseKey();
+        run(100);
+        return scenario::room->currentStage == from ? 0 : ms;
+    }
+
+    bool readAll(int fd, void *data, size_t size)
+    {
+        for (size_t done = 0; done < size;)
+        {
+            const ssize_t n = read(fd, (char *)data + done, size - done);
+            if (n <= 0)
+                return false;
+            done += n;
+        }
+        return true;
+    }
+
+    bool readString(int fd, std::string &data)
+    {
+        uint32_t size = 0;
+        if (!readAll(fd, &size, sizeof(size)))
+            return false;
+        data.resize(size);
+        return readAll(fd, &data[0], size);
+    }
+
+    bool writeString(int fd, const std::string &data)
+    {
+        const uint32_t size = data.size();
+        return write(fd, &size, sizeof(size)) == sizeof(size) && write(fd, data.data(), size) == (ssize_t)size;
+    }
+
+    void playUntilBrownout(int fd)
+    {
+        misalignWheels();
+        setup();
+        run(1000);
+        tapKey('*');
+        hal::sim::broker.inject("admin", "wheels_hint");
+        alignWheels();
+        run(100);
+        pour(0, 1);
+        hal::sim::broker.inject("admin", "fuel_hint");
+        run(8000); // the hint pours, and the levels reach NVS
+
+        CrashState state;
+        memcpy(state.rtcMemory, hal::sim::rtcMemory, sizeof(state.rtcMemory));
+        state.displayedMinute = hal::sim::displayedMinute;
+        state.displayedSecond = hal::sim::displayedSecond;
+        for (int i = 0; i < 16; i++)
+            state.fuelPixels[i] = hal::sim::frame[i];
+        std::string nvs;
+        for (const auto &blob : hal::sim::storage)
+        {
+            const uint32_t sizes[2] = {(uint32_t)blob.first.size(), (uint32_t)blob.second.size()};
+            nvs.append((const char *)sizes, sizeof(sizes)).append(blob.first).append(blob.second.begin(), blob.second.end());
+        }
+        const uint32_t nvsSize = nvs.size();
+        if (write(fd, &state, sizeof(state)) < 0 || write(fd, &nvsSize, sizeof(nvsSize)) < 0 || write(fd, nvs.data(), nvs.size()) < 0)
+            _exit(1);
+    }
+
+    bool resumeAfterBrownout(const CrashState &state, const std::string &nvs, bool keepRtcMemory)
+    {
+        for (size_t offset = 0; offset + 8 <= nvs.size();)
+        {
+            uint32_t sizes[2];
+            memcpy(sizes, nvs.data() + offset, sizeof(sizes));
+            offset += sizeof(sizes);
+            const std::string key = nvs.substr(offset, sizes[0]);
+            hal::sim::storage[key].assign(nvs.begin() + offset + sizes[0], nvs.begin() + offset + sizes[0] + sizes[1]);
+            offset += sizes[0] + sizes[1];
+        }
+        if (keepRtcMemory)
+            memcpy(hal::sim::rtcMemory, state.rtcMemory, sizeof(state.rtcMemory));
+        hal::sim::resetReason = 9; // ESP_RST_BROWNOUT
+
+        // the fuel LEDs and the countdown are back before the network is
+        const int crashSeconds = state.displayedMinute * 60 + state.displayedSecond;
+        setup();
+        bool restored = false;
+        unsigned long restoredAfter = 0;
+        while (restoredAfter < 300 && !restored)
+        {
+            run(1);
+            restoredAfter++;
+            const int shownSeconds = hal::sim::displayedMinute * 60 + hal::sim::displayedSecond;
+            restored = hal::sim::frame.size() >= 16 && memcmp(hal::sim::frame.data(), state.fuelPixels, sizeof(state.fuelPixels)) == 0 &&
+                       shownSeconds >= crashSeconds && shownSeconds <= crashSeconds + (keepRtcMemory ? 0 : 6);
+        }
+
+        for (const auto &p : poursAfterHint)
+            pour(p[0], p[1]);
+        bool solved = runUntilPublished(ESP_TOPIC, "fuel_solved", 5000);
+        for (char key : {'7', '0', '3', '1'})
+            tapKey(key);
+        solved = solved && runUntilPublished(ESP_TOPIC, "star_solved", 5000);
+
+        // the dashboard learns about the wheels again, and their compartment stays shut
+        bool caughtUp = hal::sim::broker.sawPublish(ESP_TOPIC, "wheels_solved") && !hal::sim::broker.sawPublish(ESP_TOPIC, "global_reset");
+        for (const hal::sim::Edge &edge : hal::sim::edges)
+            caughtUp = caughtUp && edge.pin != relayPins[0];
+        const bool fastBoot = hal::sim::wifiCachedConnects == 1 && hal::sim::wifiPortalConnects == 0 && hal::sim::mdnsQueries == 0;
+
+        printf("resume from %s: %s after %lu ms, %s%s%s\n", keepRtcMemory ? "RTC" : "NVS", restored ? "restored" : "NOT restored",
+               restoredAfter, solved ? "SOLVED" : "NOT SOLVED", caughtUp ? "" : ", dashboard or wheels relay wrong",
+               fastBoot ? "" : ", slow boot path");
+        if (const char *boot = lastPublished("esp_metrics", "BOOT "))
+            printf("  boot: %s\n", boot);
+        return restored && solved && caughtUp && fastBoot;
+    }
+
+    // each side of the brownout in its own process, so the resumed firmware starts from a fresh room
+    bool checkBrownoutResume(bool keepRtcMemory)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return false;
+        fflush(stdout);
+        const pid_t player = fork();
+        if (player == 0)
+        {
+            ::close(fds[0]);
+            playUntilBrownout(fds[1]);
+            _exit(0);
+        }
+        ::close(fds[1]);
+        CrashState state;
+        uint32_t nvsSize = 0;
+        bool received = readAll(fds[0], &state, sizeof(state)) && readAll(fds[0], &nvsSize, sizeof(nvsSize));
+        std::string nvs(received ? nvsSize : 0, '\0');
+        received = received && readAll(fds[0], &nvs[0], nvs.size());
+        ::close(fds[0]);
+        waitpid(player, nullptr, 0);
+        if (!received)
+            return false;
+
+        const pid_t resumed = fork();
+        if (resumed == 0)
+        {
+            const bool ok = resumeAfterBrownout(state, nvs, keepRtcMemory);
+            fflush(stdout);
+            _exit(ok ? 0 : 1);
+        }
+        int status = 1;
+        waitpid(resumed, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    void recordGame(int fd)
+    {
+        inputtrace::Writer &writer = startRecording();
+        misalignWheels();
+        setup();
+        run(1000);
+        tapKey('*');
+        hal::sim::broker.inject("admin", "wheels_hint");
+        alignWheels();
+        run(100);
+        pour(0, 1);
+        hal::sim::broker.inject("admin", "fuel_hint");
+        run(3000);
+        for (const auto &p : poursAfterHint)
+            pour(p[0], p[1]);
+        runUntilPublished(ESP_TOPIC, "fuel_solved", 5000);
+        for (char key : {'5', '5', '5', '5', '7', '0', '3', '1'})
+            tapKey(key);
+        runUntilPublished(ESP_TOPIC, "star_solved", 5000);
+        hal::sim::broker.inject("admin", "journal_dump");
+        run(1500);
+        writer.finish();
+        if (!writeString(fd, trace) || !writeString(fd, outputs) || write(fd, &hal::sim::nowMicros, sizeof(hal::sim::nowMicros)) < 0)
+            _exit(1);
+    }
+
+    // the recording and the replay each in their own process, so both start from a fresh room
+    bool checkReplay()
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return false;
+        fflush(stdout);
+        const pid_t recorder = fork();
+        if (recorder == 0)
+        {
+            ::close(fds[0]);
+            recordGame(fds[1]);
+            _exit(0);
+        }
+        ::close(fds[1]);
+        std::string recorded, expected;
+        int64_t playedMicros = 0;
+        const bool received = readString(fds[0], recorded) && readString(fds[0], expected) && readAll(fds[0], &playedMicros, sizeof(playedMicros));
+        ::close(fds[0]);
+        waitpid(recorder, nullptr, 0);
+        if (!received)
+            return false;
+
+        const pid_t player = fork();
+        if (player == 0)
+        {
+            const auto wallStart = std::chrono::steady_clock::now();
+            const bool replayed = replay(recorded);
+            const double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+            const bool identical = replayed && outputs == expected;
+            printf("replay:         %zu byte trace of %.1f s, %lu passes in %.0f ms, %zu output bytes %s\n", recorded.size(),
+                   playedMicros / 1e6, loops, wallMs, outputs.size(), identical ? "identical" : replayed ? "DIFFERENT" : "DIVERGED");
+            fflush(stdout);
+            _exit(identical ? 0 : 1);
+        }
+        int status = 1;
+        waitpid(player, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    // HIGH 500 ms, LOW 200 ms, HIGH 500 ms, then LOW, measured from the first edge, among the edges before `until`
+    bool checkRelayPulses(uint8_t pin, int64_t until)
+    {
+        const uint8_t levels[] = {HIGH, LOW, HIGH, LOW};
+        const int64_t offsets[] = {0, 500000, 700000, 1200000};
+        std::vector<hal::sim::Edge> edges;
+        for (const hal::sim::Edge &edge : hal::sim::edges)
+        {
+            if (edge.pin == pin && edge.micros < until)
+                edges.push_back(edge);
+        }
+        bool exact = edges.size() == 4;
+        for (size_t i = 0; exact && i < edges.size(); i++)
+            exact = edges[i].level == levels[i] && edges[i].micros - edges[0].micros == offsets[i];
+
+        printf("relay %-2u edges:", pin);
+        for (const hal::sim::Edge &edge : edges)
+            printf(" %s@+%lldus", edge.level ? "H" : "L", (long long)(edge.micros - edges[0].micros));
+        printf("%s\n", exact ? "" : "  (expected H@+0 L@+500000 H@+700000 L@+1200000)");
+        return exact;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    hal::sim::verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    const bool resumes = checkBrownoutResume(true) && checkBrownoutResume(false);
+    const bool replays = checkReplay();
+
+    const auto wallStart = std::chrono::steady_clock::now();
+
+    misalignWheels();
+    setup();
+    run(100);
+
+    // a broker blip before the game starts: the link backs off and reconnects on its own
+    const unsigned long scansBeforeIdle = hal::sim::keypadScans;
+    hal::sim::broker.reachable = false;
+    run(3000);
+    hal::sim::broker.reachable = true;
+    run(2000);
+    const unsigned long idleScans = hal::sim::keypadScans - scansBeforeIdle;
+
+    tapKey('*');
+    hal::sim::broker.inject("admin", "wheels_hint");
+
+    // the hint points at the first wrong wheel, and moves on as the players turn them one by one
+    for (int wheel = 0; wheel < numWheels; wheel++)
+    {
+        alignWheel(wheel);
+        run(300);
+    }
+    bool solved = runUntilPublished(ESP_TOPIC, "wheels_solved", 1000);
+    const long wheelReports = std::count_if(hal::sim::broker.published.begin(), hal::sim::broker.published.end(),
+                                            [](const hal::sim::Message &message) { return message.topic == ESP_WHEELS_TOPIC; });
+
+    pour(0, 1);
+    hal::sim::broker.inject("admin", "fuel_hint");
+    run(3000);
+    for (const auto &p : poursAfterHint)
+        pour(p[0], p[1]);
+    solved = solved && runUntilPublished(ESP_TOPIC, "fuel_solved", 5000);
+
+    for (char key : {'1', '2', '3', '4'})
+        tapKey(key);
+    for (char key : {'7', '0', '3', '1'})
+        tapKey(key, 40);
+    solved = solved && runUntilPublished(ESP_TOPIC, "star_solved", 5000);
+
+    // the network task streams the event journal out in chunks, one per pass, while the last compartment opens
+    hal::sim::broker.inject("admin", "journal_dump");
+    run(1500);
+    const char *journalEnd = lastPublished("esp_journal", "end ");
+
+    // back to READY, the wheels scrambled for the next team, a few seconds of nobody in the room, and a new game
+    const int64_t gameEnd = hal::sim::nowMicros;
+    const unsigned long resetMs = keyLatency('#', SOLVED);
+    misalignWheels();
+    const unsigned long loopsBeforeIdle = loops;
+    const unsigned long idleMs = 20000; // two metrics intervals, so at least one IDLE line is all READY
+    run(idleMs);
+    const unsigned long idlePasses = loops - loopsBeforeIdle;
+    const char *idleLine = lastPublished("esp_metrics", "IDLE ");
+    const std::string idleMetrics = idleLine ? idleLine : "none";
+    // a pass takes no virtual time here, so the duty cycle is the part of the 1 ms ticks that ran one
+    const double idleDuty = (double)idlePasses / idleMs;
+    const double idleMilliamps = IdleMode::awakeMilliamps * idleDuty + IdleMode::idleMilliamps * (1 - idleDuty);
+    const unsigned long startMs = keyLatency('*', READY);
+    const bool keysInBound = resetMs > 0 && resetMs <= keyBoundMs && startMs > 0 && startMs <= keyBoundMs;
+
+    // the wheels of the last game must not count for this one
+    run(500);
+    const bool rescrambled = scenario::room->currentStage == WHEELS;
+    alignWheels();
+    run(100);
+    const bool secondGame = rescrambled && scenario::room->currentStage == FUEL;
+
+    const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    printf("result:         %s\n", solved ? "SOLVED" : "NOT SOLVED");
+    printf("loop() passes:  %lu\n", loops);
+    printf("virtual time:   %.3f s\n", hal::sim::nowMicros / 1e6);
+    printf("wall time:      %.3f s\n", wallSeconds);
+    printf("loop() rate:    %.0f /s\n", loops / wallSeconds);
+    printf("frames shown:   %lu (%lu out of WS2812B timing)\n", hal::sim::framesShown, hal::sim::frameTimingErrors);
+    printf("keypad scans:   %lu (%lu while idle)\n", hal::sim::keypadScans, idleScans);
+    printf("publishes:      %zu\n", hal::sim::broker.published.size());
+    if (const char *wheels = lastPublished(ESP_WHEELS_TOPIC, "aligned="))
+        printf("wheels:         %ld progress reports, the last aligned=%s\n", wheelReports, wheels);
+    printf("journal dump:   %s records\n", journalEnd ? journalEnd : "none");
+    printf("idle READY:     %lu passes in %lu ms, duty %.1f%%, est. %.1f mA (IDLE %s)\n", idlePasses, idleMs, 100 * idleDuty,
+           idleMilliamps, idleMetrics.c_str());
+    printf("key latency:    '#' %lu ms, '*' %lu ms (bound %lu ms)\n", resetMs, startMs, keyBoundMs);
+    printf("second game:    %s\n", secondGame ? "wheels scrambled again, solved again" : rescrambled ? "wheels NOT solved" : "wheels solved by the LAST game");
+    if (const char *link = lastPublished("esp_metrics", "MQTT "))
+        printf("broker link:    %s\n", link);
+    if (const char *outbox = lastPublished("esp_metrics", "OUTBOX "))
+        printf("outbox:         %s\n", outbox);
+    if (const char *boot = lastPublished("esp_metrics", "BOOT "))
+        printf("boot:           %s\n", boot);
+    if (const char *leds = lastPublished("esp_metrics", "LEDS "))
+        printf("leds:           %s\n", leds);
+
+    bool relaysExact = true;
+    for (uint8_t pin : relayPins)
+        relaysExact = checkRelayPulses(pin, gameEnd) && relaysExact;
+
+    return solved && resumes && replays && relaysExact && keysInBound && secondGame && idleScans == 0 && hal::sim::frameTimingErrors == 0 &&
+                   scenario::room->animator.dropped() == 0 ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+/**
+ * @brief Firmware of a room's I/O node (`[env:esp32_node]`): the room's ESP32 when its game runs in the controller
+ * daemon (src/native/daemon.cpp).
+ *
+ * The node knows nothing about the puzzles. It joins the Wi-Fi, finds the daemon through its `_escape-io._tcp` mDNS
+ * service and says which room it is (`IO_ROOM`, a build flag). From then on it streams the levels of the input pins,
+ * the key held on the keypad, the wheel reeds and the hose connections of the scanned pins to the daemon, and drives
+ * the relays, the NeoPixel strip and the timer display as the daemon tells it (lib/IoLink/IoLink.h). Which pins are
+ * what comes from the daemon's CONFIG frame, so a new puzzle only needs a restart of the daemon. The pins the node
+ * drives itself are never handed over.
+ *
+ * When the connection drops, the outputs are set LOW, which keeps the compartments shut, and the node reconnects.
+ */
+#include "globals.h"
+#include <IoLink.h>
+
+#ifndef IO_ROOM
+#define IO_ROOM 0
+#endif
+
+namespace
+{
+    const unsigned long scanInterval = 5;    // ms between two scans of the hose matrix, as the firmware does
+    const unsigned long lookupTimeout = 2000; // ms for one mDNS query for the daemon
+
+    hal::NetClient daemon;
+    hal::IPAddress daemonIp;
+    bool lookingUp = false;
+    iolink::Decoder decoder;
+
+    hal::Keypad keypad(0x20);
+    hal::Strip strip(numFuelLeds + numStarLeds + 1 + numKeypadLeds, ledsPin);
+    hal::SegmentDisplay display(0x70);
+    hal::ShiftInChain reeds(wheelReedsLatchPin, (numWheels + 7) / 8);
+    bool stripDirty = false;
+
+    // as configured by the daemon
+    uint64_t inputPins = 0;
+    uint64_t outputPins = 0;
+    uint64_t scannedPins = 0;
+
+    // as last sent to the daemon
+    uint64_t sentLevels = 0;
+    uint8_t sentKey = 0xff;
+    uint32_t sentReeds = 0;
+    unsigned long sentAt = 0;
+    uint8_t key = 16; // no key
+    uint32_t closedReeds = 0;
+    uint8_t links[2 * iolink::numPins];
+    size_t linksLength = 0;
+    bool linksDirty = true;
+    unsigned long lastScan = 0;
+    unsigned long lastReedsRead = 0;
+
+    void send(uint8_t type, const uint8_t *payload, size_t length)
+    {
+        uint8_t frame[iolink::maxFrame];
+        daemon.write(frame, iolink::encode(frame, type, payload, length));
+    }
+
+    void releaseOutputs()
+    {
+        for (int pin = 0; pin < iolink::numPins; pin++)
+        {
+            if (outputPins & (1ull << pin))
+                hal::digitalWrite(pin, LOW);
+        }
+    }
+
+    /**
+     * Looks the daemon up and connects to it, a step per call so the keypad and the matrix keep being read.
+     *
+     * @return True once connected and introduced.
+     */
+    bool connectDaemon()
+    {
+        if (daemon.connected())
+            return true;
+        if (!lookingUp)
+        {
+            lookingUp = hal::mdnsQueryStart("escape-io", "tcp", lookupTimeout);
+            return false;
+        }
+        hal::mdnsQueryStatus status = hal::mdnsQueryPoll(daemonIp);
+        if (status == hal::MDNS_QUERY_PENDING)
+            return false;
+        lookingUp = false;
+        if (status != hal::MDNS_QUERY_FOUND || !daemon.connect(daemonIp, iolink::port, 1000))
+            return false;
+
+        daemon.setNoDelay(true);
+        decoder = iolink::Decoder();
+        const uint8_t hello[2] = {iolink::version, IO_ROOM};
+        send(iolink::FRAME_HELLO, hello, sizeof(hello));
+        sentKey = 0xff; // everything again for the new connection
+        linksDirty = true;
+        Serial.println("Connected to the daemon");
+        return true;
+    }
+
+    void applyFrame()
+    {
+        const uint8_t *payload = decoder.payload();
+        switch (decoder.type())
+        {
+        case iolink::FRAME_CONFIG:
+            if (decoder.length() < iolink::pinSetSize)
+                break;
+            releaseOutputs();
+            scannedPins = iolink::getPinSet(payload) & ~nodeOwnedPins;
+            inputPins = outputPins = 0;
+            for (int pin = 0; pin < iolink::numPins; pin++)
+            {
+                if (scannedPins & (1ull << pin))
+                    hal::pinMode(pin, INPUT_PULLUP); // gpioDriveLow() only switches the output driver on and off
+            }
+            for (int i = iolink::pinSetSize; i + 1 < decoder.length(); i += 2)
+            {
+                const uint8_t pin = payload[i];
+                const uint8_t mode = payload[i + 1];
+                if (pin >= iolink::numPins || (nodeOwnedPins & (1ull << pin)))
+                    continue;
+                hal::pinMode(pin, mode);
+                if (mode == OUTPUT)
+                    outputPins |= 1ull << pin;
+                else
+                    inputPins |= 1ull << pin;
+            }
+            sentKey = 0xff;
+            break;
+        case iolink::FRAME_PINS:
+            for (int i = 0; i + 1 < decoder.length(); i += 2)
+            {
+                if (outputPins & (1ull << payload[i]))
+                    hal::digitalWrite(payload[i], payload[i + 1]);
+            }
+            break;
+        case iolink::FRAME_LEDS:
+            for (int i = 0; 1 + 3 * i + 2 < decoder.length(); i++)
+                strip.setPixelColor(payload[0] + i, hal::Strip::Color(payload[1 + 3 * i], payload[2 + 3 * i], payload[3 + 3 * i]));
+            stripDirty = true;
+            break;
+        case iolink::FRAME_DISPLAY:
+            if (decoder.length() >= 2)
+                display.displayTime(payload[0], payload[1]);
+            break;
+        }
+    }
+
+    // which scanned pin pulls which other one LOW, one drive/read/release step per pin as in HoseMatrix
+    void scanMatrix()
+    {
+        uint8_t scan[sizeof(links)];
+        size_t length = 0;
+        for (int driven = 0; driven < iolink::numPins; driven++)
+        {
+            const uint64_t driverMask = 1ull << driven;
+            if (!(scannedPins & driverMask))
+                continue;
+            const uint64_t pulledLow = hal::gpioProbeLow(driven, scannedPins);
+            for (int pulled = 0; pulled < iolink::numPins && length + 2 <= sizeof(scan); pulled++)
+            {
+                if (pulledLow & (1ull << pulled))
+                {
+                    scan[length++] = driven;
+                    scan[length++] = pulled;
+                }
+            }
+        }
+        if (length != linksLength || memcmp(scan, links, length) != 0)
+        {
+            memcpy(links, scan, length);
+            linksLength = length;
+            linksDirty = true;
+        }
+    }
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    hal::pinMode(ledsPin, OUTPUT);
+    strip.begin();
+    strip.show();
+
+    hal::i2cBegin(400000);
+    if (keypad.begin() == false)
+    {
+        Serial.println("\nERROR: cannot communicate to keypad.\n");
+    }
+    hal::pinMode(keypadIntPin, INPUT_PULLUP);
+    display.begin();
+    display.displayOn();
+    display.setDigits(4);
+    reeds.begin();
+
+    if (!hal::wifiAutoConnect("escape_room_node_AP", 60))
+    {
+        Serial.println("Failed to connect and hit timeout");
+    }
+    hal::mdnsBegin("escape-room-node");
+}
+
+void loop()
+{
+    if (!connectDaemon())
+    {
+        releaseOutputs();
+        return;
+    }
+
+    while (daemon.available() > 0)
+    {
+        if (decoder.push(daemon.read()))
+            applyFrame();
+    }
+    if (stripDirty && !strip.busy())
+    {
+        strip.show();
+        stripDirty = false;
+    }
+
+    // the INT line of the PCF8574 goes LOW on a change and is released by the read
+    if (hal::digitalRead(keypadIntPin) == LOW)
+        key = keypad.getKey();
+
+    const unsigned long now = hal::millis();
+    if (scannedPins != 0 && now - lastScan >= scanInterval)
+    {
+        lastScan = now;
+        scanMatrix();
+    }
+    if (now != lastReedsRead)
+    {
+        lastReedsRead = now;
+        closedReeds = reeds.read(); // the daemon debounces them
+    }
+
+    const uint64_t levels = hal::gpioReadAll() & inputPins;
+    if (levels != sentLevels || key != sentKey || closedReeds != sentReeds || now - sentAt >= iolink::heartbeatMs)
+    {
+        uint8_t payload[iolink::inputsSize];
+        iolink::putPinSet(payload, levels);
+        payload[iolink::pinSetSize] = key;
+        iolink::putUint32(payload + iolink::pinSetSize + 1, closedReeds);
+        send(iolink::FRAME_INPUTS, payload, sizeof(payload));
+        sentLevels = levels;
+        sentKey = key;
+        sentReeds = closedReeds;
+        sentAt = now;
+    }
+    if (linksDirty)
+    {
+        send(iolink::FRAME_LINKS, links, linksLength);
+        linksDirty = false;
+    }
+}
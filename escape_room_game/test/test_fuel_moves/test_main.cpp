@@ -0,0 +1,108 @@
+/**
+ * @file test_main.cpp
+ * @brief Checks the compile-time fuel move table against a plain breadth-first search run on the host.
+ *
+ * `pio test -e native`. For every capacity set below, the search runs backwards from the goal states over the
+ * reversed pours and gives every state its shortest number of pours. Every table entry must have that distance,
+ * unsolvable ones included, and its move must be a legal pour into a state one pour closer to the goal.
+ */
+
+#include <FuelMoves.h>
+#include <unity.h>
+#include <queue>
+#include <stdio.h>
+#include <vector>
+
+void setUp() {}
+void tearDown() {}
+
+template <typename Moves>
+std::vector<uint8_t> searchDistances()
+{
+    std::vector<std::vector<int>> predecessors(Moves::numStates);
+    std::vector<uint8_t> distances(Moves::numStates, Moves::unsolvable);
+    std::queue<int> frontier;
+    for (int s = 0; s < Moves::numStates; s++)
+    {
+        int values[Moves::numTanks] = {};
+        Moves::decode(s, values);
+        if (Moves::isSolved(values))
+        {
+            distances[s] = 0;
+            frontier.push(s);
+        }
+        for (int from = 0; from < Moves::numTanks; from++)
+        {
+            for (int to = 0; to < Moves::numTanks; to++)
+            {
+                const int next = Moves::pour(s, from, to);
+                if (next >= 0)
+                    predecessors[next].push_back(s);
+            }
+        }
+    }
+
+    while (!frontier.empty())
+    {
+        const int s = frontier.front();
+        frontier.pop();
+        for (int previous : predecessors[s])
+        {
+            if (distances[previous] != Moves::unsolvable)
+                continue;
+            distances[previous] = distances[s] + 1;
+            frontier.push(previous);
+        }
+    }
+    return distances;
+}
+
+template <typename Moves>
+void checkTable()
+{
+    const std::vector<uint8_t> distances = searchDistances<Moves>();
+    int solvable = 0;
+    for (int s = 0; s < Moves::numStates; s++)
+    {
+        char state[48];
+        snprintf(state, sizeof(state), "state %d", s);
+        const typename Moves::Entry entry = Moves::table.entries[s];
+        TEST_ASSERT_EQUAL_UINT8_MESSAGE(distances[s], entry.distance, state);
+        if (entry.distance == Moves::unsolvable)
+            continue;
+        solvable++;
+
+        int values[Moves::numTanks] = {};
+        Moves::decode(s, values);
+        int from = -1, to = -1;
+        const bool hasMove = Moves::nextMove(values, from, to);
+        TEST_ASSERT_EQUAL_MESSAGE(entry.distance > 0, hasMove, state);
+        if (!hasMove)
+            continue;
+        const int next = Moves::pour(s, from, to);
+        TEST_ASSERT_TRUE_MESSAGE(next >= 0, state);
+        TEST_ASSERT_EQUAL_UINT8_MESSAGE(distances[s] - 1, distances[next], state);
+    }
+    TEST_ASSERT_TRUE(solvable > 0);
+}
+
+// the puzzle in the room, see Fuel
+void test_room_tanks() { checkTable<FuelMoves<4, 8, 5, 3>>(); }
+
+// a larger version of it, 10 pours at most
+void test_larger_tanks() { checkTable<FuelMoves<6, 12, 7, 5>>(); }
+
+// a set where a good part of the states can never get to the target
+void test_unsolvable_states() { checkTable<FuelMoves<2, 12, 8, 4>>(); }
+
+void test_four_tanks() { checkTable<FuelMoves<5, 9, 6, 4, 2>>(); }
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_room_tanks);
+    RUN_TEST(test_larger_tanks);
+    RUN_TEST(test_unsolvable_states);
+    RUN_TEST(test_four_tanks);
+    return UNITY_END();
+}